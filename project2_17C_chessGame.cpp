@@ -14,12 +14,264 @@
 // Used to perform sorting, searching, and other operations on STL containers.
 #include <tuple> 
 // Used to store and return multiple values from a function.
-#include <unordered_map> 
+#include <unordered_map>
 // Used to store and access chess pieces at specific board positions.
+#include <cstdint>
+// Used for the fixed-width 64-bit integers that hold the bitboards.
+#include <vector>
+// Used as the storage behind the undo stack.
+#include <cctype>
+// Used to read promotion letters regardless of case.
+#include <cstdlib>
+// Used to convert numeric command-line arguments and FEN fields.
+#include <chrono>
+// Used to time perft runs.
+#include <atomic>
+// Used for the transposition table entries that several search threads read and write at once.
+#include <thread>
+// Used to run the helper threads of the parallel search.
+#include <memory>
+// Used to own the per-thread search objects.
+#include <functional>
+// Used for the callback that reports each completed search iteration.
+#include <string_view>
+// Used to split FEN and EPD text into fields without copying it.
+#include <charconv>
+// Used to parse numbers straight out of a string_view.
+#include <type_traits>
+// Used to check that position snapshots stay plain data.
+#include <fstream>
+// Used to read EPD files.
+#include <sstream>
+// Used to build multi-line replies before writing them out in one piece.
+#include <cstring>
+// Used for character-set lookups while tokenizing PGN.
+#include <mutex>
+// Used to guard the shared state of the thread pool, the tablebase cache and the output streams.
+#include <deque>
+// Used for the task queues of the work-stealing thread pool.
+#include <queue>
+// Used to merge sorted runs when building the position index.
+#include <cstdio>
+// Used to delete the temporary run files.
+#include <condition_variable>
+// Used by the server's request queues to wake waiting workers.
+#include <cmath>
+// Used for the Elo and SPRT statistics of self-play matches.
+#include <cassert>
+// Used for debug checks of fixed-capacity buffers.
+#include <cerrno>
+// Used to tell a drained non-blocking socket from a failed one.
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+// POSIX sockets and Linux epoll, used by the server mode.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// POSIX file mapping, used to scan PGN archives in place and to read endgame tablebases.
+#include <dirent.h>
+// Used to list the tablebase files in a directory.
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+// Used for the PEXT instruction that indexes the sliding-piece attack tables when BMI2 is enabled,
+// and for the SSE2 and AVX2 network kernels.
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+// Used for the NEON network kernel.
+#endif
+#if defined(CHESS_INSTRUMENT) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+// Used to read the time-stamp counter for the instrumentation timers.
+#endif
 
-enum class Color { WHITE, BLACK }; 
+// Built-in instrumentation, compiled in only with -DCHESS_INSTRUMENT. It counts calls to the hot
+// paths of move generation, search and evaluation, and for some of them also the time spent inside,
+// read from the CPU's time-stamp counter where there is one and from steady_clock otherwise.
+//
+// Each thread adds to its own block of relaxed atomics, so the hot path never shares a cache line
+// with another thread and never takes a lock; a snapshot sums the blocks of all live threads plus
+// what exited threads left behind. Without CHESS_INSTRUMENT the INSTRUMENT_* macros expand to
+// nothing and the probes cost nothing at all; snapshots then report the instrumentation as disabled.
+enum class Probe {
+    LEGAL_MOVES,        // Timed: Board::generateLegalMovesFor.
+    IN_CHECK,           // Timed: Board::isInCheck.
+    SIMULATE_MOVE,      // Timed: Board::simulateMoveAndCheck.
+    MOVE_PIECE,         // Timed: Board::movePiece.
+    EVALUATE,           // Timed: Evaluator::evaluate and Network::evaluate.
+    TT_PROBE,           // Timed: TranspositionTable::probe.
+    TT_HIT,
+    SEARCH_NODE,
+    QUIESCENCE_NODE,
+    COUNT
+};
+
+const char* const PROBE_NAMES[static_cast<int>(Probe::COUNT)] = {
+    "legal_moves", "in_check", "simulate_move", "move_piece", "evaluate", "tt_probe", "tt_hit",
+    "search_node", "quiescence_node"
+};
+const bool PROBE_TIMED[static_cast<int>(Probe::COUNT)] = { true, true, true, true, true, true, false, false, false };
+
+#ifdef CHESS_INSTRUMENT
+inline std::uint64_t instrumentTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+class Instrumentation {
+public:
+    struct Block {
+        std::atomic<std::uint64_t> calls[static_cast<int>(Probe::COUNT)];
+        std::atomic<std::uint64_t> ticks[static_cast<int>(Probe::COUNT)];
+    };
+
+private:
+    std::mutex lock;
+    std::vector<Block*> live;
+    std::uint64_t retiredCalls[static_cast<int>(Probe::COUNT)] = {};
+    std::uint64_t retiredTicks[static_cast<int>(Probe::COUNT)] = {};
+    std::uint64_t startTicks;
+    std::chrono::steady_clock::time_point startTime;
+
+    // Registers the calling thread's block on first use and folds it into the totals on exit.
+    struct ThreadBlock {
+        Block block;
+        ThreadBlock();
+        ~ThreadBlock();
+    };
+
+public:
+    Instrumentation() : startTicks(instrumentTicks()), startTime(std::chrono::steady_clock::now()) {}
+
+    static Block& local() {
+        thread_local ThreadBlock mine;
+        return mine.block;
+    }
+
+    // A single writer per block, so a relaxed load and store is enough and avoids a locked add.
+    static void count(Probe probe) {
+        std::atomic<std::uint64_t>& calls = local().calls[static_cast<int>(probe)];
+        calls.store(calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    static void addTicks(Probe probe, std::uint64_t ticks) {
+        Block& block = local();
+        std::atomic<std::uint64_t>& calls = block.calls[static_cast<int>(probe)];
+        std::atomic<std::uint64_t>& total = block.ticks[static_cast<int>(probe)];
+        calls.store(calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+    }
+
+    // Totals over every thread so far, with 'seconds' converted from ticks.
+    void snapshot(std::uint64_t calls[], double seconds[]);
+};
+
+Instrumentation instrumentation;
+
+Instrumentation::ThreadBlock::ThreadBlock() {
+    for (auto& value : block.calls) value.store(0, std::memory_order_relaxed);
+    for (auto& value : block.ticks) value.store(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(instrumentation.lock);
+    instrumentation.live.push_back(&block);
+}
+
+Instrumentation::ThreadBlock::~ThreadBlock() {
+    std::lock_guard<std::mutex> guard(instrumentation.lock);
+    for (int i = 0; i < static_cast<int>(Probe::COUNT); ++i) {
+        instrumentation.retiredCalls[i] += block.calls[i].load(std::memory_order_relaxed);
+        instrumentation.retiredTicks[i] += block.ticks[i].load(std::memory_order_relaxed);
+    }
+    instrumentation.live.erase(std::find(instrumentation.live.begin(), instrumentation.live.end(), &block));
+}
+
+void Instrumentation::snapshot(std::uint64_t calls[], double seconds[]) {
+    std::uint64_t ticks[static_cast<int>(Probe::COUNT)];
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int i = 0; i < static_cast<int>(Probe::COUNT); ++i) {
+            calls[i] = retiredCalls[i];
+            ticks[i] = retiredTicks[i];
+            for (const Block* block : live) {
+                calls[i] += block->calls[i].load(std::memory_order_relaxed);
+                ticks[i] += block->ticks[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    // The tick rate is measured against steady_clock over the process's lifetime so far.
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    double elapsedTicks = static_cast<double>(instrumentTicks() - startTicks);
+    double secondsPerTick = elapsedTicks > 0 ? elapsed / elapsedTicks : 0;
+    for (int i = 0; i < static_cast<int>(Probe::COUNT); ++i) seconds[i] = ticks[i] * secondsPerTick;
+}
+
+// Adds the time from construction to destruction to a probe.
+class ScopedTimer {
+private:
+    Probe probe;
+    std::uint64_t start;
+
+public:
+    explicit ScopedTimer(Probe timed) : probe(timed), start(instrumentTicks()) {}
+    ~ScopedTimer() { Instrumentation::addTicks(probe, instrumentTicks() - start); }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+#define INSTRUMENT_COUNT(probe) Instrumentation::count(Probe::probe)
+#define INSTRUMENT_TIMER(probe) ScopedTimer INSTRUMENT_CONCAT(scopedTimer, __LINE__)(Probe::probe)
+#else
+#define INSTRUMENT_COUNT(probe) ((void)0)
+#define INSTRUMENT_TIMER(probe) ((void)0)
+#endif
+
+// Writes the counters as JSON, or in the Prometheus text format when 'prometheus' is set.
+void writeInstrumentation(std::ostream& out, bool prometheus) {
+#ifdef CHESS_INSTRUMENT
+    std::uint64_t calls[static_cast<int>(Probe::COUNT)];
+    double seconds[static_cast<int>(Probe::COUNT)];
+    instrumentation.snapshot(calls, seconds);
+    if (prometheus) {
+        out << "# TYPE chess_calls_total counter\n";
+        for (int i = 0; i < static_cast<int>(Probe::COUNT); ++i) {
+            out << "chess_calls_total{probe=\"" << PROBE_NAMES[i] << "\"} " << calls[i] << "\n";
+        }
+        out << "# TYPE chess_seconds_total counter\n";
+        for (int i = 0; i < static_cast<int>(Probe::COUNT); ++i) {
+            if (PROBE_TIMED[i]) out << "chess_seconds_total{probe=\"" << PROBE_NAMES[i] << "\"} " << seconds[i] << "\n";
+        }
+        return;
+    }
+    out << "{\"enabled\": true, \"probes\": {";
+    for (int i = 0; i < static_cast<int>(Probe::COUNT); ++i) {
+        out << (i ? ", " : "") << "\"" << PROBE_NAMES[i] << "\": {\"calls\": " << calls[i];
+        if (PROBE_TIMED[i]) {
+            out << ", \"seconds\": " << seconds[i]
+                << ", \"ns_per_call\": " << (calls[i] ? seconds[i] * 1e9 / calls[i] : 0);
+        }
+        out << "}";
+    }
+    out << "}}\n";
+#else
+    if (prometheus) out << "# instrumentation disabled; rebuild with -DCHESS_INSTRUMENT\n";
+    else out << "{\"enabled\": false}\n";
+#endif
+}
+
+enum class Color : std::uint8_t { WHITE, BLACK };
 // Enum class to represent the color of a chess piece.
 
+enum class PieceType : std::uint8_t { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING, NONE };
+// Enum class to represent the kind of a chess piece, independent of its color.
+
 class Position { 
 public: 
     char column;  
@@ -38,6 +290,21 @@ public:
         return std::tie(column, row) < std::tie(other.column, other.row);
     }
 // This function is used to compare two Position objects to determine their relative order.
+
+    bool isOnBoard() const {
+        return column >= 'a' && column <= 'h' && row >= 1 && row <= 8;
+    }
+// This function is used to check that a computed position lies inside the 8x8 board.
+
+    int toSquare() const {
+        return (row - 1) * 8 + (column - 'a');
+    }
+// This function converts the position to a square index from 0 (a1) to 63 (h8), as used by the bitboards.
+
+    static Position fromSquare(int square) {
+        return Position(static_cast<char>('a' + square % 8), square / 8 + 1);
+    }
+// This function converts a square index from 0 (a1) to 63 (h8) back into a Position.
 };
 
 namespace std {
@@ -52,382 +319,986 @@ namespace std {
 }
 // This function is used to hash Position objects to create a unique hash value for each position on the chess board.
 
-// Abstract base class representing a generic chess piece.
-class ChessPiece {
-protected:
-    Color color;            // The color of the piece (either WHITE or BLACK).
-    Position position;      // The current position of the piece on the chessboard.
-    bool hasMoved;          // Tracks whether the piece has moved (important for rules like castling or en passant).
-
-public:
-    // Constructor to initialize a chess piece with its color and position.
-    // By default, 'hasMoved' is set to false because the piece has not moved initially.
-    ChessPiece(Color c, Position p) : color(c), position(p), hasMoved(false) {}
+typedef std::uint64_t Bitboard;
+// A bitboard is a set of squares packed into 64 bits: bit 0 is a1, bit 7 is h1 and bit 63 is h8.
 
-    // Virtual destructor to ensure proper cleanup of derived classes when a ChessPiece pointer is deleted.
-    virtual ~ChessPiece() {}
+inline Bitboard squareBit(int square) { return Bitboard(1) << square; }
+// Returns a bitboard with only the given square set.
 
-    // Getter method to retrieve the color of the chess piece (WHITE or BLACK).
-    Color getColor() const { return color; }
+inline int lsb(Bitboard b) { return __builtin_ctzll(b); }
+// Returns the index of the lowest set square. The bitboard must not be empty.
 
-    // Getter method to retrieve the current position of the chess piece.
-    Position getPosition() const { return position; }
+inline int popLsb(Bitboard& b) {
+    int square = lsb(b);
+    b &= b - 1;
+    return square;
+}
+// Removes the lowest set square from the bitboard and returns its index.
 
-    // Setter method to update the position of the chess piece to a new position.
-    void setPosition(Position p) { position = p; }
+inline int popCount(Bitboard b) { return __builtin_popcountll(b); }
+// Returns the number of squares set in the bitboard.
 
-    // Method to check if the piece has moved before (returns the value of 'hasMoved').
-    bool hasMovedBefore() const { return hasMoved; }
+inline int pieceIndex(Color color, PieceType type) {
+    return (color == Color::WHITE ? 0 : 6) + static_cast<int>(type);
+}
+// Maps a color and piece type to one of the twelve piece bitboards (white pieces first, then black).
 
-    // Method to mark the piece as having moved. Sets 'hasMoved' to true.
-    void markAsMoved() { hasMoved = true; }
+inline Color opponent(Color color) { return color == Color::WHITE ? Color::BLACK : Color::WHITE; }
+// Returns the other side.
 
-    // Pure virtual method to calculate the legal moves for the chess piece.
-    // This must be implemented by all derived classes (e.g., Pawn, Rook, Knight).
-    // - 'board' represents the current state of the chessboard as an unordered_map,
-    //    mapping positions to chess pieces.
-    // - 'lastMovePos' stores the position of the last move (important for rules like en passant).
-    // - 'enPassantAvailable' is a flag indicating whether an en passant move is available.
-    virtual std::set<Position> legalMoves(
-        const std::unordered_map<Position, ChessPiece*, std::hash<Position>>& board,
-        const Position& lastMovePos,
-        bool enPassantAvailable
-    ) const = 0;
+inline int colorIndex(Color color) { return color == Color::WHITE ? 0 : 1; }
+// Maps a color to an array index (WHITE = 0, BLACK = 1).
 
-    // Pure virtual method to get a string representation of the piece.
-    // This will return a single-character string (e.g., "P" for white pawn, "r" for black rook).
-    virtual std::string toString() const = 0;
+// A colored piece in four bits: the piece type in the low three bits and the color in bit 3.
+// Empty squares hold NO_PIECE, whose type bits read as PieceType::NONE.
+enum Piece : std::uint8_t {
+    WHITE_PAWN = 0, WHITE_KNIGHT, WHITE_BISHOP, WHITE_ROOK, WHITE_QUEEN, WHITE_KING,
+    NO_PIECE = 6,
+    BLACK_PAWN = 8, BLACK_KNIGHT, BLACK_BISHOP, BLACK_ROOK, BLACK_QUEEN, BLACK_KING
 };
 
-class Pawn : public ChessPiece {
-public:
-    Pawn(Color c, Position p) : ChessPiece(c, p) {}
+inline Piece makePiece(Color color, PieceType type) {
+    return static_cast<Piece>((color == Color::WHITE ? 0 : 8) | static_cast<int>(type));
+}
+// Combines a color and a piece type into a Piece.
 
-    std::set<Position> legalMoves(const std::unordered_map<Position, ChessPiece*, std::hash<Position>>& board, 
-                                  const Position& lastMovePos, 
-                                  bool enPassantAvailable) const override {
-        std::set<Position> moves;
+inline PieceType typeOf(Piece piece) { return static_cast<PieceType>(piece & 7); }
+// Returns the type of the piece, or PieceType::NONE for NO_PIECE.
 
-        int direction = (color == Color::WHITE) ? 1 : -1;
+inline Color colorOf(Piece piece) { return (piece & 8) ? Color::BLACK : Color::WHITE; }
+// Returns the color of the piece. Meaningless for NO_PIECE.
 
-        Position oneStep(position.column, position.row + direction);
-        if (board.find(oneStep) == board.end()) { 
-            // No piece in the way
-            moves.insert(oneStep);
+inline char pieceSymbol(Piece piece) { return "PNBRQK. pnbrqk"[piece]; }
+// Returns the FEN letter of the piece (uppercase for White), or '.' for an empty square.
 
-            if (!hasMovedBefore()) {
-                Position twoStep(position.column, position.row + 2 * direction);
-                if (board.find(twoStep) == board.end()) {  
-                    // No piece in the way
-                    moves.insert(twoStep);
-                }
-            }
-        }
+// Bit flags for the four castling rights, stored together in BoardState::castlingRights.
+enum CastlingRight : std::uint8_t {
+    WHITE_KING_SIDE = 1,
+    WHITE_QUEEN_SIDE = 2,
+    BLACK_KING_SIDE = 4,
+    BLACK_QUEEN_SIDE = 8
+};
 
-        for (int dc = -1; dc <= 1; dc += 2) { 
-            // Looping for left and right diagonal positions
-            Position capturePos(position.column + dc, position.row + direction);
-            if (board.find(capturePos) != board.end() && board.at(capturePos)->getColor() != color) {
-                moves.insert(capturePos); 
-                // Opponent's piece found, valid capture move
-            }
-        }
+// Random 64-bit keys for Zobrist hashing: a position's key is the XOR of one key per piece on its
+// square, plus keys for black to move, the castling rights and the en passant file. A move changes
+// only a few of these terms, so the key is updated with a handful of XORs.
+struct ZobristKeys {
+    std::uint64_t pieces[12][64];   // Indexed by pieceIndex() and square.
+    std::uint64_t blackToMove;
+    std::uint64_t castling[16];     // Indexed by the full castlingRights bit set.
+    std::uint64_t enPassantFile[8];
 
-        // Check for en passant capture
-        if (enPassantAvailable && !hasMovedBefore()) {
-            // Check left and right squares
-            Position leftEnPassant(position.column - 1, position.row);
-            Position rightEnPassant(position.column + 1, position.row);
-            if (lastMovePos == leftEnPassant || lastMovePos == rightEnPassant) {
-                ChessPiece* adjacentPawn = board.at(lastMovePos);
-                if (adjacentPawn && adjacentPawn->toString() == (color == Color::WHITE ? "p" : "P") && !adjacentPawn->hasMovedBefore()) {
-                    Position enPassantPos(lastMovePos.column, position.row + direction);
-                    moves.insert(enPassantPos);
-                }
-            }
+    ZobristKeys() {
+        // SplitMix64 with a fixed seed, so keys (and anything stored under them) are stable between runs.
+        std::uint64_t seed = 0x2545F4914F6CDD1DULL;
+        auto next = [&seed]() {
+            std::uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        };
+        for (auto& piece : pieces) {
+            for (std::uint64_t& key : piece) key = next();
         }
-
-        return moves;  // Return all valid legal moves for this pawn
+        blackToMove = next();
+        for (std::uint64_t& key : castling) key = next();
+        for (std::uint64_t& key : enPassantFile) key = next();
     }
+};
+
+const ZobristKeys zobrist;
+// The single set of Zobrist keys, initialized before main() runs.
+
+// A middlegame and an endgame score packed into one 32-bit integer: the endgame half in the upper
+// 16 bits and the middlegame half in the lower 16. Both halves are added and subtracted together with
+// ordinary integer arithmetic, so keeping the two running totals costs one addition per piece.
+typedef std::int32_t Score;
+
+inline Score makeScore(int middlegame, int endgame) {
+    return static_cast<Score>(static_cast<std::uint32_t>(endgame) << 16) + middlegame;
+}
+
+inline int middlegameValue(Score score) {
+    return static_cast<std::int16_t>(static_cast<std::uint16_t>(static_cast<std::uint32_t>(score)));
+}
+
+inline int endgameValue(Score score) {
+    // Adding 0x8000 first corrects for the borrow a negative middlegame half takes from the upper half.
+    return static_cast<std::int16_t>(static_cast<std::uint16_t>((static_cast<std::uint32_t>(score) + 0x8000) >> 16));
+}
+
+const int PHASE_WEIGHTS[6] = { 0, 1, 1, 2, 4, 0 };
+// Game phase contributed by each piece type; the starting position adds up to MAX_PHASE.
+const int MAX_PHASE = 24;
+const int PIECE_VALUES[6] = { 100, 320, 330, 500, 900, 0 };
+// Material values in centipawns, indexed by PieceType.
+
+// Material plus piece-square values for every piece on every square, from White's point of view
+// (Black's entries are negated and mirrored). Increments are looked up here as pieces move, so the
+// board always holds the sum for the whole position.
+struct PieceSquareTables {
+    Score scores[12][64];   // Indexed by pieceIndex() and square.
+
+    PieceSquareTables() {
+        const int middlegameMaterial[6] = { 82, 337, 365, 477, 1025, 0 };
+        const int endgameMaterial[6] = { 94, 281, 297, 512, 936, 0 };
 
-    std::string toString() const override {
-        return color == Color::WHITE ? "P" : "p";
+        // Tables are written as seen from White's side, rank 8 first, so square a1 is entry 56.
+        static const int middlegame[6][64] = {
+            {  0,  0,  0,  0,  0,  0,  0,  0,   50, 50, 50, 50, 50, 50, 50, 50,
+              10, 10, 20, 30, 30, 20, 10, 10,    5,  5, 10, 25, 25, 10,  5,  5,
+               0,  0,  0, 20, 20,  0,  0,  0,    5, -5,-10,  0,  0,-10, -5,  5,
+               5, 10, 10,-20,-20, 10, 10,  5,    0,  0,  0,  0,  0,  0,  0,  0 },
+            {-50,-40,-30,-30,-30,-30,-40,-50,  -40,-20,  0,  0,  0,  0,-20,-40,
+             -30,  0, 10, 15, 15, 10,  0,-30,  -30,  5, 15, 20, 20, 15,  5,-30,
+             -30,  0, 15, 20, 20, 15,  0,-30,  -30,  5, 10, 15, 15, 10,  5,-30,
+             -40,-20,  0,  5,  5,  0,-20,-40,  -50,-40,-30,-30,-30,-30,-40,-50 },
+            {-20,-10,-10,-10,-10,-10,-10,-20,  -10,  0,  0,  0,  0,  0,  0,-10,
+             -10,  0,  5, 10, 10,  5,  0,-10,  -10,  5,  5, 10, 10,  5,  5,-10,
+             -10,  0, 10, 10, 10, 10,  0,-10,  -10, 10, 10, 10, 10, 10, 10,-10,
+             -10,  5,  0,  0,  0,  0,  5,-10,  -20,-10,-10,-10,-10,-10,-10,-20 },
+            {  0,  0,  0,  0,  0,  0,  0,  0,    5, 10, 10, 10, 10, 10, 10,  5,
+              -5,  0,  0,  0,  0,  0,  0, -5,   -5,  0,  0,  0,  0,  0,  0, -5,
+              -5,  0,  0,  0,  0,  0,  0, -5,   -5,  0,  0,  0,  0,  0,  0, -5,
+              -5,  0,  0,  0,  0,  0,  0, -5,    0,  0,  0,  5,  5,  0,  0,  0 },
+            {-20,-10,-10, -5, -5,-10,-10,-20,  -10,  0,  0,  0,  0,  0,  0,-10,
+             -10,  0,  5,  5,  5,  5,  0,-10,   -5,  0,  5,  5,  5,  5,  0, -5,
+               0,  0,  5,  5,  5,  5,  0, -5,  -10,  5,  5,  5,  5,  5,  0,-10,
+             -10,  0,  5,  0,  0,  0,  0,-10,  -20,-10,-10, -5, -5,-10,-10,-20 },
+            {-30,-40,-40,-50,-50,-40,-40,-30,  -30,-40,-40,-50,-50,-40,-40,-30,
+             -30,-40,-40,-50,-50,-40,-40,-30,  -30,-40,-40,-50,-50,-40,-40,-30,
+             -20,-30,-30,-40,-40,-30,-30,-20,  -10,-20,-20,-20,-20,-20,-20,-10,
+              20, 20,  0,  0,  0,  0, 20, 20,   20, 30, 10,  0,  0, 10, 30, 20 }
+        };
+        // In the endgame passed pawns matter more than structure and the king belongs in the centre;
+        // the minor and major pieces keep their middlegame tables.
+        static const int endgamePawn[64] = {
+              0,  0,  0,  0,  0,  0,  0,  0,   90, 90, 90, 90, 90, 90, 90, 90,
+             60, 60, 60, 60, 60, 60, 60, 60,   35, 35, 35, 35, 35, 35, 35, 35,
+             20, 20, 20, 20, 20, 20, 20, 20,   10, 10, 10, 10, 10, 10, 10, 10,
+              0,  0,  0,  0,  0,  0,  0,  0,    0,  0,  0,  0,  0,  0,  0,  0 };
+        static const int endgameKing[64] = {
+            -50,-40,-30,-20,-20,-30,-40,-50,  -30,-20,-10,  0,  0,-10,-20,-30,
+            -30,-10, 20, 30, 30, 20,-10,-30,  -30,-10, 30, 40, 40, 30,-10,-30,
+            -30,-10, 30, 40, 40, 30,-10,-30,  -30,-10, 20, 30, 30, 20,-10,-30,
+            -30,-30,  0,  0,  0,  0,-30,-30,  -50,-30,-30,-30,-30,-30,-30,-50 };
+
+        for (int type = 0; type < 6; ++type) {
+            const int* endgame = type == 0 ? endgamePawn : type == 5 ? endgameKing : middlegame[type];
+            for (int square = 0; square < 64; ++square) {
+                // White looks the square up from the top of the table; Black sees the board flipped.
+                int whiteEntry = square ^ 56;
+                int blackEntry = square;
+                scores[type][square] = makeScore(middlegameMaterial[type] + middlegame[type][whiteEntry],
+                                                 endgameMaterial[type] + endgame[whiteEntry]);
+                scores[6 + type][square] = -makeScore(middlegameMaterial[type] + middlegame[type][blackEntry],
+                                                      endgameMaterial[type] + endgame[blackEntry]);
+            }
+        }
     }
 };
 
-class Rook : public ChessPiece {
-public:
+const PieceSquareTables pieceSquareTables;
+// The single set of piece-square tables, initialized before main() runs.
 
-    Rook(Color c, Position p) : ChessPiece(c, p) {}
+// Flat bitboard representation of a position: twelve piece bitboards plus the side to move,
+// castling rights and en passant square. It holds no pointers, so copying it is a plain memory copy.
+// Alongside the bitboards a 64-byte mailbox answers "what stands on this square" with one load.
+//
+// This is the position snapshot handed between threads and kept for analysis branches: it is
+// trivially copyable and fits in three cache lines (checked below), so taking or restoring one is a
+// fixed-size memcpy with no allocation. Fields are ordered largest first so nothing is padded.
+struct BoardState {
+    Bitboard pieces[12];        // One bitboard per color and piece type, indexed by pieceIndex().
+    std::uint64_t hash;         // Zobrist key of the position, kept current by Board::makeMove().
+    Score psqt;                 // Sum of material and piece-square values, White's point of view.
+    Piece mailbox[64];          // The piece on each square, or NO_PIECE; always agrees with 'pieces'.
+    std::uint16_t halfmoveClock; // Plies since the last capture or pawn move.
+    std::uint16_t fullmoveNumber; // Starts at 1 and increases after each Black move.
+    Color turn;                 // The color of the player who is to move.
+    std::uint8_t castlingRights; // CastlingRight flags still available.
+    std::int8_t enPassantSquare; // Square a pawn may capture onto en passant, or -1 if there is none.
+    std::uint8_t kingSquare[2]; // Cached square of each king, indexed by colorIndex().
+    std::uint8_t phase;         // Sum of PHASE_WEIGHTS over the pieces on the board.
 
-    std::set<Position> legalMoves(const std::unordered_map<Position, ChessPiece*, std::hash<Position>>& board, const Position& lastMovePos, bool enPassantAvailable) const override {
-        std::set<Position> moves;
+    // Empties the board and resets the side to move and special-move state.
+    void clear() {
+        for (Bitboard& b : pieces) b = 0;
+        for (Piece& piece : mailbox) piece = NO_PIECE;
+        turn = Color::WHITE;
+        castlingRights = 0;
+        enPassantSquare = -1;
+        halfmoveClock = 0;
+        fullmoveNumber = 1;
+        kingSquare[0] = kingSquare[1] = 0;
+        hash = computeHash();
+        psqt = computePsqt();
+        phase = computePhase();
+    }
 
-        for (int i = 1; i <= 8; ++i) {
-            if (i != position.row) moves.insert(Position(position.column, i));
+    // Computes the Zobrist key from scratch. Used when a position is set up; moves update it incrementally.
+    std::uint64_t computeHash() const {
+        std::uint64_t key = 0;
+        for (int i = 0; i < 12; ++i) {
+            Bitboard b = pieces[i];
+            while (b) key ^= zobrist.pieces[i][popLsb(b)];
         }
+        if (turn == Color::BLACK) key ^= zobrist.blackToMove;
+        key ^= zobrist.castling[castlingRights];
+        if (enPassantSquare >= 0) key ^= zobrist.enPassantFile[enPassantSquare % 8];
+        return key;
+    }
 
-        for (int i = 1; i <= 8; ++i) {
-            if (i != position.column - 'a' + 1) moves.insert(Position('a' + i - 1, position.row));
+    // Computes the material and piece-square sum from scratch. Moves update it incrementally.
+    Score computePsqt() const {
+        Score total = 0;
+        for (int i = 0; i < 12; ++i) {
+            Bitboard b = pieces[i];
+            while (b) total += pieceSquareTables.scores[i][popLsb(b)];
         }
+        return total;
+    }
 
-        return moves; 
-        // Return all valid legal moves for this rook.
+    // Computes the game phase from scratch. Moves update it incrementally.
+    std::uint8_t computePhase() const {
+        int total = 0;
+        for (int i = 0; i < 12; ++i) total += PHASE_WEIGHTS[i % 6] * popCount(pieces[i]);
+        return static_cast<std::uint8_t>(total);
     }
 
-    std::string toString() const override {
-        return color == Color::WHITE ? "R" : "r"; 
-        // Return 'R' for white rook, 'r' for black rook.
+    // Returns all squares occupied by pieces of the given color.
+    Bitboard occupancy(Color color) const {
+        const Bitboard* p = pieces + pieceIndex(color, PieceType::PAWN);
+        return p[0] | p[1] | p[2] | p[3] | p[4] | p[5];
     }
-};
 
-class Knight : public ChessPiece {
-public:
-    Knight(Color c, Position p) : ChessPiece(c, p) {}
+    // Returns all occupied squares.
+    Bitboard occupancy() const { return occupancy(Color::WHITE) | occupancy(Color::BLACK); }
 
-    // Calculates the legal moves of a knight. A knight moves in an "L" shape: two squares in one direction and then one square perpendicular.
-    std::set<Position> legalMoves(const std::unordered_map<Position, ChessPiece*, std::hash<Position>>& board, const Position& lastMovePos, bool enPassantAvailable) const override {
-        std::set<Position> moves;
+    // Returns the squares holding pieces of the given color and type.
+    Bitboard piecesOf(Color color, PieceType type) const { return pieces[pieceIndex(color, type)]; }
 
-        const int dx[] = { 2, 2, -2, -2, 1, 1, -1, -1 };  
-        // Horizontal moves (2 steps forward/backward and 1 step left/right)
-        const int dy[] = { 1, -1, 1, -1, 2, -2, 2, -2 }; 
-        // Vertical moves (1 step up/down and 2 steps left/right)
+    bool isOccupied(int square) const { return (occupancy() & squareBit(square)) != 0; }
 
-        for (int i = 0; i < 8; ++i) {
-            // Calculate the new row and column after applying the move.
-            int newRow = position.row + dx[i];  
-            // Add the horizontal movement
-            int newCol = position.column + dy[i]; 
-            // Add the vertical movement
+    // Returns the color of the piece on the square. The square must be occupied.
+    Color colorAt(int square) const { return colorOf(mailbox[square]); }
 
-            // Check if the new position is within the bounds of the chessboard (1-8 for rows and 'a'-'h' for columns).
-            if (newRow >= 1 && newRow <= 8 && newCol >= 'a' && newCol <= 'h') {
-                // If the move is within bounds, add it to the set of possible moves.
-                moves.insert(Position(newCol, newRow));
-            }
-        }
+    // Returns the type of the piece on the square, or PieceType::NONE if the square is empty.
+    PieceType pieceTypeAt(int square) const { return typeOf(mailbox[square]); }
 
-        return moves;  
-        // Return all valid legal moves for this knight.
+    void addPiece(Color color, PieceType type, int square) {
+        pieces[pieceIndex(color, type)] |= squareBit(square);
+        mailbox[square] = makePiece(color, type);
     }
+    void removePiece(Color color, PieceType type, int square) {
+        pieces[pieceIndex(color, type)] &= ~squareBit(square);
+        mailbox[square] = NO_PIECE;
+    }
+};
+
+static_assert(std::is_trivially_copyable<BoardState>::value, "BoardState snapshots must be plain memory copies");
+static_assert(sizeof(BoardState) <= 192, "BoardState snapshots must fit in three cache lines");
+
+// Magic bitboard entry for one square of a sliding piece. The relevant blockers of 'occupied' are
+// hashed into an index into that square's slice of the attack table.
+struct Magic {
+    Bitboard mask;      // Squares whose occupancy can block the slider (board edges excluded).
+    Bitboard magic;     // Multiplier that maps every blocker subset to a distinct table index.
+    Bitboard* attacks;  // Start of this square's slice of the shared attack table.
+    unsigned shift;     // 64 minus the number of bits in 'mask'.
 
-    std::string toString() const override {
-        return color == Color::WHITE ? "N" : "n";  
-        // Return 'N' for white knight, 'n' for black knight.
+    unsigned index(Bitboard occupied) const {
+#ifdef __BMI2__
+        // With BMI2 the blocker bits can be gathered directly and no multiplier is needed.
+        return static_cast<unsigned>(_pext_u64(occupied, mask));
+#else
+        return static_cast<unsigned>(((occupied & mask) * magic) >> shift);
+#endif
     }
 };
 
-class Bishop : public ChessPiece {
+// Attack sets for every piece type, built once at startup. Knight, king and pawn attacks are fixed
+// masks per square; rook and bishop attacks are looked up through magic bitboards, so a sliding
+// attack query costs a mask, a multiply, a shift and one table load.
+class AttackTables {
+private:
+    Bitboard rookTable[0x19000];   // 102400 entries shared by all 64 rook squares.
+    Bitboard bishopTable[0x1480];  // 5248 entries shared by all 64 bishop squares.
+
+    static Bitboard slidingAttacks(int square, Bitboard occupied, const int (*directions)[2]);
+    void initMagics(Magic magics[64], Bitboard* table, const int (*directions)[2]);
+
 public:
+    Bitboard knight[64];
+    Bitboard king[64];
+    Bitboard pawn[2][64];     // Squares a pawn of each color attacks, indexed [WHITE/BLACK][square].
+    Magic rookMagics[64];
+    Magic bishopMagics[64];
+    Bitboard between[64][64]; // Squares strictly between two squares on a shared line, otherwise empty.
+    Bitboard line[64][64];    // The full rank, file or diagonal through two squares, otherwise empty.
 
-    Bishop(Color c, Position p) : ChessPiece(c, p) {}
-
-    // Calculates the legal moves of a bishop. A bishop can move diagonally in any direction.
-    std::set<Position> legalMoves(const std::unordered_map<Position, ChessPiece*, std::hash<Position>>& board, const Position& lastMovePos, bool enPassantAvailable) const override {
-        std::set<Position> moves;
-
-        // Diagonal movement (Corrected logic)
-        for (int i = 1; i <= 8; ++i) {
-            // Top-Right Diagonal
-            Position topRight(position.column + i, position.row + i);
-            if (topRight.row >= 1 && topRight.row <= 8 && topRight.column >= 'a' && topRight.column <= 'h') {
-                if (board.find(topRight) == board.end() || board.at(topRight)->getColor() != color) {
-                    moves.insert(topRight);
-                    if (board.find(topRight) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
-                }
-            }
+    AttackTables();
+};
 
-            // Top-Left Diagonal
-            Position topLeft(position.column - i, position.row + i);
-            if (topLeft.row >= 1 && topLeft.row <= 8 && topLeft.column >= 'a' && topLeft.column <= 'h') {
-                if (board.find(topLeft) == board.end() || board.at(topLeft)->getColor() != color) {
-                    moves.insert(topLeft);
-                    if (board.find(topLeft) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
-                }
-            }
+const int ROOK_DIRECTIONS[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+const int BISHOP_DIRECTIONS[4][2] = { { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+// Direction vectors for the sliding pieces as { column step, row step }.
 
-            // Bottom-Right Diagonal
-            Position bottomRight(position.column + i, position.row - i);
-            if (bottomRight.row >= 1 && bottomRight.row <= 8 && bottomRight.column >= 'a' && bottomRight.column <= 'h') {
-                if (board.find(bottomRight) == board.end() || board.at(bottomRight)->getColor() != color) {
-                    moves.insert(bottomRight);
-                    if (board.find(bottomRight) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
+// Computes slider attacks by walking each ray until it leaves the board or hits a piece.
+// Only used to fill the tables; the blocking piece itself is included in the result.
+Bitboard AttackTables::slidingAttacks(int square, Bitboard occupied, const int (*directions)[2]) {
+    Bitboard attacks = 0;
+    for (int d = 0; d < 4; ++d) {
+        int file = square % 8 + directions[d][0];
+        int rank = square / 8 + directions[d][1];
+        while (file >= 0 && file < 8 && rank >= 0 && rank < 8) {
+            Bitboard bit = squareBit(rank * 8 + file);
+            attacks |= bit;
+            if (occupied & bit) break;
+            file += directions[d][0];
+            rank += directions[d][1];
+        }
+    }
+    return attacks;
+}
+
+// Fills the magic entries and attack table for one slider. For every square it enumerates all
+// blocker subsets of the mask, then searches for a sparse random multiplier that sends each subset
+// to a slot holding the right attack set (constructive collisions are allowed).
+void AttackTables::initMagics(Magic magics[64], Bitboard* table, const int (*directions)[2]) {
+    const Bitboard fileAH = 0x8181818181818181ULL;
+    const Bitboard rank18 = 0xFF000000000000FFULL;
+    Bitboard occupancies[4096], reference[4096];
+#ifndef __BMI2__
+    int epoch[4096] = {};
+    int attempt = 0;
+    // xorshift64* generator reseeded per rank with values known to find magics quickly, so the
+    // tables come out the same on every run and take only a few milliseconds to build.
+    const Bitboard seeds[8] = { 728, 10316, 55013, 32803, 12281, 15100, 16645, 255 };
+    Bitboard seed = 0;
+    auto random = [&seed]() {
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        return seed * 2685821657736338717ULL;
+    };
+#endif
+
+    Bitboard* next = table;
+    for (int square = 0; square < 64; ++square) {
+        // Edge squares never block, unless the slider itself stands on that edge.
+        Bitboard edges = (rank18 & ~(Bitboard(0xFF) << (square / 8 * 8))) |
+                         (fileAH & ~(0x0101010101010101ULL << (square % 8)));
+        Magic& m = magics[square];
+        m.mask = slidingAttacks(square, 0, directions) & ~edges;
+        m.shift = 64 - popCount(m.mask);
+        m.attacks = next;
+
+        // Carry-Rippler enumeration of every subset of the mask.
+        int size = 0;
+        Bitboard subset = 0;
+        do {
+            occupancies[size] = subset;
+            reference[size] = slidingAttacks(square, subset, directions);
+            ++size;
+            subset = (subset - m.mask) & m.mask;
+        } while (subset);
+        next += size;
+
+#ifdef __BMI2__
+        m.magic = 0;
+        for (int i = 0; i < size; ++i) m.attacks[m.index(occupancies[i])] = reference[i];
+#else
+        seed = seeds[square / 8];
+        for (int i = 0; i < size; ) {
+            do {
+                m.magic = random() & random() & random();
+            } while (popCount((m.magic * m.mask) >> 56) < 6);
+
+            ++attempt;
+            for (i = 0; i < size; ++i) {
+                unsigned idx = m.index(occupancies[i]);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m.attacks[idx] = reference[i];
+                } else if (m.attacks[idx] != reference[i]) {
+                    break;
                 }
             }
+        }
+#endif
+    }
+}
 
-            // Bottom-Left Diagonal
-            Position bottomLeft(position.column - i, position.row - i);
-            if (bottomLeft.row >= 1 && bottomLeft.row <= 8 && bottomLeft.column >= 'a' && bottomLeft.column <= 'h') {
-                if (board.find(bottomLeft) == board.end() || board.at(bottomLeft)->getColor() != color) {
-                    moves.insert(bottomLeft);
-                    if (board.find(bottomLeft) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
-                }
+AttackTables::AttackTables() {
+    const int knightSteps[8][2] = { { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 }, { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 } };
+
+    for (int square = 0; square < 64; ++square) {
+        int file = square % 8, rank = square / 8;
+        knight[square] = king[square] = 0;
+        pawn[0][square] = pawn[1][square] = 0;
+
+        for (const auto& step : knightSteps) {
+            int f = file + step[0], r = rank + step[1];
+            if (f >= 0 && f < 8 && r >= 0 && r < 8) knight[square] |= squareBit(r * 8 + f);
+        }
+        for (int df = -1; df <= 1; ++df) {
+            for (int dr = -1; dr <= 1; ++dr) {
+                int f = file + df, r = rank + dr;
+                if ((df || dr) && f >= 0 && f < 8 && r >= 0 && r < 8) king[square] |= squareBit(r * 8 + f);
             }
         }
+        for (int df = -1; df <= 1; df += 2) {
+            int f = file + df;
+            if (f < 0 || f >= 8) continue;
+            if (rank < 7) pawn[0][square] |= squareBit((rank + 1) * 8 + f);
+            if (rank > 0) pawn[1][square] |= squareBit((rank - 1) * 8 + f);
+        }
+    }
 
-        return moves; 
+    initMagics(rookMagics, rookTable, ROOK_DIRECTIONS);
+    initMagics(bishopMagics, bishopTable, BISHOP_DIRECTIONS);
+
+    for (int a = 0; a < 64; ++a) {
+        for (int b = 0; b < 64; ++b) {
+            between[a][b] = line[a][b] = 0;
+            if (a == b) continue;
+            const int (*directions)[2] = nullptr;
+            if (slidingAttacks(a, 0, ROOK_DIRECTIONS) & squareBit(b)) directions = ROOK_DIRECTIONS;
+            else if (slidingAttacks(a, 0, BISHOP_DIRECTIONS) & squareBit(b)) directions = BISHOP_DIRECTIONS;
+            if (!directions) continue;
+            between[a][b] = slidingAttacks(a, squareBit(b), directions) & slidingAttacks(b, squareBit(a), directions);
+            line[a][b] = (slidingAttacks(a, 0, directions) & slidingAttacks(b, 0, directions)) | squareBit(a) | squareBit(b);
+        }
     }
+}
+
+const AttackTables attackTables;
+// The single set of attack tables, initialized before main() runs.
+
+inline Bitboard rookAttacks(int square, Bitboard occupied) {
+    const Magic& m = attackTables.rookMagics[square];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard bishopAttacks(int square, Bitboard occupied) {
+    const Magic& m = attackTables.bishopMagics[square];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard queenAttacks(int square, Bitboard occupied) {
+    return rookAttacks(square, occupied) | bishopAttacks(square, occupied);
+}
 
-    std::string toString() const override {
-        return color == Color::WHITE ? "B" : "b"; 
-        // Return 'B' for white bishop, 'b' for black bishop.
+inline Bitboard pawnAttacks(Color color, int square) {
+    return attackTables.pawn[colorIndex(color)][square];
+}
+// Attack queries for each piece type. 'occupied' is every piece on the board; the result includes
+// the first blocker in each direction, whichever side it belongs to.
+
+// Returns the attacks of a knight, bishop, rook, queen or king standing on the square.
+inline Bitboard pieceAttacks(PieceType type, int square, Bitboard occupied) {
+    switch (type) {
+        case PieceType::KNIGHT: return attackTables.knight[square];
+        case PieceType::BISHOP: return bishopAttacks(square, occupied);
+        case PieceType::ROOK: return rookAttacks(square, occupied);
+        case PieceType::QUEEN: return queenAttacks(square, occupied);
+        case PieceType::KING: return attackTables.king[square];
+        default: return 0;
     }
-};
+}
+
+// Returns the pieces of 'attacker' that attack the square, given the occupancy to use for sliders.
+inline Bitboard attackersTo(const BoardState& state, int square, Color attacker, Bitboard occupied) {
+    const Bitboard queens = state.piecesOf(attacker, PieceType::QUEEN);
+    return (pawnAttacks(opponent(attacker), square) & state.piecesOf(attacker, PieceType::PAWN)) |
+           (attackTables.knight[square] & state.piecesOf(attacker, PieceType::KNIGHT)) |
+           (attackTables.king[square] & state.piecesOf(attacker, PieceType::KING)) |
+           (bishopAttacks(square, occupied) & (state.piecesOf(attacker, PieceType::BISHOP) | queens)) |
+           (rookAttacks(square, occupied) & (state.piecesOf(attacker, PieceType::ROOK) | queens));
+}
+
+// A move packed into 16 bits: bits 0-5 hold the from square, bits 6-11 the to square and
+// bits 12-15 the flags below. Promotions set the PROMOTION bit and store the new piece in the
+// low two flag bits (0 = knight, 1 = bishop, 2 = rook, 3 = queen), combined with CAPTURE if needed.
+class Move {
+private:
+    std::uint16_t data;
 
-class Queen : public ChessPiece {
 public:
-    // Constructor initializes the Queen with a color and position.
-    Queen(Color c, Position p) : ChessPiece(c, p) {}
-
-    std::set<Position> legalMoves(const std::unordered_map<Position, ChessPiece*, std::hash<Position>>& board, const Position& lastMovePos, bool enPassantAvailable) const override {
-        std::set<Position> moves;
-        for (int i = 1; i <= 8; ++i) {
-            if (i != position.row) moves.insert(Position(position.column, i)); 
-            // Adds vertical moves.
-            if (i != position.column - 'a' + 1) moves.insert(Position('a' + i - 1, position.row));  
-            // Adds horizontal moves.
-        }
-
-        // Diagonal movement (Corrected logic)
-        for (int i = 1; i <= 8; ++i) {
-            // Top-Right Diagonal
-            Position topRight(position.column + i, position.row + i);
-            if (topRight.row >= 1 && topRight.row <= 8 && topRight.column >= 'a' && topRight.column <= 'h') {
-                if (board.find(topRight) == board.end() || board.at(topRight)->getColor() != color) {
-                    moves.insert(topRight);
-                    if (board.find(topRight) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
-                }
-            }
+    enum Flag {
+        QUIET = 0,
+        DOUBLE_PAWN_PUSH = 1,
+        KING_CASTLE = 2,
+        QUEEN_CASTLE = 3,
+        CAPTURE = 4,
+        EN_PASSANT = 5,
+        PROMOTION = 8
+    };
 
-            // Top-Left Diagonal
-            Position topLeft(position.column - i, position.row + i);
-            if (topLeft.row >= 1 && topLeft.row <= 8 && topLeft.column >= 'a' && topLeft.column <= 'h') {
-                if (board.find(topLeft) == board.end() || board.at(topLeft)->getColor() != color) {
-                    moves.insert(topLeft);
-                    if (board.find(topLeft) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
-                }
-            }
+    Move() = default;
+    // Left uninitialized so that a MoveList can be created without touching its 256 slots.
 
-            // Bottom-Right Diagonal
-            Position bottomRight(position.column + i, position.row - i);
-            if (bottomRight.row >= 1 && bottomRight.row <= 8 && bottomRight.column >= 'a' && bottomRight.column <= 'h') {
-                if (board.find(bottomRight) == board.end() || board.at(bottomRight)->getColor() != color) {
-                    moves.insert(bottomRight);
-                    if (board.find(bottomRight) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
-                }
-            }
+    Move(int from, int to, int flags) : data(static_cast<std::uint16_t>(from | (to << 6) | (flags << 12))) {}
 
-            // Bottom-Left Diagonal
-            Position bottomLeft(position.column - i, position.row - i);
-            if (bottomLeft.row >= 1 && bottomLeft.row <= 8 && bottomLeft.column >= 'a' && bottomLeft.column <= 'h') {
-                if (board.find(bottomLeft) == board.end() || board.at(bottomLeft)->getColor() != color) {
-                    moves.insert(bottomLeft);
-                    if (board.find(bottomLeft) != board.end()) {
-                        break; // Stop if we encounter a piece (own or opponent's)
-                    }
-                }
-            }
-        }
+    static Move none() { return Move(0, 0, QUIET); }
+    // The null move (a1 to a1), used to mean "no move".
+
+    static Move fromRaw(std::uint16_t raw) {
+        Move move;
+        move.data = raw;
+        return move;
+    }
+    // Rebuilds a move from the 16 bits returned by raw(), e.g. when read back from a table or file.
 
-        return moves;  
-        // Returns the legal moves for the queen (incomplete for full movement logic).
+    int from() const { return data & 63; }
+    int to() const { return (data >> 6) & 63; }
+    int flags() const { return data >> 12; }
+    std::uint16_t raw() const { return data; }
+
+    bool isNone() const { return data == 0; }
+    bool isCapture() const { return (flags() & CAPTURE) != 0; }
+    bool isPromotion() const { return (flags() & PROMOTION) != 0; }
+    bool isEnPassant() const { return flags() == EN_PASSANT; }
+    bool isCastle() const { return flags() == KING_CASTLE || flags() == QUEEN_CASTLE; }
+    PieceType promotionType() const { return static_cast<PieceType>(static_cast<int>(PieceType::KNIGHT) + (flags() & 3)); }
+
+    bool operator==(const Move& other) const { return data == other.data; }
+    bool operator!=(const Move& other) const { return data != other.data; }
+
+    // Returns the move in coordinate notation, e.g. "e2e4" or "e7e8q".
+    std::string toString() const {
+        std::string text;
+        Position fromPos = Position::fromSquare(from());
+        Position toPos = Position::fromSquare(to());
+        text += fromPos.column;
+        text += static_cast<char>('0' + fromPos.row);
+        text += toPos.column;
+        text += static_cast<char>('0' + toPos.row);
+        if (isPromotion()) text += "nbrq"[flags() & 3];
+        return text;
     }
+};
 
-    std::string toString() const override {
-        return color == Color::WHITE ? "Q" : "q";  // Return 'Q' for white queen, 'q' for black queen.
+const int MAX_MOVES = 324;
+// No position reachable by legal play has more than 218 legal moves, but loaded positions need not
+// be reachable. parseFEN(), which every FEN, EPD and PGN loader goes through, accepts only the
+// material promotions can produce: besides the king, at most fifteen pieces and at most nine
+// queens. A queen has up to 27 moves and every other piece fewer, so the most a side can have is with
+// nine queens and the two rooks, bishops and knights: 9 * 27 + 2 * 14 + 2 * 13 + 2 * 8 + 8 (king)
+// + 2 (castling) = 323 moves, and 324 slots suffice for every accepted position.
+
+// Fixed-capacity list of moves meant to live on the stack, so move generation never allocates.
+struct MoveList {
+    Move moves[MAX_MOVES];
+    int count;
+
+    MoveList() : count(0) {}
+
+    void add(Move move) {
+        assert(count < MAX_MOVES);
+        moves[count++] = move;
     }
+    void clear() { count = 0; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    Move& operator[](int i) { return moves[i]; }
+    Move operator[](int i) const { return moves[i]; }
+    Move* begin() { return moves; }
+    Move* end() { return moves + count; }
+    const Move* begin() const { return moves; }
+    const Move* end() const { return moves + count; }
+};
+
+// Optional neural network evaluation (NNUE: an efficiently updatable neural network). The network
+// has one hidden layer, seen from both sides: 768 inputs, one per piece type and color on each square,
+// feed NNUE_HIDDEN neurons, computed once from White's point of view and once from Black's (with the
+// board flipped, so both views see "own" and "enemy" pieces the same way). The output is a weighted
+// sum of the two clipped layers, side to move's first.
+//
+// A move switches at most four inputs off or on (castling moves two pieces, a capture removes one),
+// so the hidden layer of each position is kept in an Accumulator and updated by adding and
+// subtracting a few weight rows instead of being recomputed. Board does this in makeMove() and keeps
+// one Accumulator per ply, so unmakeMove() costs nothing.
+//
+// Weights are int16, quantized by NNUE_QA (hidden layer) and NNUE_QB (output). The file is the raw
+// little-endian arrays in this order, as written by the common trainers for a (768 -> 256) x 2 -> 1
+// network: input weights [768][256], hidden biases [256], output weights [2][256] (side to move,
+// then the other side) and the output bias, quantized by QA * QB. Up to 64 bytes of trailing padding
+// are ignored.
+const int NNUE_INPUTS = 768;
+const int NNUE_HIDDEN = 256;
+const int NNUE_QA = 255;
+const int NNUE_QB = 64;
+const int NNUE_SCALE = 400;
+// Converts the network's output (a win probability in logits) into centipawns.
+
+struct alignas(64) Accumulator {
+    std::int16_t values[2][NNUE_HIDDEN];    // Hidden layer from each side's view, indexed by colorIndex().
+    std::uint32_t generation;               // Network::generation() it was computed for; 0 for never.
+};
+
+// The inputs a move switches on and off, as pieceIndex() * 64 + square from White's view. Unused
+// slots hold -1.
+struct FeatureDelta {
+    int added[2] = { -1, -1 };
+    int removed[2] = { -1, -1 };
+    int addCount = 0, removeCount = 0;
+
+    void add(int piece, int square) { added[addCount++] = piece * 64 + square; }
+    void remove(int piece, int square) { removed[removeCount++] = piece * 64 + square; }
 };
 
-class King : public ChessPiece {
+class Network {
+private:
+    alignas(64) std::int16_t inputWeights[NNUE_INPUTS][NNUE_HIDDEN];
+    alignas(64) std::int16_t hiddenBias[NNUE_HIDDEN];
+    alignas(64) std::int16_t outputWeights[2][NNUE_HIDDEN];
+    alignas(64) std::int16_t zeroRow[NNUE_HIDDEN];     // Stands in for unused delta slots.
+    std::int32_t outputBias;
+    std::uint32_t loadedGeneration;                    // 0 while no network is loaded.
+    std::int32_t (*clippedDot)(const std::int16_t*, const std::int16_t*);
+    void (*updateRows)(const std::int16_t*, std::int16_t*, const std::int16_t* const[4]);
+    const char* kernel;
+
+    // The row of the weight matrix for an input, seen from 'perspective'.
+    const std::int16_t* row(Color perspective, int feature) const;
+
 public:
-    // Constructor initializes the King with a color and position.
-    King(Color c, Position p) : ChessPiece(c, p) {}
-
-    std::set<Position> legalMoves(const std::unordered_map<Position, ChessPiece*, std::hash<Position>>& board, const Position& lastMovePos, bool enPassantAvailable) const override {
-        std::set<Position> moves;
-
-        for (int dx = -1; dx <= 1; ++dx) {  
-            // Loop through x-direction (horizontal movement)
-            for (int dy = -1; dy <= 1; ++dy) {  
-                // Loop through y-direction (vertical movement)
-                if (dx == 0 && dy == 0) continue;  
-                // Skip the current position (no move)
-
-                // Calculate the new position the king could move to
-                Position newPos(position.column + dx, position.row + dy);
-
-                if (newPos.row >= 1 && newPos.row <= 8 && newPos.column >= 'a' && newPos.column <= 'h') {
-                    // Check if the new position is either empty or occupied by an opponent's piece
-                    if (board.find(newPos) == board.end() || board.at(newPos)->getColor() != color) {
-                        moves.insert(newPos);  
-                        // Add valid move to the set of possible moves
-                    }
+    Network();
+
+    // Reads a network file, replacing any network already loaded. On failure no network is loaded.
+    bool load(const char* path);
+    void unload() { loadedGeneration = 0; }
+    bool loaded() const { return loadedGeneration != 0; }
+
+    // Changes with every load, so accumulators computed for an earlier network are recomputed.
+    std::uint32_t generation() const { return loadedGeneration; }
+
+    // Name of the vector instructions the network runs on: avx2, sse2, neon or scalar.
+    const char* kernelName() const { return kernel; }
+
+    // Computes the hidden layer of a position from scratch.
+    void refresh(const BoardState& state, Accumulator& accumulator) const;
+
+    // Computes the hidden layer after a move from the one before it.
+    void update(const Accumulator& parent, const FeatureDelta& delta, Accumulator& child) const;
+
+    // The position's score in centipawns from the side to move's point of view.
+    int evaluate(const Accumulator& accumulator, Color turn) const;
+};
+
+// Each kernel clips the hidden layer to [0, QA] and takes its dot product with an output weight row,
+// multiplying int16 pairs into int32 sums (PMADDWD on x86, VMLAL on ARM).
+static std::int32_t clippedDotScalar(const std::int16_t* hidden, const std::int16_t* weights) {
+    std::int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; ++i) sum += std::clamp<int>(hidden[i], 0, NNUE_QA) * weights[i];
+    return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static std::int32_t clippedDotSse2(const std::int16_t* hidden, const std::int16_t* weights) {
+    const __m128i zero = _mm_setzero_si128(), ceiling = _mm_set1_epi16(NNUE_QA);
+    __m128i sum = zero;
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i clipped = _mm_min_epi16(_mm_max_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(hidden + i)), zero), ceiling);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(clipped, _mm_load_si128(reinterpret_cast<const __m128i*>(weights + i))));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static std::int32_t clippedDotAvx2(const std::int16_t* hidden, const std::int16_t* weights) {
+    const __m256i zero = _mm256_setzero_si256(), ceiling = _mm256_set1_epi16(NNUE_QA);
+    __m256i sum = zero;
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i clipped = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(hidden + i)), zero), ceiling);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(clipped, _mm256_load_si256(reinterpret_cast<const __m256i*>(weights + i))));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static std::int32_t clippedDotNeon(const std::int16_t* hidden, const std::int16_t* weights) {
+    const int16x8_t zero = vdupq_n_s16(0), ceiling = vdupq_n_s16(NNUE_QA);
+    int32x4_t sum = vdupq_n_s32(0);
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        int16x8_t clipped = vminq_s16(vmaxq_s16(vld1q_s16(hidden + i), zero), ceiling);
+        int16x8_t row = vld1q_s16(weights + i);
+        sum = vmlal_s16(sum, vget_low_s16(clipped), vget_low_s16(row));
+        sum = vmlal_s16(sum, vget_high_s16(clipped), vget_high_s16(row));
+    }
+    return vaddvq_s32(sum);
+}
+#endif
+
+typedef std::int16_t Int16Lanes8 __attribute__((vector_size(16)));
+typedef std::int16_t Int16Lanes16 __attribute__((vector_size(32)));
+
+// child = parent + rows[0] + rows[1] - rows[2] - rows[3] over one hidden layer, in one pass. The
+// additions wrap like the trainer's int16 arithmetic; a trained network never gets near the limits.
+template <class V>
+inline __attribute__((always_inline)) void updateRowsKernel(const std::int16_t* parent, std::int16_t* child,
+                                                            const std::int16_t* const rows[4]) {
+    for (std::size_t i = 0; i < NNUE_HIDDEN; i += sizeof(V) / sizeof(std::int16_t)) {
+        V value, add0, add1, sub0, sub1;
+        std::memcpy(&value, parent + i, sizeof(V));
+        std::memcpy(&add0, rows[0] + i, sizeof(V));
+        std::memcpy(&add1, rows[1] + i, sizeof(V));
+        std::memcpy(&sub0, rows[2] + i, sizeof(V));
+        std::memcpy(&sub1, rows[3] + i, sizeof(V));
+        value = value + add0 + add1 - sub0 - sub1;
+        std::memcpy(child + i, &value, sizeof(V));
+    }
+}
+
+static void updateRows128(const std::int16_t* parent, std::int16_t* child, const std::int16_t* const rows[4]) {
+    updateRowsKernel<Int16Lanes8>(parent, child, rows);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void updateRowsAvx2(const std::int16_t* parent, std::int16_t* child, const std::int16_t* const rows[4]) {
+    updateRowsKernel<Int16Lanes16>(parent, child, rows);
+}
+#endif
+
+Network::Network() : outputBias(0), loadedGeneration(0), clippedDot(clippedDotScalar), updateRows(updateRows128), kernel("scalar") {
+    std::memset(zeroRow, 0, sizeof(zeroRow));
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        clippedDot = clippedDotAvx2;
+        updateRows = updateRowsAvx2;
+        kernel = "avx2";
+    } else {
+        clippedDot = clippedDotSse2;
+        kernel = "sse2";
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    clippedDot = clippedDotNeon;
+    kernel = "neon";
+#endif
+}
+
+bool Network::load(const char* path) {
+    static std::uint32_t loads = 0;
+    unload();
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const std::size_t values = NNUE_INPUTS * NNUE_HIDDEN + NNUE_HIDDEN + 2 * NNUE_HIDDEN + 1;
+    if (data.size() < 2 * values || data.size() > 2 * values + 64) return false;
+
+    const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(data.data());
+    auto next = [&p]() {
+        std::int16_t value = static_cast<std::int16_t>(p[0] | (p[1] << 8));
+        p += 2;
+        return value;
+    };
+    for (auto& weights : inputWeights) {
+        for (std::int16_t& weight : weights) weight = next();
+    }
+    for (std::int16_t& bias : hiddenBias) bias = next();
+    for (auto& weights : outputWeights) {
+        for (std::int16_t& weight : weights) weight = next();
+    }
+    outputBias = next();
+    loadedGeneration = ++loads;
+    return true;
+}
+
+const std::int16_t* Network::row(Color perspective, int feature) const {
+    if (feature < 0) return zeroRow;
+    if (perspective == Color::BLACK) {
+        // Black sees the board flipped, with the colors swapped.
+        int piece = feature / 64;
+        feature = (piece < 6 ? piece + 6 : piece - 6) * 64 + ((feature % 64) ^ 56);
+    }
+    return inputWeights[feature];
+}
+
+void Network::refresh(const BoardState& state, Accumulator& accumulator) const {
+    for (int side = 0; side < 2; ++side) {
+        Color perspective = side == colorIndex(Color::WHITE) ? Color::WHITE : Color::BLACK;
+        std::int16_t* values = accumulator.values[side];
+        std::memcpy(values, hiddenBias, sizeof(hiddenBias));
+        // Pieces are added two rows per pass, through the same kernel as the incremental update.
+        const std::int16_t* rows[4] = { zeroRow, zeroRow, zeroRow, zeroRow };
+        int pending = 0;
+        for (int piece = 0; piece < 12; ++piece) {
+            Bitboard pieces = state.pieces[piece];
+            while (pieces) {
+                rows[pending++] = row(perspective, piece * 64 + popLsb(pieces));
+                if (pending == 2) {
+                    updateRows(values, values, rows);
+                    rows[0] = rows[1] = zeroRow;
+                    pending = 0;
                 }
             }
         }
-
-        return moves; 
-        // Return the set of legal moves for the king.
+        if (pending) updateRows(values, values, rows);
     }
+    accumulator.generation = loadedGeneration;
+}
 
-    std::string toString() const override {
-        return color == Color::WHITE ? "K" : "k";  
-        // Return 'K' for white king, 'k' for black king.
+void Network::update(const Accumulator& parent, const FeatureDelta& delta, Accumulator& child) const {
+    for (int side = 0; side < 2; ++side) {
+        Color perspective = side == colorIndex(Color::WHITE) ? Color::WHITE : Color::BLACK;
+        const std::int16_t* const rows[4] = { row(perspective, delta.added[0]), row(perspective, delta.added[1]),
+                                              row(perspective, delta.removed[0]), row(perspective, delta.removed[1]) };
+        updateRows(parent.values[side], child.values[side], rows);
     }
+    child.generation = loadedGeneration;
+}
+
+int Network::evaluate(const Accumulator& accumulator, Color turn) const {
+    INSTRUMENT_TIMER(EVALUATE);
+    std::int64_t output = static_cast<std::int64_t>(clippedDot(accumulator.values[colorIndex(turn)], outputWeights[0])) +
+                          clippedDot(accumulator.values[colorIndex(opponent(turn))], outputWeights[1]);
+    // The clipped layer carries a factor QA and the output weights QB; the bias already has both.
+    return static_cast<int>((output + outputBias) * NNUE_SCALE / (NNUE_QA * NNUE_QB));
+}
+
+Network network;
+// The engine's neural network; the search uses it instead of Evaluator while one is loaded.
+
+// Everything makeMove() overwrites that cannot be recomputed from the move itself. It is plain data,
+// so pushing and popping one is a small copy.
+struct UndoRecord {
+    Move move;                   // The move that was made.
+    PieceType captured;          // Type of the captured piece, or PieceType::NONE.
+    Color turn;                  // Side to move before the move.
+    std::uint8_t castlingRights; // Castling rights before the move.
+    std::int8_t enPassantSquare; // En passant square before the move, or -1.
+    std::uint16_t halfmoveClock; // Halfmove clock before the move.
+    std::uint64_t hash;          // Zobrist key before the move.
+    Score psqt;                  // Material and piece-square sum before the move.
+    std::uint8_t phase;          // Game phase before the move.
 };
 
+// Pieces are plain Piece values in BoardState's mailbox, so there are no piece objects. The squares a
+// piece can move to are computed by pieceTargets<Type>, specialized per piece type, and the run-time
+// overload picks the specialization with a switch on the type stored in the mailbox.
+// Targets are pseudo-legal: they may leave the king in check and never include castling.
+template <PieceType Type>
+Bitboard pieceTargets(const BoardState& board, Color color, int square) {
+    // Knights, bishops, rooks, queens and kings move onto any attacked square not held by their own side.
+    return pieceAttacks(Type, square, board.occupancy()) & ~board.occupancy(color);
+}
+
+template <>
+Bitboard pieceTargets<PieceType::PAWN>(const BoardState& board, Color color, int square) {
+    const Bitboard empty = ~board.occupancy();
+    const bool white = color == Color::WHITE;
+
+    // One step forward onto an empty square, and a second step from the starting rank.
+    Bitboard oneStep = (white ? squareBit(square) << 8 : squareBit(square) >> 8) & empty;
+    Bitboard targets = oneStep;
+    if (square / 8 == (white ? 1 : 6)) {
+        targets |= (white ? oneStep << 8 : oneStep >> 8) & empty;
+    }
+
+    // Diagonal captures, including en passant onto the square the enemy pawn skipped over.
+    Bitboard enemies = board.occupancy(opponent(color));
+    if (board.enPassantSquare >= 0) enemies |= squareBit(board.enPassantSquare);
+    return targets | (pawnAttacks(color, square) & enemies);
+}
+
+inline Bitboard pieceTargets(const BoardState& board, Color color, PieceType type, int square) {
+    switch (type) {
+        case PieceType::PAWN: return pieceTargets<PieceType::PAWN>(board, color, square);
+        case PieceType::KNIGHT: return pieceTargets<PieceType::KNIGHT>(board, color, square);
+        case PieceType::BISHOP: return pieceTargets<PieceType::BISHOP>(board, color, square);
+        case PieceType::ROOK: return pieceTargets<PieceType::ROOK>(board, color, square);
+        case PieceType::QUEEN: return pieceTargets<PieceType::QUEEN>(board, color, square);
+        case PieceType::KING: return pieceTargets<PieceType::KING>(board, color, square);
+        default: return 0;
+    }
+}
+
+// Where the game stands for the side to move, as returned by Board::status(). The tablebase results
+// (for the side to move) come only from Board::adjudicate().
+enum class GameStatus : std::uint8_t { PLAYING, CHECK, CHECKMATE, STALEMATE, DRAW, TABLEBASE_WIN, TABLEBASE_DRAW, TABLEBASE_LOSS };
+
 class Board {
 private:
-    std::unordered_map<Position, ChessPiece*, std::hash<Position>> pieceMap; 
-    //A std::map that associates positions with pieces on the board.
-    Color turn; 
-    //The color of the player who is currently to move.
+    BoardState state;
+    //The bitboards, side to move, castling rights and en passant square for the current position.
     Position lastMovePos;
     //The position of the last move made.
-    bool enPassantAvailable;
-    //A flag indicating if en passant is available for the current player.
-    bool whiteCastleKingSide, whiteCastleQueenSide; 
-    //Flags indicating if white castling is available.
-    bool blackCastleKingSide, blackCastleQueenSide; 
-    //Flags indicating if black castling is available.
+    std::vector<UndoRecord> history;
+    //Undo records for every move made, oldest first; the last one is undone next.
+    static const int KEY_RING_SIZE = 256;
+    std::uint64_t keyRing[KEY_RING_SIZE];
+    //Zobrist key of the position before each move, at index ply % KEY_RING_SIZE. A repetition can only
+    //reach back to the last capture or pawn move, which is at most about 100 plies in any game that has
+    //not already been drawn by the fifty-move rule, so a small ring holds every key that can repeat.
+    std::size_t plyBase;
+    //Plies played before 'history' starts, on the board this one was branched from; their keys are in
+    //the ring too, so repetitions reaching back past the branch are still found.
+    mutable std::uint64_t statusKey;
+    mutable std::uint16_t statusMoves;
+    mutable bool statusInCheck;
+    mutable bool statusValid;
+    //Legal move count and check state of the position with key statusKey, kept by status() so asking
+    //again about the same position does not generate its moves again.
+    mutable std::vector<Accumulator> accumulators;
+    //Network hidden layer of the position after each move, indexed like 'history' plus one (entry 0 is the
+    //position before the first move). Kept only while a network is loaded; an entry whose generation is not
+    //the network's is stale and recomputed when asked for.
+
+    static Move findMove(const MoveList& moves, const Position& from, const Position& to, PieceType promotion);
+    //Returns the move in 'moves' matching from/to (and promotion), or Move::none().
+
+    Bitboard attackersTo(int square, Color attacker, Bitboard occupied) const;
+    //Returns the pieces of 'attacker' that attack the square, given the occupancy to use for sliders.
+    void generateLegalMovesFor(Color side, MoveList& moves) const;
+    //Appends the legal moves of the given side to 'moves'.
+
+    void generateMovesFor(Color side, MoveList& moves) const;
+    //Appends the pseudo-legal moves of the given side to 'moves'.
 
 public:
-    Board() : lastMovePos(Position('a', 1)), enPassantAvailable(false), 
-      whiteCastleKingSide(true), whiteCastleQueenSide(true),
-      blackCastleKingSide(true), blackCastleQueenSide(true) {
+    Board() : lastMovePos(Position('a', 1)), plyBase(0), statusKey(0), statusMoves(0), statusInCheck(false), statusValid(false) {
         // Initialize the board with the starting pieces.
-        pieceMap = std::unordered_map<Position, ChessPiece*, std::hash<Position>>(); 
-        // Initialize pieceMap here. 
         initialize();
-        turn = Color::WHITE;
     }
 
-~Board() {
-    for (auto& entry : pieceMap) {
-        delete entry.second;
-        // Deallocate memory for each piece
-    }
-}
+    void makeMove(Move move);
+    // Plays a pseudo-legal move for the piece on its from square and pushes an undo record.
+    void unmakeMove();
+    // Takes back the most recent move made with makeMove(), restoring the position exactly.
+    bool canUndo() const { return !history.empty(); }
+    // Returns true if there is a move to take back.
+    std::size_t moveCount() const { return history.size(); }
+    Move moveAt(std::size_t ply) const { return history[ply].move; }
+    // The moves made since the position was set up, oldest first.
+    BoardState startPosition() const;
+    // Returns the position before the first of those moves.
+    void reserveHistory(std::size_t plies) { history.reserve(plies); }
+    // Makes room for that many moves up front, so making them does not allocate.
 
     void initialize();
+    bool fromFEN(std::string_view fen);
+    // Replaces the position with one given in FEN; returns false if the FEN is malformed.
+    std::string toFEN() const;
+    // Returns the current position in FEN.
+    void setState(const BoardState& position);
+    // Replaces the position with an already parsed one and clears the undo history.
+    void branchFrom(const Board& other);
+    // Makes this board continue from the other's current position, for a helper thread or an analysis
+    // line: it copies the position snapshot and the keys repetition detection looks back over, but no
+    // undo history, so the moves that led there cannot be taken back here. The buffers of this board
+    // are reused, so once they have grown branching allocates nothing.
     void display() const;
     bool movePiece(const std::string& from, const std::string& to);
-    std::string getTurnName() const { return turn == Color::WHITE ? "White" : "Black"; } 
+    std::string getTurnName() const { return state.turn == Color::WHITE ? "White" : "Black"; }
     // Method to get the turn name
     void updateLastMove(Position pos) {
         lastMovePos = pos;
@@ -440,50 +1311,81 @@ public:
     bool canCastleQueenSide(Color color) const;
     void updateCastlingRights(Color color, const std::string& pieceType);
     bool isInCheck(Color color);
+    bool isSquareAttacked(const Position& square, Color attacker) const;
+    bool isSquareAttacked(int square, Color attacker) const;
+    // Returns true if any piece of 'attacker' attacks the square.
     bool isCheckmate(Color color);
     bool isStalemate(Color color);
+    bool isDraw() const;
+    // Returns true if the game is drawn by threefold repetition or the fifty-move rule.
+    GameStatus status() const;
+    // Returns checkmate, stalemate, draw, check or playing for the side to move with one legal move
+    // generation, remembered until the position changes.
+    GameStatus adjudicate();
+    // Returns status(), or the tablebase result for the side to move once the game is still going and the
+    // position is in the loaded tables. Separate from status() because the prober itself calls status()
+    // and plays captures on the board to resolve the table lookup.
+    bool isRepetition(int earlier) const;
+    // Returns true if the current position occurred at least 'earlier' times before, with the same
+    // side to move, since the position was set up.
 
     bool simulateMoveAndCheck(const Position& from, const Position& to, Color color);
+    bool simulateMoveAndCheck(Move move, Color color);
+    // Returns true if making the move would leave 'color' in check. The position is unchanged afterwards.
+
+    Position findKing(Color color) const;
+
+    Move parseSAN(std::string_view san) const;
+    // Returns the legal move written in Standard Algebraic Notation, or Move::none().
+
+    Bitboard legalMovesFrom(const Position& from) const;
+    // Returns the squares the piece standing on 'from' can move to, ignoring checks and castling,
+    // or an empty bitboard if the square is empty.
 
-    ChessPiece* findKing(Color color) const;
+    void generateMoves(MoveList& moves) const;
+    // Fills 'moves' with every pseudo-legal move for the side to move (moves that may still leave
+    // the king in check). Nothing is allocated; the list is normally a local variable.
+    void generateLegalMoves(MoveList& moves) const;
+    // Fills 'moves' with exactly the legal moves for the side to move.
 
-    Color getTurn() const { return turn; } 
+    const BoardState& getState() const { return state; }
+    // Read-only access to the underlying bitboards.
+
+    Color getTurn() const { return state.turn; }
     // Added getter method for 'turn'
-    bool isEnPassantAvailable() const { return enPassantAvailable; }
+    bool isEnPassantAvailable() const { return state.enPassantSquare >= 0; }
+    std::uint64_t getHash() const { return state.hash; }
+    // Returns the Zobrist key of the current position.
+    const Accumulator& accumulator() const;
+    // Returns the network hidden layer of the current position. Requires a loaded network.
 };
 
 // Method to initialize the chessboard with the starting positions of all pieces.
 // This method sets up both White and Black pieces in their respective starting positions.
 void Board::initialize() {
-    // Place White's major pieces on the first rank (row 1).
-    pieceMap[Position('a', 1)] = new Rook(Color::WHITE, Position('a', 1));    
-    pieceMap[Position('b', 1)] = new Knight(Color::WHITE, Position('b', 1));  
-    pieceMap[Position('c', 1)] = new Bishop(Color::WHITE, Position('c', 1));  
-    pieceMap[Position('d', 1)] = new Queen(Color::WHITE, Position('d', 1));  
-    pieceMap[Position('e', 1)] = new King(Color::WHITE, Position('e', 1));   
-    pieceMap[Position('f', 1)] = new Bishop(Color::WHITE, Position('f', 1)); 
-    pieceMap[Position('g', 1)] = new Knight(Color::WHITE, Position('g', 1)); 
-    pieceMap[Position('h', 1)] = new Rook(Color::WHITE, Position('h', 1));    
-
-    // Place White's pawns on the second rank (row 2).
-    for (char col = 'a'; col <= 'h'; ++col) {
-        pieceMap[Position(col, 2)] = new Pawn(Color::WHITE, Position(col, 2)); // White Pawn on row 2
-    }
+    const PieceType backRank[8] = {
+        PieceType::ROOK, PieceType::KNIGHT, PieceType::BISHOP, PieceType::QUEEN,
+        PieceType::KING, PieceType::BISHOP, PieceType::KNIGHT, PieceType::ROOK
+    };
 
-    // Place Black's major pieces on the eighth rank (row 8).
-    pieceMap[Position('a', 8)] = new Rook(Color::BLACK, Position('a', 8));    
-    pieceMap[Position('b', 8)] = new Knight(Color::BLACK, Position('b', 8));  
-    pieceMap[Position('c', 8)] = new Bishop(Color::BLACK, Position('c', 8));  
-    pieceMap[Position('d', 8)] = new Queen(Color::BLACK, Position('d', 8));   
-    pieceMap[Position('e', 8)] = new King(Color::BLACK, Position('e', 8));    
-    pieceMap[Position('f', 8)] = new Bishop(Color::BLACK, Position('f', 8));  
-    pieceMap[Position('g', 8)] = new Knight(Color::BLACK, Position('g', 8)); 
-    pieceMap[Position('h', 8)] = new Rook(Color::BLACK, Position('h', 8));  
+    state.clear();
+    accumulators.clear();
+    for (int file = 0; file < 8; ++file) {
+        // Place White's major pieces on the first rank and pawns on the second rank.
+        state.addPiece(Color::WHITE, backRank[file], file);
+        state.addPiece(Color::WHITE, PieceType::PAWN, 8 + file);
 
-    // Place Black's pawns on the seventh rank (row 7).
-    for (char col = 'a'; col <= 'h'; ++col) {
-        pieceMap[Position(col, 7)] = new Pawn(Color::BLACK, Position(col, 7)); // Black Pawn on row 7
+        // Place Black's pawns on the seventh rank and major pieces on the eighth rank.
+        state.addPiece(Color::BLACK, PieceType::PAWN, 48 + file);
+        state.addPiece(Color::BLACK, backRank[file], 56 + file);
     }
+    state.turn = Color::WHITE;
+    state.kingSquare[0] = 4;
+    state.kingSquare[1] = 60;
+    state.castlingRights = WHITE_KING_SIDE | WHITE_QUEEN_SIDE | BLACK_KING_SIDE | BLACK_QUEEN_SIDE;
+    state.hash = state.computeHash();
+    state.psqt = state.computePsqt();
+    state.phase = state.computePhase();
 }
 
 void Board::display() const {
@@ -491,97 +1393,239 @@ void Board::display() const {
     for (int row = 8; row >= 1; --row) {
         std::cout << row << " ";
         for (char col = 'a'; col <= 'h'; ++col) {
-            Position pos(col, row);
-            if (pieceMap.find(pos) != pieceMap.end()) {
-                std::cout << pieceMap.at(pos)->toString() << " ";
-            } else {
-                std::cout << ". ";
-            }
+            std::cout << pieceSymbol(state.mailbox[Position(col, row).toSquare()]) << " ";
         }
         std::cout << row << std::endl;
     }
     std::cout << "  a b c d e f g h\n";
 }
 
-bool Board::movePiece(const std::string& from, const std::string& to) {
-    // Convert the string positions ('e2' to Position('e', 2)) for both from and to.
-    Position fromPos(from[0], from[1] - '0');
-    Position toPos(to[0], to[1] - '0');
-
-    // Check if the piece at the 'from' position exists.
-    if (pieceMap.find(fromPos) == pieceMap.end()) {
-        return false; // No piece found at 'from', return false.
+// Castling rights that survive a move touching each square: moving or capturing on a1, e1, h1,
+// a8, e8 or h8 clears the rights tied to that rook or king.
+static std::uint8_t castlingRightsKept(int square) {
+    switch (square) {
+        case 0: return static_cast<std::uint8_t>(~WHITE_QUEEN_SIDE);
+        case 4: return static_cast<std::uint8_t>(~(WHITE_KING_SIDE | WHITE_QUEEN_SIDE));
+        case 7: return static_cast<std::uint8_t>(~WHITE_KING_SIDE);
+        case 56: return static_cast<std::uint8_t>(~BLACK_QUEEN_SIDE);
+        case 60: return static_cast<std::uint8_t>(~(BLACK_KING_SIDE | BLACK_QUEEN_SIDE));
+        case 63: return static_cast<std::uint8_t>(~BLACK_KING_SIDE);
+        default: return 0xFF;
     }
+}
 
-    // Get the piece at the 'from' position.
-    ChessPiece* piece = pieceMap[fromPos];
+void Board::makeMove(Move move) {
+    const int from = move.from();
+    const int to = move.to();
+    const Color side = state.colorAt(from);
+    const Color enemySide = opponent(side);
+    const PieceType type = state.pieceTypeAt(from);
 
-    // Check if the piece is a Pawn.
-    bool isPawn = dynamic_cast<Pawn*>(piece) != nullptr;
+    UndoRecord undo;
+    undo.move = move;
+    undo.captured = PieceType::NONE;
+    undo.turn = state.turn;
+    undo.castlingRights = state.castlingRights;
+    undo.enPassantSquare = state.enPassantSquare;
+    undo.halfmoveClock = state.halfmoveClock;
+    undo.hash = state.hash;
+    undo.psqt = state.psqt;
+    undo.phase = state.phase;
+    // Make sure the hidden layer of the position being left is current before it is updated.
+    if (network.loaded()) accumulator();
 
-    // Check if the piece is a King (by comparing the piece type string).
-    bool isKing = piece->toString() == (piece->getColor() == Color::WHITE ? "K" : "k");
+    // The key is updated term by term: the old side, castling and en passant terms come out here,
+    // and every piece that is added or removed toggles its own key. The evaluation sums are updated
+    // the same way, one table entry per piece added or removed.
+    std::uint64_t hash = state.hash ^ zobrist.blackToMove ^ zobrist.castling[state.castlingRights];
+    if (state.enPassantSquare >= 0) hash ^= zobrist.enPassantFile[state.enPassantSquare % 8];
+    auto add = [this, &hash](Color color, PieceType piece, int square) {
+        state.addPiece(color, piece, square);
+        hash ^= zobrist.pieces[pieceIndex(color, piece)][square];
+        state.psqt += pieceSquareTables.scores[pieceIndex(color, piece)][square];
+        state.phase += PHASE_WEIGHTS[static_cast<int>(piece)];
+    };
+    auto remove = [this, &hash](Color color, PieceType piece, int square) {
+        state.removePiece(color, piece, square);
+        hash ^= zobrist.pieces[pieceIndex(color, piece)][square];
+        state.psqt -= pieceSquareTables.scores[pieceIndex(color, piece)][square];
+        state.phase -= PHASE_WEIGHTS[static_cast<int>(piece)];
+    };
 
-    bool enPassantCapture = false;
-    if (isPawn) {
-        // If the piece is a Pawn, check if the move is legal (including en passant).
-        Pawn* pawn = dynamic_cast<Pawn*>(piece);
-        auto moves = pawn->legalMoves(pieceMap, lastMovePos, enPassantAvailable);
-        if (moves.find(toPos) == moves.end()) {
-            return false; // Move is not legal for this pawn, return false.
-        }
-        enPassantCapture = enPassantAvailable && (lastMovePos == Position(toPos.column, fromPos.row)); // Check for en passant capture.
-        // Update enPassantAvailable if a pawn moves two squares forward
-        if (std::abs(toPos.row - fromPos.row) == 2) {
-            enPassantAvailable = true; 
-        } else {
-            enPassantAvailable = false;
+    // Remove the captured piece: en passant takes the pawn beside the destination, not on it.
+    if (move.isEnPassant()) {
+        undo.captured = PieceType::PAWN;
+        remove(enemySide, PieceType::PAWN, to + (side == Color::WHITE ? -8 : 8));
+    } else if (move.isCapture()) {
+        undo.captured = state.pieceTypeAt(to);
+        remove(enemySide, undo.captured, to);
+    }
+
+    // Move the piece, replacing a promoting pawn with its new piece.
+    remove(side, type, from);
+    add(side, move.isPromotion() ? move.promotionType() : type, to);
+    if (type == PieceType::KING) state.kingSquare[colorIndex(side)] = static_cast<std::uint8_t>(to);
+
+    // Castling also moves the rook to the square the king passed over.
+    if (move.flags() == Move::KING_CASTLE) {
+        remove(side, PieceType::ROOK, to + 1);
+        add(side, PieceType::ROOK, to - 1);
+    } else if (move.flags() == Move::QUEEN_CASTLE) {
+        remove(side, PieceType::ROOK, to - 2);
+        add(side, PieceType::ROOK, to + 1);
+    }
+
+    state.castlingRights &= castlingRightsKept(from) & castlingRightsKept(to);
+    hash ^= zobrist.castling[state.castlingRights];
+
+    // After a double push the skipped square is recorded only if an enemy pawn could capture onto it.
+    state.enPassantSquare = -1;
+    if (move.flags() == Move::DOUBLE_PAWN_PUSH) {
+        int skipped = (from + to) / 2;
+        if (pawnAttacks(side, skipped) & state.piecesOf(enemySide, PieceType::PAWN)) {
+            state.enPassantSquare = static_cast<std::int8_t>(skipped);
+            hash ^= zobrist.enPassantFile[skipped % 8];
         }
-    } 
+    }
 
-    // If the piece is a King, check if castling is possible (either King-side or Queen-side).
-    else if (isKing && canCastleKingSide(piece->getColor()) && toPos == Position('g', fromPos.row)) {
-        Position rookPos('h', fromPos.row);
-        ChessPiece* rook = pieceMap[rookPos];
-        if (rook && rook->toString() == (piece->getColor() == Color::WHITE ? "R" : "r")) {
-            // Perform castling by moving the King and Rook.
-            Position newKingPos('f', fromPos.row);
-            piece->setPosition(newKingPos);
-            rook->setPosition(Position('e', fromPos.row));
-            updateCastlingRights(piece->getColor(), "king");
+    state.halfmoveClock = (type == PieceType::PAWN || undo.captured != PieceType::NONE)
+                              ? 0 : static_cast<std::uint16_t>(state.halfmoveClock + 1);
+    if (side == Color::BLACK) ++state.fullmoveNumber;
+    state.turn = enemySide;
+    state.hash = hash;
+    lastMovePos = Position::fromSquare(to);
+
+    keyRing[(plyBase + history.size()) % KEY_RING_SIZE] = undo.hash;
+    history.push_back(undo);
+
+    // The new hidden layer follows from the parent's, brought up to date above, and the pieces the
+    // move took off and put on. Entries past this ply are left over from moves already taken back, so
+    // unmakeMove() has nothing to undo.
+    if (network.loaded()) {
+        FeatureDelta delta;
+        delta.remove(pieceIndex(side, type), from);
+        delta.add(pieceIndex(side, move.isPromotion() ? move.promotionType() : type), to);
+        if (move.isEnPassant()) {
+            delta.remove(pieceIndex(enemySide, PieceType::PAWN), to + (side == Color::WHITE ? -8 : 8));
+        } else if (undo.captured != PieceType::NONE) {
+            delta.remove(pieceIndex(enemySide, undo.captured), to);
+        } else if (move.flags() == Move::KING_CASTLE) {
+            delta.remove(pieceIndex(side, PieceType::ROOK), to + 1);
+            delta.add(pieceIndex(side, PieceType::ROOK), to - 1);
+        } else if (move.flags() == Move::QUEEN_CASTLE) {
+            delta.remove(pieceIndex(side, PieceType::ROOK), to - 2);
+            delta.add(pieceIndex(side, PieceType::ROOK), to + 1);
         }
-    } 
+        std::size_t ply = history.size();
+        if (accumulators.size() <= ply) accumulators.resize(ply + 1);
+        network.update(accumulators[ply - 1], delta, accumulators[ply]);
+    }
+}
+
+const Accumulator& Board::accumulator() const {
+    std::size_t ply = history.size();
+    if (accumulators.size() <= ply) accumulators.resize(ply + 1);
+    // New entries start with generation 0, so they are computed here.
+    Accumulator& current = accumulators[ply];
+    if (current.generation != network.generation()) network.refresh(state, current);
+    return current;
+}
+
+void Board::unmakeMove() {
+    const UndoRecord undo = history.back();
+    history.pop_back();
+
+    const Move move = undo.move;
+    const int from = move.from();
+    const int to = move.to();
+    const Color side = state.colorAt(to);
+    const PieceType placed = state.pieceTypeAt(to);
+
+    // Put the piece back, turning a promoted piece back into a pawn.
+    state.removePiece(side, placed, to);
+    state.addPiece(side, move.isPromotion() ? PieceType::PAWN : placed, from);
+    if (placed == PieceType::KING) state.kingSquare[colorIndex(side)] = static_cast<std::uint8_t>(from);
+
+    if (move.flags() == Move::KING_CASTLE) {
+        state.removePiece(side, PieceType::ROOK, to - 1);
+        state.addPiece(side, PieceType::ROOK, to + 1);
+    } else if (move.flags() == Move::QUEEN_CASTLE) {
+        state.removePiece(side, PieceType::ROOK, to + 1);
+        state.addPiece(side, PieceType::ROOK, to - 2);
+    }
 
-    else if (isKing && canCastleQueenSide(piece->getColor()) && toPos == Position('c', fromPos.row)) {
-        Position rookPos('a', fromPos.row);
-        ChessPiece* rook = pieceMap[rookPos];
-        if (rook && rook->toString() == (piece->getColor() == Color::WHITE ? "R" : "r")) {
-            // Perform castling by moving the King and Rook.
-            Position newKingPos('d', fromPos.row);
-            piece->setPosition(newKingPos);
-            rook->setPosition(Position('e', fromPos.row));
-            updateCastlingRights(piece->getColor(), "queen");
+    if (undo.captured != PieceType::NONE) {
+        int capturedSquare = move.isEnPassant() ? to + (side == Color::WHITE ? -8 : 8) : to;
+        state.addPiece(opponent(side), undo.captured, capturedSquare);
+    }
+
+    state.turn = undo.turn;
+    state.castlingRights = undo.castlingRights;
+    state.enPassantSquare = undo.enPassantSquare;
+    state.halfmoveClock = undo.halfmoveClock;
+    if (undo.turn == Color::BLACK) --state.fullmoveNumber;
+    state.hash = undo.hash;
+    state.psqt = undo.psqt;
+    state.phase = undo.phase;
+    lastMovePos = history.empty() ? Position('a', 1) : Position::fromSquare(history.back().move.to());
+}
+
+BoardState Board::startPosition() const {
+    // Undo every move on a scratch copy rather than keeping a second copy of the state around.
+    Board start(*this);
+    while (start.canUndo()) start.unmakeMove();
+    return start.state;
+}
+
+Move Board::findMove(const MoveList& moves, const Position& from, const Position& to, PieceType promotion) {
+    int fromSquare = from.toSquare();
+    int toSquare = to.toSquare();
+    for (Move move : moves) {
+        if (move.from() == fromSquare && move.to() == toSquare &&
+            (!move.isPromotion() || move.promotionType() == promotion)) {
+            return move;
         }
     }
+    return Move::none();
+}
+
+// Method to play a move given in coordinate notation ('e2', 'e4'). The destination may carry a
+// promotion letter ('e8n'); pawns promote to a queen otherwise.
+// Returns false, leaving the board unchanged, if the move is not legal for the side to move.
+bool Board::movePiece(const std::string& from, const std::string& to) {
+    INSTRUMENT_TIMER(MOVE_PIECE);
+    if (from.size() < 2 || to.size() < 2) {
+        return false; // Not a square name, return false.
+    }
 
-    // Handle en passant capture if applicable.
-    if (enPassantCapture) {
-        Position capturedPawnPos(toPos.column, fromPos.row);
-        delete pieceMap[capturedPawnPos]; // Capture the pawn via en passant.
-        pieceMap.erase(capturedPawnPos);
+    // Convert the string positions ('e2' to Position('e', 2)) for both from and to.
+    Position fromPos(from[0], from[1] - '0');
+    Position toPos(to[0], to[1] - '0');
+    if (!fromPos.isOnBoard() || !toPos.isOnBoard()) {
+        return false; // Square outside the board, return false.
     }
 
-    // Finalize the move: update piece position and mark it as moved.
-    piece->setPosition(toPos);
-    piece->markAsMoved();
-    pieceMap[toPos] = piece;
-    pieceMap.erase(fromPos); // Remove the piece from the original position.
+    PieceType promotion = PieceType::QUEEN;
+    if (to.size() > 2) {
+        switch (std::tolower(static_cast<unsigned char>(to[2]))) {
+            case 'n': promotion = PieceType::KNIGHT; break;
+            case 'b': promotion = PieceType::BISHOP; break;
+            case 'r': promotion = PieceType::ROOK; break;
+            case 'q': promotion = PieceType::QUEEN; break;
+            default: return false; // Unknown promotion piece, return false.
+        }
+    }
 
-    // Update the last move, reset en passant availability, and switch turns.
-    lastMovePos = toPos;
-    enPassantAvailable = false; // Reset en passant availability after each move
-    turn = (turn == Color::WHITE) ? Color::BLACK : Color::WHITE;
+    // The move must be one of the side to move's legal moves.
+    MoveList moves;
+    generateLegalMoves(moves);
+    Move move = findMove(moves, fromPos, toPos, promotion);
+    if (move.isNone()) {
+        return false;
+    }
 
+    makeMove(move);
+    statusValid = false; // The remembered status belongs to the position before the move.
     return true; // Successfully completed the move.
 }
 
@@ -592,16 +1636,16 @@ bool Board::movePiece(const std::string& from, const std::string& to) {
 // - true if the King-side castling is still allowed, false otherwise.
 bool Board::canCastleKingSide(Color color) const {
     if (color == Color::WHITE) { // Check if the player is White.
-        return whiteCastleKingSide; // Return White's King-side castling status.
+        return (state.castlingRights & WHITE_KING_SIDE) != 0; // Return White's King-side castling status.
     }
-    return blackCastleKingSide; // Return Black's King-side castling status.
+    return (state.castlingRights & BLACK_KING_SIDE) != 0; // Return Black's King-side castling status.
 }
 
 bool Board::canCastleQueenSide(Color color) const {
     if (color == Color::WHITE) { // Check if the player is White.
-        return whiteCastleQueenSide; // Return White's Queen-side castling status.
+        return (state.castlingRights & WHITE_QUEEN_SIDE) != 0; // Return White's Queen-side castling status.
     }
-    return blackCastleQueenSide; // Return Black's Queen-side castling status.
+    return (state.castlingRights & BLACK_QUEEN_SIDE) != 0; // Return Black's Queen-side castling status.
 }
 
 // Castling rights are removed when the king or the relevant rook moves.
@@ -613,8 +1657,7 @@ void Board::updateCastlingRights(Color color, const std::string& pieceType) {
         // Update White's castling rights.
         if (pieceType == "king") {
             // If the White King has moved, both King-side and Queen-side castling are no longer allowed.
-            whiteCastleKingSide = false;
-            whiteCastleQueenSide = false;
+            state.castlingRights &= ~(WHITE_KING_SIDE | WHITE_QUEEN_SIDE);
         }
         // Note: Logic for updating castling rights for rooks would go here if needed.
     } 
@@ -622,149 +1665,5498 @@ void Board::updateCastlingRights(Color color, const std::string& pieceType) {
         // Update Black's castling rights.
         if (pieceType == "king") {
             // If the Black King has moved, both King-side and Queen-side castling are no longer allowed.
-            blackCastleKingSide = false;
-            blackCastleQueenSide = false;
+            state.castlingRights &= ~(BLACK_KING_SIDE | BLACK_QUEEN_SIDE);
         }
     }
 }
 
 // Function to check if a king is in check
 bool Board::isInCheck(Color color) { 
-  // Function to check if a king is in check
-    Position kingPos = findKing(color)->getPosition(); 
-  // Find the king's position
-    for (const auto& entry : pieceMap) {
-        if (entry.second->getColor() != color) {
-            auto moves = entry.second->legalMoves(pieceMap, lastMovePos, enPassantAvailable); 
-            // Pass enPassantAvailable
-            if (moves.find(kingPos) != moves.end()) {
-                return true;
+    INSTRUMENT_TIMER(IN_CHECK);
+    return isSquareAttacked(state.kingSquare[colorIndex(color)], opponent(color));
+    // Look outward from the cached king square for any enemy piece that reaches it
+}
+
+bool Board::isSquareAttacked(const Position& square, Color attacker) const {
+    return isSquareAttacked(square.toSquare(), attacker);
+}
+
+// Attacks are symmetric: a knight on the square would reach exactly the squares knights attack it
+// from, and likewise for kings and sliders. Pawns are the exception, so the defender's pawn
+// pattern is used to find attacking pawns.
+bool Board::isSquareAttacked(int square, Color attacker) const {
+    const Bitboard occupied = state.occupancy();
+    const Bitboard queens = state.piecesOf(attacker, PieceType::QUEEN);
+    return (pawnAttacks(opponent(attacker), square) & state.piecesOf(attacker, PieceType::PAWN)) ||
+           (attackTables.knight[square] & state.piecesOf(attacker, PieceType::KNIGHT)) ||
+           (attackTables.king[square] & state.piecesOf(attacker, PieceType::KING)) ||
+           (bishopAttacks(square, occupied) & (state.piecesOf(attacker, PieceType::BISHOP) | queens)) ||
+           (rookAttacks(square, occupied) & (state.piecesOf(attacker, PieceType::ROOK) | queens));
+}
+
+// Function to check if the current player is in checkmate
+bool Board::isCheckmate(Color color) {
+    MoveList moves;
+    generateLegalMovesFor(color, moves);
+    return moves.empty() && isInCheck(color);
+    // Checkmate: no legal move and the king is attacked
+}
+
+// Check if the current player is in stalemate
+bool Board::isStalemate(Color color) { 
+    MoveList moves;
+    generateLegalMovesFor(color, moves);
+    return moves.empty() && !isInCheck(color);
+    // Stalemate: no legal move while the king is not attacked
+}
+
+// Check if the position has repeated. Only positions since the last capture or pawn move can match,
+// and of those only every second one has the same side to move, so the scan starts two plies back
+// and steps by two for at most halfmoveClock plies.
+bool Board::isRepetition(int earlier) const {
+    const std::size_t ply = plyBase + history.size();
+    std::size_t reach = std::min<std::size_t>(static_cast<std::size_t>(state.halfmoveClock), ply);
+    reach = std::min<std::size_t>(reach, KEY_RING_SIZE - 1);
+    int found = 0;
+    for (std::size_t back = 2; back <= reach; back += 2) {
+        if (keyRing[(ply - back) % KEY_RING_SIZE] == state.hash && ++found >= earlier) return true;
+    }
+    return false;
+}
+
+// Method to find out how the game stands. The legal move count and check state depend only on the
+// position, so they are remembered by its key; whether a position has repeated depends on the moves
+// that led to it, so that part is checked every time, which costs only a short scan of the key ring.
+GameStatus Board::status() const {
+    if (!statusValid || statusKey != state.hash) {
+        MoveList moves;
+        generateLegalMovesFor(state.turn, moves);
+        statusKey = state.hash;
+        statusMoves = static_cast<std::uint16_t>(moves.size());
+        statusInCheck = isSquareAttacked(state.kingSquare[colorIndex(state.turn)], opponent(state.turn));
+        statusValid = true;
+    }
+
+    if (statusMoves == 0) return statusInCheck ? GameStatus::CHECKMATE : GameStatus::STALEMATE;
+    if (state.halfmoveClock >= 100 || isRepetition(2)) return GameStatus::DRAW;
+    return statusInCheck ? GameStatus::CHECK : GameStatus::PLAYING;
+}
+
+// Check if the game is drawn: the same position for the third time, or 100 plies without a capture
+// or pawn move. A checkmate delivered on the hundredth ply still wins, so that case is excluded.
+bool Board::isDraw() const {
+    if (isRepetition(2)) return true;
+    if (state.halfmoveClock < 100) return false;
+    MoveList moves;
+    generateLegalMovesFor(state.turn, moves);
+    return !moves.empty() || !isSquareAttacked(state.kingSquare[colorIndex(state.turn)], opponent(state.turn));
+}
+
+bool Board::simulateMoveAndCheck(const Position& from, const Position& to, Color color) {
+    MoveList moves;
+    generateMovesFor(color, moves);
+    Move move = findMove(moves, from, to, PieceType::QUEEN);
+    // Look up the full move (flags included) so captures and special moves are simulated correctly
+    return !move.isNone() && simulateMoveAndCheck(move, color);
+}
+
+bool Board::simulateMoveAndCheck(Move move, Color color) {
+    INSTRUMENT_TIMER(SIMULATE_MOVE);
+    makeMove(move);
+    // Simulate the move
+    bool inCheck = isInCheck(color);
+    unmakeMove();
+    // Revert the move from its undo record
+    return inCheck;
+}
+
+
+Position Board::findKing(Color color) const {
+    // The king's square is cached in the board state and kept current by makeMove/unmakeMove.
+    return Position::fromSquare(state.kingSquare[colorIndex(color)]);
+}
+
+Bitboard Board::legalMovesFrom(const Position& from) const {
+    int square = from.toSquare();
+    Piece piece = state.mailbox[square];
+    if (piece == NO_PIECE) return 0;
+    return pieceTargets(state, colorOf(piece), typeOf(piece), square);
+}
+
+void Board::generateMoves(MoveList& moves) const {
+    moves.clear();
+    generateMovesFor(state.turn, moves);
+}
+
+void Board::generateMovesFor(Color side, MoveList& moves) const {
+    const Bitboard own = state.occupancy(side);
+    const Bitboard enemy = state.occupancy(opponent(side));
+    const Bitboard occupied = own | enemy;
+    const bool white = side == Color::WHITE;
+    const int forward = white ? 8 : -8;
+    const int startRank = white ? 1 : 6;
+    const int lastRank = white ? 7 : 0;
+
+    // Adds a pawn move, expanding it into the four promotions when it reaches the last rank.
+    auto addPawnMove = [&moves, lastRank](int from, int to, int flags) {
+        if (to / 8 == lastRank) {
+            for (int promotion = 3; promotion >= 0; --promotion) {
+                moves.add(Move(from, to, Move::PROMOTION | (flags & Move::CAPTURE) | promotion));
             }
+        } else {
+            moves.add(Move(from, to, flags));
+        }
+    };
+
+    // Pawns: single and double pushes onto empty squares, diagonal captures and en passant.
+    Bitboard pawns = state.piecesOf(side, PieceType::PAWN);
+    while (pawns) {
+        int from = popLsb(pawns);
+        int to = from + forward;
+        if (!(occupied & squareBit(to))) {
+            addPawnMove(from, to, Move::QUIET);
+            if (from / 8 == startRank && !(occupied & squareBit(to + forward))) {
+                moves.add(Move(from, to + forward, Move::DOUBLE_PAWN_PUSH));
+            }
+        }
+        Bitboard captures = pawnAttacks(side, from) & enemy;
+        while (captures) {
+            addPawnMove(from, popLsb(captures), Move::CAPTURE);
+        }
+        if (state.enPassantSquare >= 0 && side == state.turn &&
+            (pawnAttacks(side, from) & squareBit(state.enPassantSquare))) {
+            moves.add(Move(from, state.enPassantSquare, Move::EN_PASSANT));
         }
     }
 
-    return false;
+    // Knights, bishops, rooks, queens and the king move to any attacked square not held by their side.
+    for (int type = static_cast<int>(PieceType::KNIGHT); type <= static_cast<int>(PieceType::KING); ++type) {
+        Bitboard pieces = state.piecesOf(side, static_cast<PieceType>(type));
+        while (pieces) {
+            int from = popLsb(pieces);
+            Bitboard targets = pieceAttacks(static_cast<PieceType>(type), from, occupied) & ~own;
+            while (targets) {
+                int to = popLsb(targets);
+                moves.add(Move(from, to, (enemy & squareBit(to)) ? Move::CAPTURE : Move::QUIET));
+            }
+        }
+    }
+
+    // Castling: the right must still be held and the squares between king and rook must be empty.
+    // Whether the king passes through check is left to the caller, as for every other pseudo-legal move.
+    const int kingSquare = white ? 4 : 60;
+    const Bitboard rooks = state.piecesOf(side, PieceType::ROOK);
+    if (state.piecesOf(side, PieceType::KING) & squareBit(kingSquare)) {
+        std::uint8_t kingSide = white ? WHITE_KING_SIDE : BLACK_KING_SIDE;
+        std::uint8_t queenSide = white ? WHITE_QUEEN_SIDE : BLACK_QUEEN_SIDE;
+        if ((state.castlingRights & kingSide) && (rooks & squareBit(kingSquare + 3)) &&
+            !(occupied & (squareBit(kingSquare + 1) | squareBit(kingSquare + 2)))) {
+            moves.add(Move(kingSquare, kingSquare + 2, Move::KING_CASTLE));
+        }
+        if ((state.castlingRights & queenSide) && (rooks & squareBit(kingSquare - 4)) &&
+            !(occupied & (squareBit(kingSquare - 1) | squareBit(kingSquare - 2) | squareBit(kingSquare - 3)))) {
+            moves.add(Move(kingSquare, kingSquare - 2, Move::QUEEN_CASTLE));
+        }
+    }
 }
 
-// Function to check if the current player is in checkmate
-bool Board::isCheckmate(Color color) {
-    if (!isInCheck(color)) return false;  
-   // If the current player is not in check, it's not checkmate
-
-    for (const auto& entry : pieceMap) {
-        if (entry.second->getColor() == color) {  
-          // Iterate over pieces of the current player
-            auto moves = entry.second->legalMoves(pieceMap, lastMovePos, enPassantAvailable); 
-            // Pass enPassantAvailable
-            for (const auto& move : moves) {
-                if (!simulateMoveAndCheck(entry.first, move, color)) {
-                  // Check if the move is legal
-
-                    return false;
-                }
+void Board::generateLegalMoves(MoveList& moves) const {
+    moves.clear();
+    generateLegalMovesFor(state.turn, moves);
+}
+
+Bitboard Board::attackersTo(int square, Color attacker, Bitboard occupied) const {
+    return ::attackersTo(state, square, attacker, occupied);
+}
+
+// Legal move generation. The checkers and pinned pieces are found once from the king square; after
+// that every move is legal by construction:
+// - the king may only step to squares the enemy does not attack (tested with the king lifted off
+//   the board, so it cannot hide behind itself from a slider);
+// - in double check only the king may move;
+// - in single check other pieces must capture the checker or block the line to it;
+// - a pinned piece may only move along the line through its king and the pinning piece;
+// - en passant, which removes two pieces from one rank, is verified against the resulting occupancy;
+// - castling requires that the king is not in check and does not cross or land on an attacked square.
+void Board::generateLegalMovesFor(Color side, MoveList& moves) const {
+    INSTRUMENT_TIMER(LEGAL_MOVES);
+    const Color enemySide = opponent(side);
+    const Bitboard own = state.occupancy(side);
+    const Bitboard enemy = state.occupancy(enemySide);
+    const Bitboard occupied = own | enemy;
+    const int kingSquare = state.kingSquare[colorIndex(side)];
+    const Bitboard enemyQueens = state.piecesOf(enemySide, PieceType::QUEEN);
+    const Bitboard enemyDiagonal = state.piecesOf(enemySide, PieceType::BISHOP) | enemyQueens;
+    const Bitboard enemyStraight = state.piecesOf(enemySide, PieceType::ROOK) | enemyQueens;
+
+    // King moves first: they are the only ones allowed in double check.
+    const Bitboard withoutKing = occupied ^ squareBit(kingSquare);
+    Bitboard kingTargets = attackTables.king[kingSquare] & ~own;
+    while (kingTargets) {
+        int to = popLsb(kingTargets);
+        if (!attackersTo(to, enemySide, withoutKing)) {
+            moves.add(Move(kingSquare, to, (enemy & squareBit(to)) ? Move::CAPTURE : Move::QUIET));
+        }
+    }
+
+    const Bitboard checkers = attackersTo(kingSquare, enemySide, occupied);
+    if (popCount(checkers) > 1) return;
+
+    // Squares a non-king move must land on: anywhere when not in check, otherwise the checker or
+    // a square between it and the king.
+    Bitboard checkMask = ~Bitboard(0);
+    if (checkers) checkMask = checkers | attackTables.between[kingSquare][lsb(checkers)];
+
+    // A piece is pinned when it is the only piece between the king and an enemy slider on that line.
+    Bitboard pinned = 0;
+    Bitboard snipers = (rookAttacks(kingSquare, 0) & enemyStraight) | (bishopAttacks(kingSquare, 0) & enemyDiagonal);
+    while (snipers) {
+        Bitboard blockers = attackTables.between[kingSquare][popLsb(snipers)] & occupied;
+        if (popCount(blockers) == 1) pinned |= blockers & own;
+    }
+
+    // Restricts a piece's targets to the check mask and, when pinned, to its pin line.
+    auto legalTargets = [&](int from, Bitboard targets) {
+        targets &= checkMask;
+        if (pinned & squareBit(from)) targets &= attackTables.line[kingSquare][from];
+        return targets;
+    };
+
+    const bool white = side == Color::WHITE;
+    const int forward = white ? 8 : -8;
+    const int startRank = white ? 1 : 6;
+    const int lastRank = white ? 7 : 0;
+    auto addPawnMove = [&moves, lastRank](int from, int to, int flags) {
+        if (to / 8 == lastRank) {
+            for (int promotion = 3; promotion >= 0; --promotion) {
+                moves.add(Move(from, to, Move::PROMOTION | (flags & Move::CAPTURE) | promotion));
             }
+        } else {
+            moves.add(Move(from, to, flags));
+        }
+    };
+
+    Bitboard pawns = state.piecesOf(side, PieceType::PAWN);
+    while (pawns) {
+        int from = popLsb(pawns);
+        Bitboard pushes = 0;
+        int to = from + forward;
+        if (!(occupied & squareBit(to))) {
+            pushes |= squareBit(to);
+            if (from / 8 == startRank && !(occupied & squareBit(to + forward))) pushes |= squareBit(to + forward);
+        }
+        pushes = legalTargets(from, pushes);
+        while (pushes) {
+            int target = popLsb(pushes);
+            if (target == from + 2 * forward) moves.add(Move(from, target, Move::DOUBLE_PAWN_PUSH));
+            else addPawnMove(from, target, Move::QUIET);
+        }
+        Bitboard captures = legalTargets(from, pawnAttacks(side, from) & enemy);
+        while (captures) {
+            addPawnMove(from, popLsb(captures), Move::CAPTURE);
+        }
+
+        // En passant removes the capturing and the captured pawn from the same rank, which can expose
+        // the king along that rank, so it is checked against the occupancy after the capture.
+        if (state.enPassantSquare >= 0 && side == state.turn &&
+            (pawnAttacks(side, from) & squareBit(state.enPassantSquare))) {
+            int target = state.enPassantSquare;
+            int capturedSquare = target - forward;
+            Bitboard after = (occupied ^ squareBit(from) ^ squareBit(capturedSquare)) | squareBit(target);
+            Bitboard enemyPawns = state.piecesOf(enemySide, PieceType::PAWN) & ~squareBit(capturedSquare);
+            bool exposed = (rookAttacks(kingSquare, after) & enemyStraight) ||
+                           (bishopAttacks(kingSquare, after) & enemyDiagonal) ||
+                           (attackTables.knight[kingSquare] & state.piecesOf(enemySide, PieceType::KNIGHT)) ||
+                           (pawnAttacks(side, kingSquare) & enemyPawns);
+            if (!exposed) moves.add(Move(from, target, Move::EN_PASSANT));
+        }
+    }
+
+    for (int type = static_cast<int>(PieceType::KNIGHT); type <= static_cast<int>(PieceType::QUEEN); ++type) {
+        Bitboard pieces = state.piecesOf(side, static_cast<PieceType>(type));
+        while (pieces) {
+            int from = popLsb(pieces);
+            Bitboard targets = legalTargets(from, pieceAttacks(static_cast<PieceType>(type), from, occupied) & ~own);
+            while (targets) {
+                int to = popLsb(targets);
+                moves.add(Move(from, to, (enemy & squareBit(to)) ? Move::CAPTURE : Move::QUIET));
+            }
+        }
+    }
+
+    const int homeSquare = white ? 4 : 60;
+    if (!checkers && kingSquare == homeSquare) {
+        const Bitboard rooks = state.piecesOf(side, PieceType::ROOK);
+        std::uint8_t kingSide = white ? WHITE_KING_SIDE : BLACK_KING_SIDE;
+        std::uint8_t queenSide = white ? WHITE_QUEEN_SIDE : BLACK_QUEEN_SIDE;
+        if ((state.castlingRights & kingSide) && (rooks & squareBit(kingSquare + 3)) &&
+            !(occupied & (squareBit(kingSquare + 1) | squareBit(kingSquare + 2))) &&
+            !attackersTo(kingSquare + 1, enemySide, occupied) && !attackersTo(kingSquare + 2, enemySide, occupied)) {
+            moves.add(Move(kingSquare, kingSquare + 2, Move::KING_CASTLE));
+        }
+        if ((state.castlingRights & queenSide) && (rooks & squareBit(kingSquare - 4)) &&
+            !(occupied & (squareBit(kingSquare - 1) | squareBit(kingSquare - 2) | squareBit(kingSquare - 3))) &&
+            !attackersTo(kingSquare - 1, enemySide, occupied) && !attackersTo(kingSquare - 2, enemySide, occupied)) {
+            moves.add(Move(kingSquare, kingSquare - 2, Move::QUEEN_CASTLE));
         }
     }
-    return true;
 }
 
-// Check if the current player is in stalemate
-bool Board::isStalemate(Color color) { 
+// Removes and returns the next space-separated field of 'text', or an empty view at the end.
+// The field points into the caller's text, so splitting a FEN never copies or allocates.
+static std::string_view nextField(std::string_view& text) {
+    std::size_t start = text.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        text = std::string_view();
+        return text;
+    }
+    text.remove_prefix(start);
+    std::size_t end = std::min(text.find_first_of(" \t"), text.size());
+    std::string_view field = text.substr(0, end);
+    text.remove_prefix(end);
+    return field;
+}
+
+// Parses a non-negative decimal number that makes up the whole field.
+static bool parseNumber(std::string_view field, int& value) {
+    if (field.empty()) return false;
+    std::from_chars_result result = std::from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == std::errc() && result.ptr == field.data() + field.size() && value >= 0;
+}
 
-    if (isInCheck(color)) return false;  
-  // Check if the king is in check
+// Parses the four position fields of a FEN or EPD record (placement, side to move, castling rights
+// and en passant square) into 'parsed', followed by the halfmove and fullmove counters when they are
+// present. 'text' is advanced past everything consumed, so an EPD record's operations are what remains.
+// Returns false if the fields do not describe a valid position; 'parsed' is then unspecified.
+bool parseFEN(std::string_view& text, BoardState& parsed) {
+    parsed.clear();
 
-    for (const auto& entry : pieceMap) {
-        if (entry.second->getColor() == color) { 
-          // Check if the piece is of the given color
+    std::string_view placement = nextField(text);
+    int rank = 7, file = 0;
+    for (char c : placement) {
+        if (c == '/') {
+            if (file != 8 || rank == 0) return false;
+            --rank;
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8) return false;
+        } else {
+            const char* symbols = "PNBRQKpnbrqk";
+            const char* symbol = std::char_traits<char>::find(symbols, 12, c);
+            if (!symbol || file > 7) return false;
+            int index = static_cast<int>(symbol - symbols);
+            Color color = index < 6 ? Color::WHITE : Color::BLACK;
+            PieceType type = static_cast<PieceType>(index % 6);
+            if (type == PieceType::KING) parsed.kingSquare[colorIndex(color)] = static_cast<std::uint8_t>(rank * 8 + file);
+            parsed.addPiece(color, type, rank * 8 + file);
+            ++file;
+        }
+    }
+    if (rank != 0 || file != 8) return false;
+    // A pawn on the first or eighth rank has no square to move to or capture on, and the pawn
+    // generators would shift it off the board.
+    const Bitboard backRanks = 0xFF000000000000FFULL;
+    if ((parsed.piecesOf(Color::WHITE, PieceType::PAWN) | parsed.piecesOf(Color::BLACK, PieceType::PAWN)) & backRanks) {
+        return false;
+    }
+    if (popCount(parsed.piecesOf(Color::WHITE, PieceType::KING)) != 1 ||
+        popCount(parsed.piecesOf(Color::BLACK, PieceType::KING)) != 1) {
+        return false; // Each side needs exactly one king.
+    }
+    // Neither side may have more material than its sixteen starting pieces can become: at most eight
+    // pawns, and every piece beyond the starting set (a ninth queen, a third rook, a second bishop
+    // on one square color, ...) needs a pawn that is missing to have promoted from. This keeps the
+    // move count of any accepted position within MoveList's capacity.
+    const Bitboard lightSquares = 0x55AA55AA55AA55AAULL;
+    for (Color color : { Color::WHITE, Color::BLACK }) {
+        const Bitboard bishops = parsed.piecesOf(color, PieceType::BISHOP);
+        int pawns = popCount(parsed.piecesOf(color, PieceType::PAWN));
+        int promoted = std::max(popCount(parsed.piecesOf(color, PieceType::QUEEN)) - 1, 0) +
+                       std::max(popCount(parsed.piecesOf(color, PieceType::ROOK)) - 2, 0) +
+                       std::max(popCount(parsed.piecesOf(color, PieceType::KNIGHT)) - 2, 0) +
+                       std::max(popCount(bishops & lightSquares) - 1, 0) +
+                       std::max(popCount(bishops & ~lightSquares) - 1, 0);
+        if (pawns > 8 || promoted > 8 - pawns) return false;
+    }
 
-            auto moves = entry.second->legalMoves(pieceMap, lastMovePos, enPassantAvailable);
-            // Pass enPassantAvailable
-            for (const auto& move : moves) { 
-              // Loop through all possible moves
+    std::string_view side = nextField(text);
+    if (side != "w" && side != "b") return false;
+    parsed.turn = side == "w" ? Color::WHITE : Color::BLACK;
 
-                if (!simulateMoveAndCheck(entry.first, move, color)) {
-                  // Check if the move is valid
-                    return false;
-                }
+    std::string_view castling = nextField(text);
+    if (castling.empty()) return false;
+    for (char c : castling) {
+        switch (c) {
+            case 'K': parsed.castlingRights |= WHITE_KING_SIDE; break;
+            case 'Q': parsed.castlingRights |= WHITE_QUEEN_SIDE; break;
+            case 'k': parsed.castlingRights |= BLACK_KING_SIDE; break;
+            case 'q': parsed.castlingRights |= BLACK_QUEEN_SIDE; break;
+            case '-': break;
+            default: return false;
+        }
+    }
+    // A right is only kept if its king and rook are still on their starting squares; records from
+    // databases sometimes carry stale rights, and castling without the rook would corrupt the board.
+    for (int square : { 0, 4, 7, 56, 60, 63 }) {
+        PieceType expected = (square % 8 == 4) ? PieceType::KING : PieceType::ROOK;
+        Color owner = square < 8 ? Color::WHITE : Color::BLACK;
+        if (parsed.mailbox[square] != makePiece(owner, expected)) {
+            parsed.castlingRights &= castlingRightsKept(square);
+        }
+    }
+
+    std::string_view enPassant = nextField(text);
+    if (enPassant.size() == 2) {
+        Position square(enPassant[0], enPassant[1] - '0');
+        if (!square.isOnBoard()) return false;
+        parsed.enPassantSquare = static_cast<std::int8_t>(square.toSquare());
+    } else if (enPassant != "-") {
+        return false;
+    }
+
+    // The counters are optional and EPD records normally leave them out, so a field is only taken
+    // as a counter if it is a number.
+    std::string_view rest = text;
+    int counter = 0;
+    if (parseNumber(nextField(rest), counter)) {
+        parsed.halfmoveClock = static_cast<std::uint16_t>(std::min(std::max(counter, 0), 0xFFFF));
+        text = rest;
+        if (parseNumber(nextField(rest), counter)) {
+            parsed.fullmoveNumber = static_cast<std::uint16_t>(std::max(counter, 1));
+            text = rest;
+        }
+    }
+
+    // The side that just moved cannot have left its king in check.
+    const Color moved = opponent(parsed.turn);
+    if (attackersTo(parsed, parsed.kingSquare[colorIndex(moved)], parsed.turn, parsed.occupancy())) return false;
+
+    // The en passant square is only kept when it is one a double push by the side that just moved
+    // could have skipped, on the third or sixth rank with that pawn in front of it and the pawn's
+    // start square and the skipped square empty, and when a pawn can actually capture there, as
+    // makeMove() does, so that the same position always gets the same key and en passant never
+    // takes a pawn that is not there.
+    if (parsed.enPassantSquare >= 0) {
+        const int skipped = parsed.enPassantSquare;
+        const int forward = moved == Color::WHITE ? 8 : -8;
+        const int expectedRank = moved == Color::WHITE ? 2 : 5;
+        bool possible = skipped / 8 == expectedRank &&
+                        parsed.mailbox[skipped + forward] == makePiece(moved, PieceType::PAWN) &&
+                        parsed.mailbox[skipped] == NO_PIECE && parsed.mailbox[skipped - forward] == NO_PIECE;
+        if (!possible || !(pawnAttacks(moved, skipped) & parsed.piecesOf(parsed.turn, PieceType::PAWN))) {
+            parsed.enPassantSquare = -1;
+        }
+    }
+    parsed.hash = parsed.computeHash();
+    parsed.psqt = parsed.computePsqt();
+    parsed.phase = parsed.computePhase();
+    return true;
+}
+
+// Appends the position in FEN, with both counters, to 'out'. Output fits in 90 characters.
+void appendFEN(const BoardState& state, std::string& out) {
+    for (int rank = 7; rank >= 0; --rank) {
+        int empty = 0;
+        for (int file = 0; file < 8; ++file) {
+            Piece piece = state.mailbox[rank * 8 + file];
+            if (piece == NO_PIECE) {
+                ++empty;
+                continue;
             }
+            if (empty) out += static_cast<char>('0' + empty);
+            empty = 0;
+            out += pieceSymbol(piece);
+        }
+        if (empty) out += static_cast<char>('0' + empty);
+        if (rank) out += '/';
+    }
+
+    out += state.turn == Color::WHITE ? " w " : " b ";
+    if (!state.castlingRights) out += '-';
+    if (state.castlingRights & WHITE_KING_SIDE) out += 'K';
+    if (state.castlingRights & WHITE_QUEEN_SIDE) out += 'Q';
+    if (state.castlingRights & BLACK_KING_SIDE) out += 'k';
+    if (state.castlingRights & BLACK_QUEEN_SIDE) out += 'q';
+
+    out += ' ';
+    if (state.enPassantSquare >= 0) {
+        Position square = Position::fromSquare(state.enPassantSquare);
+        out += square.column;
+        out += static_cast<char>('0' + square.row);
+    } else {
+        out += '-';
+    }
+
+    out += ' ';
+    out += std::to_string(state.halfmoveClock);
+    out += ' ';
+    out += std::to_string(state.fullmoveNumber);
+}
+
+// Method to find the legal move a SAN string such as "Nbd7", "exd6", "e8=Q+" or "O-O" describes.
+// Check, mate and annotation suffixes are ignored; "0-0" and a promotion without '=' are accepted.
+// Returns Move::none() if no legal move matches or the notation is ambiguous.
+Move Board::parseSAN(std::string_view san) const {
+    while (!san.empty() && std::strchr("+#!?", san.back())) san.remove_suffix(1);
+    if (san.size() < 2) return Move::none();
+
+    MoveList moves;
+    generateLegalMoves(moves);
+
+    if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        int flags = san.size() == 3 ? Move::KING_CASTLE : Move::QUEEN_CASTLE;
+        for (Move move : moves) {
+            if (move.flags() == flags) return move;
         }
+        return Move::none();
+    }
+
+    // Piece letter (pawns have none), then optional disambiguation and 'x', the destination, and
+    // for pawns an optional promotion piece.
+    PieceType piece = PieceType::PAWN;
+    const char* pieceLetters = "NBRQK";
+    if (const char* letter = std::strchr(pieceLetters, san.front())) {
+        piece = static_cast<PieceType>(static_cast<int>(PieceType::KNIGHT) + (letter - pieceLetters));
+        san.remove_prefix(1);
+    }
+
+    PieceType promotion = PieceType::NONE;
+    if (piece == PieceType::PAWN && san.size() >= 3 && std::strchr("NBRQ", san.back())) {
+        promotion = static_cast<PieceType>(static_cast<int>(PieceType::KNIGHT) + (std::strchr(pieceLetters, san.back()) - pieceLetters));
+        san.remove_suffix(1);
+        if (san.back() == '=') san.remove_suffix(1);
+    }
+
+    if (san.size() < 2) return Move::none();
+    Position destination(san[san.size() - 2], san[san.size() - 1] - '0');
+    if (!destination.isOnBoard()) return Move::none();
+    san.remove_suffix(2);
+
+    int fromFile = -1, fromRank = -1;
+    for (char c : san) {
+        if (c >= 'a' && c <= 'h') fromFile = c - 'a';
+        else if (c >= '1' && c <= '8') fromRank = c - '1';
+        else if (c != 'x' && c != '-' && c != ':') return Move::none();
+    }
+
+    const int to = destination.toSquare();
+    Move found = Move::none();
+    for (Move move : moves) {
+        if (move.to() != to || state.pieceTypeAt(move.from()) != piece) continue;
+        if (fromFile >= 0 && move.from() % 8 != fromFile) continue;
+        if (fromRank >= 0 && move.from() / 8 != fromRank) continue;
+        if (move.isPromotion() ? move.promotionType() != promotion : promotion != PieceType::NONE) continue;
+        if (!found.isNone()) return Move::none();
+        // A second match: the SAN did not disambiguate enough.
+        found = move;
     }
+    return found;
+}
+
+// Method to set up the board from a position in Forsyth-Edwards Notation, e.g.
+// "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1". The halfmove and fullmove
+// fields are optional. Returns false, leaving the board unchanged, if the text is not a valid FEN.
+bool Board::fromFEN(std::string_view fen) {
+    BoardState parsed;
+    if (!parseFEN(fen, parsed) || !nextField(fen).empty()) return false;
+    // Anything left after the counters means the text was not a FEN.
+    setState(parsed);
     return true;
 }
 
-bool Board::simulateMoveAndCheck(const Position& from, const Position& to, Color color) {
-    ChessPiece* piece = pieceMap[from];
-    ChessPiece* capturedPiece = pieceMap[to]; 
-    // Store the piece at the target position
+// Method to describe the current position in Forsyth-Edwards Notation.
+std::string Board::toFEN() const {
+    std::string fen;
+    fen.reserve(90);
+    appendFEN(state, fen);
+    return fen;
+}
 
-    // Simulate the move
-    piece->setPosition(to);
-    // Move the piece to the target position
-    pieceMap[to] = piece; 
-    // Update the board map
-    pieceMap.erase(from);
-    // Remove the piece from its original position
+void Board::setState(const BoardState& position) {
+    state = position;
+    history.clear();
+    accumulators.clear();
+    plyBase = 0;
+    statusValid = false;
+    lastMovePos = Position('a', 1);
+}
 
-    bool inCheck = isInCheck(color);
+void Board::branchFrom(const Board& other) {
+    state = other.state;
+    history.clear();
+    accumulators.clear();
+    plyBase = other.plyBase + other.history.size();
+    // Only the keys isRepetition() can reach are copied; they keep their ring slots.
+    std::size_t reach = std::min<std::size_t>(std::min<std::size_t>(state.halfmoveClock, plyBase), KEY_RING_SIZE - 1);
+    for (std::size_t back = 1; back <= reach; ++back) {
+        keyRing[(plyBase - back) % KEY_RING_SIZE] = other.keyRing[(plyBase - back) % KEY_RING_SIZE];
+    }
+    statusValid = false;
+    lastMovePos = other.lastMovePos;
+}
 
-    // Revert the move
-    piece->setPosition(from);
-    // Reset the piece's position
-    pieceMap[from] = piece;
-    // Update the board map
-    pieceMap[to] = capturedPiece;
-    // Reset the piece at the target position
+// One record of an EPD file: the position and its operations, e.g. "bm Nf3; id \"test 1\";" or the
+// ";D1 20 ;D2 400" depth counts of a perft suite.
+struct EPDRecord {
+    BoardState state;
+    std::string_view operations;   // Everything after the position fields; valid until the next read.
+    int line = 0;                  // Line number in the input, counting from 1.
 
-    // Clean up
-    return inCheck;
+    // Returns the operand of the first operation with the given opcode, or an empty view if it has none.
+    // Surrounding quotes are not removed.
+    std::string_view operation(std::string_view opcode) const;
+};
+
+std::string_view EPDRecord::operation(std::string_view opcode) const {
+    std::string_view rest = operations;
+    while (!rest.empty()) {
+        std::size_t end = std::min(rest.find(';'), rest.size());
+        std::string_view op = rest.substr(0, end);
+        rest.remove_prefix(std::min(end + 1, rest.size()));
+
+        std::string_view code = nextField(op);
+        if (code == opcode) {
+            std::size_t start = op.find_first_not_of(" \t");
+            if (start == std::string_view::npos) return std::string_view();
+            op.remove_prefix(start);
+            return op.substr(0, op.find_last_not_of(" \t\r") + 1);
+        }
+    }
+    return std::string_view();
 }
 
+// Reads EPD (or plain FEN) records from a stream one line at a time. The line buffer is reused and
+// every field is parsed in place, so after the first few lines reading allocates nothing, however
+// many positions the file holds. Blank lines and lines starting with '#' are skipped.
+class EPDReader {
+private:
+    std::istream& input;
+    std::string line;
+    int lineNumber;
+    int errorCount;
+
+public:
+    explicit EPDReader(std::istream& in) : input(in), lineNumber(0), errorCount(0) {}
+
+    // Reads the next valid record. Malformed lines are counted and skipped.
+    // Returns false at the end of the input.
+    bool next(EPDRecord& record);
 
-ChessPiece* Board::findKing(Color color) const {
-    for (const auto& entry : pieceMap) {
-        if (entry.second->getColor() == color && entry.second->toString() == (color == Color::WHITE ? "K" : "k")) {
-            // King found
-            return entry.second;
+    int errors() const { return errorCount; }
+    // Number of malformed lines skipped so far.
+};
+
+bool EPDReader::next(EPDRecord& record) {
+    while (std::getline(input, line)) {
+        ++lineNumber;
+        std::string_view text(line);
+        std::size_t start = text.find_first_not_of(" \t\r");
+        if (start == std::string_view::npos || text[start] == '#') continue;
+
+        if (!parseFEN(text, record.state)) {
+            ++errorCount;
+            continue;
         }
+        record.operations = text;
+        record.line = lineNumber;
+        return true;
     }
+    return false;
+}
+
+// Counts the leaf nodes of the legal move tree to the given depth. Leaves are counted from the
+// size of the move list at depth 1 instead of being made, as usual for perft.
+std::uint64_t perft(Board& board, int depth) {
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    if (depth <= 1) return depth == 1 ? static_cast<std::uint64_t>(moves.size()) : 1;
 
-    return nullptr;
+    std::uint64_t nodes = 0;
+    for (Move move : moves) {
+        board.makeMove(move);
+        nodes += perft(board, depth - 1);
+        board.unmakeMove();
+    }
+    return nodes;
 }
 
-//This is the main game loop, where the board is displayed, and the user is prompted for input. The loop continues until the program is terminated.
-int main() {
-    std::cout << "Welcome to My Chess Game!\n";
-    std::cout << "In this game, you will move pieces on a chessboard to checkmate your opponent.\n";
-    std::cout << "Each player takes turns moving one piece at a time.\n";
-    std::cout << "Type your move using standard chess notation (e.g., 'e2 e4').\n";
-    std::cout << "You can move a piece to an empty square or capture an opponent's piece by moving to its square.\n\n";
-    std::cout << "Let's get started!\n\n";
+// A reference position with its published perft node counts.
+struct PerftCase {
+    const char* name;
+    const char* fen;
+    int depth;
+    std::uint64_t nodes;
+};
+
+const char* const START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// Standard perft suite (positions 1-6 from the Chess Programming Wiki "Perft Results" page).
+// Together they exercise castling, en passant, promotions, pins and discovered checks.
+const PerftCase PERFT_SUITE[] = {
+    { "start", START_FEN, 5, 4865609 },
+    { "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603 },
+    { "position3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083 },
+    { "position4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5, 15833292 },
+    { "position5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487 },
+    { "position6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594 }
+};
+
+// Positions the FEN parser must reject, checked with the suite: each would otherwise break move
+// generation (pawns with no square ahead, more moves than a MoveList holds) or is impossible.
+const char* const INVALID_FENS[] = {
+    "P3k3/8/8/8/8/8/8/4K3 w - - 0 1",                                  // White pawn on the eighth rank.
+    "4k3/8/8/8/8/8/8/p3K3 b - - 0 1",                                  // Black pawn on the first rank.
+    "QQQQQQbk/Q4Q1b/Q5QQ/Q6Q/Q6Q/Q6Q/Q6Q/KQQQQQQQ w - - 0 1",          // More queens than promotions allow.
+    "4k3/8/8/8/8/P7/PPPPPPPP/4K3 w - - 0 1",                           // More than eight pawns.
+    "4k2R/8/8/8/8/8/8/4K3 w - - 0 1",                                  // Side not to move in check.
+    "8/8/8/8/8/8/8/4K3 w - - 0 1"                                      // Missing king.
+};
+
+// Returns nodes per second for a node count and elapsed time, guarding against a zero duration.
+static double nodesPerSecond(std::uint64_t nodes, double seconds) {
+    return seconds > 0 ? nodes / seconds : 0.0;
+}
+
+// Entry point for "perft" mode:
+//   perft <depth> [FEN]   node count with per-move breakdown (divide) from the start position or FEN
+//   perft --suite         run the reference suite and the FEN rejection checks, and report failures
+//   perft --epd <file> [max depth]
+//                         check every "D<depth> <nodes>" operation of an EPD perft suite
+// Returns the process exit code: 0 on success, 1 on a mismatch or bad arguments.
+int runPerft(int argc, char* argv[]) {
+    typedef std::chrono::steady_clock Clock;
+
+    if (argc >= 3 && std::string(argv[2]) == "--suite") {
+        bool allPassed = true;
+        std::uint64_t totalNodes = 0;
+        double totalSeconds = 0;
+        for (const PerftCase& test : PERFT_SUITE) {
+            Board board;
+            board.fromFEN(test.fen);
+            Clock::time_point start = Clock::now();
+            std::uint64_t nodes = perft(board, test.depth);
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            totalNodes += nodes;
+            totalSeconds += seconds;
+
+            bool passed = nodes == test.nodes;
+            allPassed = allPassed && passed;
+            std::cout << (passed ? "PASS " : "FAIL ") << test.name << " depth " << test.depth
+                      << ": " << nodes << " nodes (expected " << test.nodes << "), "
+                      << static_cast<std::uint64_t>(nodesPerSecond(nodes, seconds)) << " nps\n";
+        }
+        for (const char* fen : INVALID_FENS) {
+            Board board;
+            bool rejected = !board.fromFEN(fen);
+            allPassed = allPassed && rejected;
+            std::cout << (rejected ? "PASS " : "FAIL ") << "rejects " << fen << "\n";
+        }
+        std::cout << "Total: " << totalNodes << " nodes in " << totalSeconds << " s, "
+                  << static_cast<std::uint64_t>(nodesPerSecond(totalNodes, totalSeconds)) << " nps\n";
+        return allPassed ? 0 : 1;
+    }
+
+    if (argc >= 4 && std::string(argv[2]) == "--epd") {
+        std::ifstream file(argv[3]);
+        if (!file) {
+            std::cerr << "Cannot open " << argv[3] << ".\n";
+            return 1;
+        }
+        int maxDepth = argc > 4 ? std::atoi(argv[4]) : 6;
+
+        EPDReader reader(file);
+        EPDRecord record;
+        Board board;
+        int positions = 0, failures = 0;
+        std::uint64_t totalNodes = 0;
+        Clock::time_point start = Clock::now();
+        while (reader.next(record)) {
+            board.setState(record.state);
+            ++positions;
+            for (int depth = 1; depth <= maxDepth; ++depth) {
+                char opcode[4] = { 'D', static_cast<char>('0' + depth), 0, 0 };
+                // Depths above 9 are spelled with two digits, e.g. "D10".
+                if (depth > 9) {
+                    opcode[1] = static_cast<char>('0' + depth / 10);
+                    opcode[2] = static_cast<char>('0' + depth % 10);
+                }
+                std::string_view expected = record.operation(opcode);
+                if (expected.empty()) continue;
+
+                std::uint64_t nodes = perft(board, depth);
+                totalNodes += nodes;
+                if (std::to_string(nodes) != expected) {
+                    ++failures;
+                    std::cout << "FAIL line " << record.line << " depth " << depth << ": " << nodes
+                              << " nodes (expected " << expected << ") " << board.toFEN() << "\n";
+                }
+            }
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << positions << " positions, " << failures << " failures, " << reader.errors()
+                  << " malformed lines; " << totalNodes << " nodes in " << seconds << " s, "
+                  << static_cast<std::uint64_t>(nodesPerSecond(totalNodes, seconds)) << " nps\n";
+        return failures == 0 && reader.errors() == 0 ? 0 : 1;
+    }
 
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " perft <depth> [FEN]\n"
+                  << "       " << argv[0] << " perft --suite\n"
+                  << "       " << argv[0] << " perft --epd <file> [max depth]\n";
+        return 1;
+    }
+
+    int depth = std::atoi(argv[2]);
+    std::string fen = START_FEN;
+    if (argc > 3) {
+        // The FEN may be passed as one quoted argument or as its separate fields.
+        fen = argv[3];
+        for (int i = 4; i < argc; ++i) fen += std::string(" ") + argv[i];
+    }
 
     Board board;
-    board.display();  
+    if (depth < 1 || !board.fromFEN(fen)) {
+        std::cerr << "Invalid depth or FEN.\n";
+        return 1;
+    }
 
-    std::string from, to;
-    while (true) {
-        // Display the current player's turn
-        std::cout << "It's " << board.getTurnName() << "'s turn.\n";
-        std::cout << "Enter your move in the format 'from_square to_square' (e.g., 'e2 e4').\n";
-        std::cout << "Example: Move your pawn from 'e2' to 'e4'.\n";
-        std::cin >> from >> to;
+    // Divide: the node count below each root move, so a wrong total can be traced to one move.
+    Clock::time_point start = Clock::now();
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    std::uint64_t total = 0;
+    for (Move move : moves) {
+        board.makeMove(move);
+        std::uint64_t nodes = perft(board, depth - 1);
+        board.unmakeMove();
+        total += nodes;
+        std::cout << move.toString() << ": " << nodes << "\n";
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
 
-        if (board.movePiece(from, to)) {
-            board.display();
+    std::cout << "\nMoves: " << moves.size() << "\nNodes: " << total << "\nTime: " << seconds
+              << " s\nNPS: " << static_cast<std::uint64_t>(nodesPerSecond(total, seconds)) << "\n";
+    return 0;
+}
 
-// Check if the game is over
-            if (board.isCheckmate(board.getTurn())) { // Using the getter method
-                std::cout << "\nCheckmate! " << board.getTurnName() << " is in checkmate! Game over.\n";
-                std::cout << "Congratulations to the winner, " << board.getTurnName() << "!\n";
-                std::cout << "Would you like to play again? (Y/N)\n";
-                break;
-              // Ask the user if they want to play again
-            } else if (board.isStalemate(board.getTurn())) { // Using the getter method
-                std::cout << "\nIt's a Stalemate! Neither player can make a legal move. Game over.\n";
+// Kind of score stored in a transposition table entry, relative to the search window it came from.
+enum class Bound : std::uint8_t { NONE = 0, UPPER = 1, LOWER = 2, EXACT = 3 };
+
+// What a transposition table probe returns for a position.
+struct TTData {
+    Move move;   // Best or refuting move found for the position, possibly Move::none().
+    int score;   // Search score (mate scores are stored relative to the position, not the root).
+    int depth;   // Remaining depth the score was searched to.
+    Bound bound; // Whether the score is exact, a lower bound or an upper bound.
+};
+
+// Table counters. Each search thread keeps its own copy, so counting adds no shared writes;
+// the copies are summed when statistics are reported.
+struct TTStats {
+    std::uint64_t probes = 0;
+    std::uint64_t hits = 0;       // Probes that found a verified entry for the position.
+    std::uint64_t stores = 0;
+    std::uint64_t collisions = 0; // Stores that evicted an entry belonging to a different position.
+
+    TTStats& operator+=(const TTStats& other) {
+        probes += other.probes;
+        hits += other.hits;
+        stores += other.stores;
+        collisions += other.collisions;
+        return *this;
+    }
+    std::uint64_t misses() const { return probes - hits; }
+};
+
+// Fixed-size, power-of-two transposition table shared by all search threads.
+//
+// An entry is two 64-bit words (16 bytes): 'data' packs the move, score, depth, bound and age, and
+// 'check' holds the position key XORed with 'data'. A reader accepts an entry only if
+// check ^ data gives back its own key, so an entry torn by two threads writing at once simply fails
+// verification and reads as a miss. That makes locks unnecessary. Four entries form a 64-byte,
+// cache-line-aligned bucket, and a probe touches only the bucket selected by the key.
+class TranspositionTable {
+private:
+    struct Entry {
+        std::atomic<std::uint64_t> check;
+        std::atomic<std::uint64_t> data;
+    };
+
+    struct alignas(64) Bucket {
+        Entry entries[4];
+    };
+
+    std::vector<Bucket> buckets;
+    std::uint64_t bucketMask;  // Number of buckets minus one.
+    std::uint8_t generation;   // Age of the current search, 6 bits, advanced by newSearch().
+
+    // Layout of the data word: move (bits 0-15), score (16-31), depth (32-39), bound (40-41),
+    // age (42-47). Bits 48-63 are unused.
+    static std::uint64_t pack(Move move, int score, int depth, Bound bound, std::uint8_t age) {
+        return static_cast<std::uint64_t>(move.raw()) |
+               static_cast<std::uint64_t>(static_cast<std::uint16_t>(score)) << 16 |
+               static_cast<std::uint64_t>(std::min(std::max(depth, 0), 255)) << 32 |
+               static_cast<std::uint64_t>(bound) << 40 |
+               static_cast<std::uint64_t>(age & 63) << 42;
+    }
+    static Bound boundOf(std::uint64_t data) { return static_cast<Bound>((data >> 40) & 3); }
+    static int depthOf(std::uint64_t data) { return static_cast<int>((data >> 32) & 255); }
+    static std::uint8_t ageOf(std::uint64_t data) { return static_cast<std::uint8_t>((data >> 42) & 63); }
+
+public:
+    explicit TranspositionTable(std::size_t megabytes = 16) : bucketMask(0), generation(0) { resize(megabytes); }
+
+    // Reallocates the table to the largest power-of-two bucket count fitting in 'megabytes' and clears it.
+    // Must not be called while a search is using the table.
+    void resize(std::size_t megabytes) {
+        std::size_t count = std::max<std::size_t>(megabytes, 1) * 1024 * 1024 / sizeof(Bucket);
+        std::size_t powerOfTwo = 1;
+        while (powerOfTwo * 2 <= count) powerOfTwo *= 2;
+        buckets = std::vector<Bucket>(powerOfTwo);
+        bucketMask = powerOfTwo - 1;
+        clear();
+    }
+
+    void clear() {
+        for (Bucket& bucket : buckets) {
+            for (Entry& entry : bucket.entries) {
+                entry.check.store(0, std::memory_order_relaxed);
+                entry.data.store(0, std::memory_order_relaxed);
+            }
+        }
+        generation = 0;
+    }
+
+    // Starts a new search generation, so entries from earlier searches are replaced first.
+    void newSearch() { generation = (generation + 1) & 63; }
+
+    std::size_t sizeInBytes() const { return buckets.size() * sizeof(Bucket); }
+
+    // Looks the position up. Returns true and fills 'out' if a verified entry exists.
+    bool probe(std::uint64_t key, TTData& out, TTStats& stats) const {
+        INSTRUMENT_TIMER(TT_PROBE);
+        ++stats.probes;
+        const Bucket& bucket = buckets[key & bucketMask];
+        for (const Entry& entry : bucket.entries) {
+            std::uint64_t data = entry.data.load(std::memory_order_relaxed);
+            std::uint64_t check = entry.check.load(std::memory_order_relaxed);
+            if ((check ^ data) != key || boundOf(data) == Bound::NONE) continue;
+
+            ++stats.hits;
+            INSTRUMENT_COUNT(TT_HIT);
+            out.move = Move::fromRaw(static_cast<std::uint16_t>(data));
+            out.score = static_cast<std::int16_t>(data >> 16);
+            out.depth = depthOf(data);
+            out.bound = boundOf(data);
+            return true;
+        }
+        return false;
+    }
+
+    // Stores a search result. An entry for the same position is updated in place (keeping its move
+    // if the new result has none); otherwise the entry with the lowest depth, counting each
+    // generation of age as four plies, is replaced. Empty entries are taken first.
+    void store(std::uint64_t key, Move move, int score, int depth, Bound bound, TTStats& stats) {
+        ++stats.stores;
+        Bucket& bucket = buckets[key & bucketMask];
+        Entry* replace = nullptr;
+        int worstValue = 0;
+        std::uint64_t replacedData = 0;
+
+        for (Entry& entry : bucket.entries) {
+            std::uint64_t data = entry.data.load(std::memory_order_relaxed);
+            std::uint64_t check = entry.check.load(std::memory_order_relaxed);
+            if ((check ^ data) == key) {
+                // Same position: don't let a shallower non-exact result overwrite a deeper one
+                // from this search.
+                if (bound != Bound::EXACT && depth + 2 < depthOf(data) && ageOf(data) == generation) return;
+                if (move.isNone()) {
+                    move = Move::fromRaw(static_cast<std::uint16_t>(data));
+                }
+                replace = &entry;
+                replacedData = 0;
+                break;
+            }
+            int age = (generation - ageOf(data)) & 63;
+            int value = boundOf(data) == Bound::NONE ? -1000 : depthOf(data) - 4 * age;
+            if (!replace || value < worstValue) {
+                replace = &entry;
+                worstValue = value;
+                replacedData = data;
+            }
+        }
+
+        if (boundOf(replacedData) != Bound::NONE) ++stats.collisions;
+        std::uint64_t data = pack(move, score, depth, bound, generation);
+        replace->data.store(data, std::memory_order_relaxed);
+        replace->check.store(key ^ data, std::memory_order_relaxed);
+    }
+
+    // Permille of entries in a sample of buckets written during the current search (UCI "hashfull").
+    int hashfull() const {
+        int used = 0;
+        std::size_t sample = std::min<std::size_t>(250, buckets.size());
+        for (std::size_t i = 0; i < sample; ++i) {
+            for (const Entry& entry : buckets[i].entries) {
+                std::uint64_t data = entry.data.load(std::memory_order_relaxed);
+                if (boundOf(data) != Bound::NONE && ageOf(data) == generation) ++used;
+            }
+        }
+        return static_cast<int>(used * 1000 / (sample * 4));
+    }
+};
+
+// Static evaluation. Material and piece-square values are kept up to date by Board::makeMove() as
+// one packed middlegame/endgame sum, so evaluating a leaf is a blend of two numbers rather than a
+// scan of the board: the middlegame half counts for more while many pieces remain and the endgame
+// half takes over as they are traded, according to the phase counter.
+class Evaluator {
+public:
+    // Returns the score in centipawns from the side to move's point of view.
+    static int evaluate(const BoardState& state);
+
+    // Returns the score from White's point of view, which is what the tables hold.
+    static int evaluateWhite(const BoardState& state);
+};
+
+int Evaluator::evaluateWhite(const BoardState& state) {
+    // Promotions can push the phase past its starting value; treat that as a full middlegame.
+    int phase = std::min<int>(state.phase, MAX_PHASE);
+    return (middlegameValue(state.psqt) * phase + endgameValue(state.psqt) * (MAX_PHASE - phase)) / MAX_PHASE;
+}
+
+int Evaluator::evaluate(const BoardState& state) {
+    INSTRUMENT_TIMER(EVALUATE);
+    int score = evaluateWhite(state);
+    return state.turn == Color::WHITE ? score : -score;
+}
+
+// Batch evaluation of many unrelated positions, for analysis sweeps and training data. The positions
+// are stored column by column (all white pawn bitboards, then all white knight bitboards, ...), so
+// the kernels load the same bitboard of several positions with one vector load and work on them
+// side by side, one position per 64-bit lane.
+//
+// The kernels are written once, as a template over the lane type, using GCC's generic vector types:
+// a plain uint64_t for one lane, 128-bit vectors (SSE2 on x86, NEON on ARM) for two and 256-bit AVX2
+// vectors for four. The AVX2 build is compiled with a function-level target attribute and chosen at
+// run time, so the program still runs on processors without AVX2.
+//
+// The vector kernels compute the terms that are pure bit arithmetic: material and game phase from
+// piece counts, and mobility from set-wise attack fills (Kogge-Stone) of all of a side's knights,
+// bishops, rooks and queens at once. The piece-square sum is one table load per piece; a gather of
+// four lanes costs more than the four scalar loads it replaces, so it is summed per position.
+struct PositionBatch {
+    std::vector<Bitboard> pieces[12];           // Indexed by pieceIndex(), one entry per position.
+    std::vector<std::uint8_t> blackToMove;
+
+    std::size_t size() const { return blackToMove.size(); }
+    void clear();
+    void reserve(std::size_t positions);
+    void add(const BoardState& state);
+};
+
+void PositionBatch::clear() {
+    for (auto& column : pieces) column.clear();
+    blackToMove.clear();
+}
+
+void PositionBatch::reserve(std::size_t positions) {
+    for (auto& column : pieces) column.reserve(positions);
+    blackToMove.reserve(positions);
+}
+
+void PositionBatch::add(const BoardState& state) {
+    for (int i = 0; i < 12; ++i) pieces[i].push_back(state.pieces[i]);
+    blackToMove.push_back(state.turn == Color::BLACK);
+}
+
+// Evaluation terms of every position of a batch, also column by column.
+struct BatchTerms {
+    std::vector<std::int32_t> score;      // Evaluator::evaluate(): side to move's point of view.
+    std::vector<std::int32_t> material;   // PIECE_VALUES balance, White's point of view.
+    std::vector<std::int32_t> mobility;   // Squares attacked by White's pieces not holding a white piece, less Black's.
+    std::vector<std::int32_t> phase;      // Game phase, 0 (bare kings) to MAX_PHASE and above.
+};
+
+#pragma GCC diagnostic ignored "-Wpsabi"
+// The 256-bit helpers are only ever inlined into the AVX2 kernel, so the ABI note GCC gives for
+// returning them by value outside AVX2 code never applies. GCC reports it where the translation unit
+// ends, so the warning stays off from here on.
+typedef std::uint64_t Lanes2 __attribute__((vector_size(16)));
+typedef std::uint64_t Lanes4 __attribute__((vector_size(32)));
+// Two and four bitboards processed together.
+
+const Bitboard NOT_FILE_A = 0xFEFEFEFEFEFEFEFEULL, NOT_FILE_H = 0x7F7F7F7F7F7F7F7FULL;
+const Bitboard NOT_FILE_AB = 0xFCFCFCFCFCFCFCFCULL, NOT_FILE_GH = 0x3F3F3F3F3F3F3F3FULL;
+
+template <int Shift, class V>
+inline __attribute__((always_inline)) V shiftLanes(const V& bits) {
+    if (Shift > 0) return bits << (Shift > 0 ? Shift : 0);
+    return bits >> (Shift < 0 ? -Shift : 0);
+}
+
+// Squares reached by sliding from 'sliders' in one direction until blocked, blockers included.
+// 'wrap' masks out squares that would wrap around the board edge in that direction.
+template <int Shift, class V>
+inline __attribute__((always_inline)) V slideAttacks(const V& from, const V& open, Bitboard wrap) {
+    V sliders = from, empty = open & wrap;
+    sliders |= empty & shiftLanes<Shift>(sliders);
+    empty &= shiftLanes<Shift>(empty);
+    sliders |= empty & shiftLanes<2 * Shift>(sliders);
+    empty &= shiftLanes<2 * Shift>(empty);
+    sliders |= empty & shiftLanes<4 * Shift>(sliders);
+    return shiftLanes<Shift>(sliders) & wrap;
+}
+
+template <class V>
+inline __attribute__((always_inline)) V knightAttackSet(const V& knights) {
+    V one = ((knights >> 1) & NOT_FILE_H) | ((knights << 1) & NOT_FILE_A);
+    V two = ((knights >> 2) & NOT_FILE_GH) | ((knights << 2) & NOT_FILE_AB);
+    return (one << 16) | (one >> 16) | (two << 8) | (two >> 8);
+}
+
+// Population count with shifts, masks and adds only, which every lane type has.
+template <class V>
+inline __attribute__((always_inline)) V countLanes(const V& bits) {
+    V x = bits;
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = x + (x >> 8);
+    x = x + (x >> 16);
+    x = x + (x >> 32);
+    return x & 0x7F;
+}
+
+// Mobility of one side: every square its knights and sliders attack that it does not occupy.
+template <class V>
+inline __attribute__((always_inline)) V sideMobility(const V* pieces, Color side, const V& own, const V& empty) {
+    V diagonal = pieces[pieceIndex(side, PieceType::BISHOP)] | pieces[pieceIndex(side, PieceType::QUEEN)];
+    V straight = pieces[pieceIndex(side, PieceType::ROOK)] | pieces[pieceIndex(side, PieceType::QUEEN)];
+    V attacks = knightAttackSet(pieces[pieceIndex(side, PieceType::KNIGHT)]);
+    attacks |= slideAttacks<9>(diagonal, empty, NOT_FILE_A) | slideAttacks<7>(diagonal, empty, NOT_FILE_H) |
+               slideAttacks<-7>(diagonal, empty, NOT_FILE_A) | slideAttacks<-9>(diagonal, empty, NOT_FILE_H);
+    attacks |= slideAttacks<8>(straight, empty, ~0ULL) | slideAttacks<-8>(straight, empty, ~0ULL) |
+               slideAttacks<1>(straight, empty, NOT_FILE_A) | slideAttacks<-1>(straight, empty, NOT_FILE_H);
+    return countLanes(attacks & ~own);
+}
+
+// Computes material, mobility and phase for positions [first, last), sizeof(V) / 8 at a time; the
+// caller arranges for the range to be a whole number of lanes.
+template <class V>
+inline __attribute__((always_inline)) void batchKernel(const PositionBatch& batch, std::size_t first, std::size_t last,
+                                                       BatchTerms& terms) {
+    const std::size_t lanes = sizeof(V) / sizeof(Bitboard);
+    for (std::size_t at = first; at < last; at += lanes) {
+        V pieces[12];
+        for (int i = 0; i < 12; ++i) std::memcpy(&pieces[i], batch.pieces[i].data() + at, sizeof(V));
+
+        V white = pieces[0] | pieces[1] | pieces[2] | pieces[3] | pieces[4] | pieces[5];
+        V black = pieces[6] | pieces[7] | pieces[8] | pieces[9] | pieces[10] | pieces[11];
+        V empty = ~(white | black);
+
+        // Material is summed per side so every lane stays unsigned; the difference is taken below.
+        V whiteMaterial = pieces[0] & 0, blackMaterial = pieces[0] & 0, phase = pieces[0] & 0;
+        for (int type = 0; type < 5; ++type) {
+            V whiteCount = countLanes(pieces[type]), blackCount = countLanes(pieces[6 + type]);
+            whiteMaterial += whiteCount * static_cast<std::uint64_t>(PIECE_VALUES[type]);
+            blackMaterial += blackCount * static_cast<std::uint64_t>(PIECE_VALUES[type]);
+            phase += (whiteCount + blackCount) * static_cast<std::uint64_t>(PHASE_WEIGHTS[type]);
+        }
+        V whiteMobility = sideMobility(pieces, Color::WHITE, white, empty);
+        V blackMobility = sideMobility(pieces, Color::BLACK, black, empty);
+
+        std::uint64_t out[4][lanes];
+        std::memcpy(out[0], &whiteMaterial, sizeof(V));
+        std::memcpy(out[1], &blackMaterial, sizeof(V));
+        std::memcpy(out[2], &whiteMobility, sizeof(V));
+        std::memcpy(out[3], &blackMobility, sizeof(V));
+        std::uint64_t phases[lanes];
+        std::memcpy(phases, &phase, sizeof(V));
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            terms.material[at + lane] = static_cast<std::int32_t>(out[0][lane]) - static_cast<std::int32_t>(out[1][lane]);
+            terms.mobility[at + lane] = static_cast<std::int32_t>(out[2][lane]) - static_cast<std::int32_t>(out[3][lane]);
+            terms.phase[at + lane] = static_cast<std::int32_t>(phases[lane]);
+        }
+    }
+}
+
+static void batchKernelScalar(const PositionBatch& batch, std::size_t first, std::size_t last, BatchTerms& terms) {
+    batchKernel<std::uint64_t>(batch, first, last, terms);
+}
+
+static void batchKernel128(const PositionBatch& batch, std::size_t first, std::size_t last, BatchTerms& terms) {
+    batchKernel<Lanes2>(batch, first, last, terms);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void batchKernelAvx2(const PositionBatch& batch, std::size_t first, std::size_t last, BatchTerms& terms) {
+    batchKernel<Lanes4>(batch, first, last, terms);
+}
+#endif
+
+class BatchEvaluator {
+public:
+    enum class Kernel { SCALAR, VECTOR128, AVX2 };
+
+    // The fastest kernel this processor runs.
+    static Kernel best();
+
+    static bool supported(Kernel kernel);
+    static const char* name(Kernel kernel);
+
+    explicit BatchEvaluator(Kernel use = best()) : kernel(supported(use) ? use : Kernel::SCALAR) {}
+    Kernel selected() const { return kernel; }
+
+    // Fills 'terms' for every position of the batch.
+    void evaluate(const PositionBatch& batch, BatchTerms& terms) const;
+
+private:
+    Kernel kernel;
+};
+
+bool BatchEvaluator::supported(Kernel kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernel == Kernel::AVX2) return __builtin_cpu_supports("avx2");
+    return true;
+    // SSE2 is part of every x86-64 processor.
+#else
+    return kernel != Kernel::AVX2;
+    // The 128-bit kernel becomes NEON on ARM, or plain scalar code where there is no vector unit.
+#endif
+}
+
+BatchEvaluator::Kernel BatchEvaluator::best() {
+    return supported(Kernel::AVX2) ? Kernel::AVX2 : Kernel::VECTOR128;
+}
+
+const char* BatchEvaluator::name(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::AVX2: return "avx2";
+#if defined(__ARM_NEON)
+        case Kernel::VECTOR128: return "neon";
+#else
+        case Kernel::VECTOR128: return "sse2";
+#endif
+        default: return "scalar";
+    }
+}
+
+void BatchEvaluator::evaluate(const PositionBatch& batch, BatchTerms& terms) const {
+    const std::size_t count = batch.size();
+    terms.score.resize(count);
+    terms.material.resize(count);
+    terms.mobility.resize(count);
+    terms.phase.resize(count);
+
+    // The vector kernel takes the whole lanes and the scalar one the few positions left over.
+    std::size_t lanes = kernel == Kernel::AVX2 ? 4 : kernel == Kernel::VECTOR128 ? 2 : 1;
+    std::size_t whole = count - count % lanes;
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernel == Kernel::AVX2) batchKernelAvx2(batch, 0, whole, terms);
+#endif
+    if (kernel == Kernel::VECTOR128) batchKernel128(batch, 0, whole, terms);
+    if (kernel == Kernel::SCALAR) whole = 0;
+    batchKernelScalar(batch, whole, count, terms);
+
+    // Piece-square sums, then the same taper Evaluator uses.
+    for (std::size_t at = 0; at < count; ++at) {
+        Score psqt = 0;
+        for (int i = 0; i < 12; ++i) {
+            Bitboard pieces = batch.pieces[i][at];
+            while (pieces) psqt += pieceSquareTables.scores[i][popLsb(pieces)];
+        }
+        int phase = std::min<int>(terms.phase[at], MAX_PHASE);
+        int score = (middlegameValue(psqt) * phase + endgameValue(psqt) * (MAX_PHASE - phase)) / MAX_PHASE;
+        terms.score[at] = batch.blackToMove[at] ? -score : score;
+    }
+}
+
+// Fixed position sets for "bench", one per kind of position the game code spends its time in.
+struct BenchCorpus {
+    const char* name;
+    std::vector<const char*> fens;
+};
+
+const BenchCorpus BENCH_CORPORA[] = {
+    { "opening", {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq c6 0 2",
+        "rnbqkbnr/ppp1pppp/8/3p4/2PP4/8/PP2PPPP/RNBQKBNR b KQkq c3 0 2",
+        "r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3" } },
+    { "middlegame", {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10" } },
+    { "endgame", {
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "8/8/4k3/8/2K5/8/3P4/8 w - - 0 1",
+        "8/5pk1/6p1/8/8/6P1/5PK1/8 w - - 0 1",
+        "4k3/8/8/8/8/8/8/R3K3 w Q - 0 1" } },
+    { "check", {
+        "rnbqkbnr/ppp2ppp/8/1B1pp3/4P3/8/PPPP1PPP/RNBQK1NR b KQkq - 1 3",
+        "4k3/8/8/8/8/8/4q3/4K3 w - - 0 1",
+        "rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3",
+        "8/8/8/8/8/5k2/6q1/7K w - - 0 1",
+        "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1" } },
+};
+
+volatile std::uint64_t benchSink;
+// Every benchmark adds its results here, so the compiler cannot drop the work as unused.
+
+// Runs 'op' (one pass over a corpus, doing 'opsPerPass' operations) in growing batches until at least
+// 'minSeconds' have passed, and returns nanoseconds per operation.
+static double timeBench(const std::function<std::uint64_t()>& op, std::uint64_t opsPerPass, double minSeconds,
+                        std::uint64_t& totalOps) {
+    typedef std::chrono::steady_clock Clock;
+    std::uint64_t sink = op();
+    // One untimed pass warms the caches and the branch predictors.
+    std::uint64_t passes = 1;
+    double seconds = 0;
+    while (true) {
+        Clock::time_point start = Clock::now();
+        for (std::uint64_t i = 0; i < passes; ++i) sink += op();
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= minSeconds || passes >= (1ULL << 40)) break;
+        passes *= seconds > 0 ? std::max<std::uint64_t>(2, static_cast<std::uint64_t>(minSeconds / seconds * 1.2)) : 16;
+    }
+    benchSink = benchSink + sink;
+    totalOps = passes * opsPerPass;
+    return totalOps ? seconds * 1e9 / totalOps : 0;
+}
+
+// Entry point for "bench" mode: times the board's query and update calls, and the evaluators, over
+// fixed position sets.
+//   bench [--format text|json|csv] [--min-time MS] [--filter SUBSTRING] [--nnue FILE]
+// With a network, make_unmake includes the accumulator updates and the network is timed as well.
+// Each line is one benchmark on one corpus with its ns/op, so results can be kept per commit and
+// compared. Returns the process exit code.
+int runBench(int argc, char* argv[]) {
+    std::string format = "text", filter, networkPath;
+    double minSeconds = 0.2;
+    bool usage = false;
+    for (int i = 2; i < argc && !usage; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--format" && hasValue) format = argv[++i];
+        else if (arg == "--min-time" && hasValue) minSeconds = std::atof(argv[++i]) / 1000;
+        else if (arg == "--filter" && hasValue) filter = argv[++i];
+        else if (arg == "--nnue" && hasValue) networkPath = argv[++i];
+        else usage = true;
+    }
+    if (usage || (format != "text" && format != "json" && format != "csv") || minSeconds <= 0) {
+        std::cerr << "Usage: " << argv[0]
+                  << " bench [--format text|json|csv] [--min-time MS] [--filter SUBSTRING] [--nnue FILE]\n";
+        return 1;
+    }
+    if (!networkPath.empty() && !network.load(networkPath.c_str())) {
+        std::cerr << "Cannot load network " << networkPath << ".\n";
+        return 1;
+    }
+
+    struct BenchLine {
+        std::string name, corpus;
+        std::uint64_t ops;
+        double nsPerOp;
+    };
+    std::vector<BenchLine> lines;
+
+    for (const BenchCorpus& corpus : BENCH_CORPORA) {
+        std::vector<Board> boards(corpus.fens.size());
+        std::vector<BoardState> states(corpus.fens.size());
+        for (std::size_t i = 0; i < corpus.fens.size(); ++i) {
+            if (!boards[i].fromFEN(corpus.fens[i])) {
+                std::cerr << "Bad FEN in corpus " << corpus.name << ": " << corpus.fens[i] << "\n";
+                return 1;
+            }
+            states[i] = boards[i].getState();
+        }
+
+        // Each benchmark is a pass over the corpus and the number of operations in one pass.
+        std::vector<std::pair<std::string, std::function<std::uint64_t()>>> benches;
+        std::vector<std::uint64_t> opsPerPass;
+        auto add = [&](const std::string& name, std::uint64_t ops, std::function<std::uint64_t()> op) {
+            benches.emplace_back(name, std::move(op));
+            opsPerPass.push_back(ops);
+        };
+
+        std::uint64_t positions = boards.size();
+        add("legal_moves", positions, [&]() {
+            std::uint64_t sum = 0;
+            MoveList moves;
+            for (Board& board : boards) {
+                board.generateLegalMoves(moves);
+                sum += moves.size();
+            }
+            return sum;
+        });
+
+        // Targets of each piece type, one call per piece of that type on the corpus boards.
+        for (int type = 0; type < 6; ++type) {
+            std::vector<std::pair<std::size_t, Position>> pieces;
+            for (std::size_t i = 0; i < boards.size(); ++i) {
+                Bitboard own = states[i].occupancy(states[i].turn);
+                while (own) {
+                    int square = popLsb(own);
+                    if (states[i].pieceTypeAt(square) == static_cast<PieceType>(type)) {
+                        pieces.emplace_back(i, Position::fromSquare(square));
+                    }
+                }
+            }
+            if (pieces.empty()) continue;
+            static const char* const TYPE_NAMES[6] = { "pawn", "knight", "bishop", "rook", "queen", "king" };
+            add(std::string("targets_") + TYPE_NAMES[type], pieces.size(), [&boards, pieces]() {
+                std::uint64_t sum = 0;
+                for (const auto& piece : pieces) sum += popCount(boards[piece.first].legalMovesFrom(piece.second));
+                return sum;
+            });
+        }
+
+        add("is_in_check", positions, [&]() {
+            std::uint64_t sum = 0;
+            for (Board& board : boards) sum += board.isInCheck(board.getTurn());
+            return sum;
+        });
+        add("is_checkmate", positions, [&]() {
+            std::uint64_t sum = 0;
+            for (Board& board : boards) sum += board.isCheckmate(board.getTurn());
+            return sum;
+        });
+        add("is_stalemate", positions, [&]() {
+            std::uint64_t sum = 0;
+            for (Board& board : boards) sum += board.isStalemate(board.getTurn());
+            return sum;
+        });
+        add("status_uncached", positions, [&]() {
+            std::uint64_t sum = 0;
+            for (std::size_t i = 0; i < boards.size(); ++i) {
+                boards[i].setState(states[i]);
+                // setState() drops the remembered status, so every call does the full work.
+                sum += static_cast<std::uint64_t>(boards[i].status());
+            }
+            return sum;
+        });
+
+        // movePiece with the square names a user would type, each followed by unmakeMove.
+        std::vector<std::pair<std::size_t, std::pair<std::string, std::string>>> typed;
+        for (std::size_t i = 0; i < boards.size(); ++i) {
+            MoveList moves;
+            boards[i].generateLegalMoves(moves);
+            for (Move move : moves) {
+                std::string text = move.toString();
+                typed.push_back({ i, { text.substr(0, 2), text.substr(2) } });
+            }
+        }
+        if (!typed.empty()) {
+            add("move_piece", typed.size(), [&boards, typed]() {
+                std::uint64_t sum = 0;
+                for (const auto& move : typed) {
+                    Board& board = boards[move.first];
+                    if (board.movePiece(move.second.first, move.second.second)) {
+                        sum += board.getHash() & 1;
+                        board.unmakeMove();
+                    }
+                }
+                return sum;
+            });
+        }
+
+        // Incremental hash update (make and unmake every legal move) against hashing from scratch.
+        std::vector<std::pair<std::size_t, Move>> legal;
+        for (std::size_t i = 0; i < boards.size(); ++i) {
+            MoveList moves;
+            boards[i].generateLegalMoves(moves);
+            for (Move move : moves) legal.emplace_back(i, move);
+        }
+        if (!legal.empty()) {
+            add("make_unmake", legal.size(), [&boards, legal]() {
+                std::uint64_t sum = 0;
+                for (const auto& move : legal) {
+                    Board& board = boards[move.first];
+                    board.makeMove(move.second);
+                    sum += board.getHash();
+                    board.unmakeMove();
+                }
+                return sum;
+            });
+        }
+        // Handing a position to another board: a full copy (undo history included) against a branch.
+        add("board_copy", positions, [&boards]() {
+            std::uint64_t sum = 0;
+            for (const Board& board : boards) {
+                Board copy = board;
+                sum += copy.getHash();
+            }
+            return sum;
+        });
+        add("board_branch", positions, [&boards, branch = Board()]() mutable {
+            std::uint64_t sum = 0;
+            for (const Board& board : boards) {
+                branch.branchFrom(board);
+                sum += branch.getHash();
+            }
+            return sum;
+        });
+        add("hash_full", positions, [&states]() {
+            std::uint64_t sum = 0;
+            for (const BoardState& state : states) sum += state.computeHash();
+            return sum;
+        });
+
+        add("fen_parse", positions, [&corpus]() {
+            std::uint64_t sum = 0;
+            BoardState parsed;
+            for (const char* fen : corpus.fens) {
+                std::string_view text = fen;
+                sum += parseFEN(text, parsed);
+            }
+            return sum;
+        });
+
+        // One evaluation per position against the batch kernels, over the corpus repeated to batch
+        // size so the vector loops run long enough to matter.
+        PositionBatch batch;
+        std::vector<BoardState> repeated;
+        for (std::size_t i = 0; i < 256; ++i) {
+            batch.add(states[i % states.size()]);
+            repeated.push_back(states[i % states.size()]);
+        }
+        add("evaluate", repeated.size(), [repeated]() {
+            std::uint64_t sum = 0;
+            for (const BoardState& state : repeated) sum += static_cast<std::uint64_t>(Evaluator::evaluate(state));
+            return sum;
+        });
+        if (network.loaded()) {
+            add(std::string("nnue_refresh_") + network.kernelName(), positions, [&states]() {
+                std::uint64_t sum = 0;
+                Accumulator accumulator;
+                for (const BoardState& state : states) {
+                    network.refresh(state, accumulator);
+                    sum += static_cast<std::uint16_t>(accumulator.values[0][0]);
+                }
+                return sum;
+            });
+            add(std::string("nnue_evaluate_") + network.kernelName(), positions, [&boards]() {
+                std::uint64_t sum = 0;
+                for (const Board& board : boards) {
+                    sum += static_cast<std::uint64_t>(network.evaluate(board.accumulator(), board.getTurn()));
+                }
+                return sum;
+            });
+        }
+        for (BatchEvaluator::Kernel kernel : { BatchEvaluator::Kernel::SCALAR, BatchEvaluator::Kernel::VECTOR128,
+                                               BatchEvaluator::Kernel::AVX2 }) {
+            if (!BatchEvaluator::supported(kernel)) continue;
+            add(std::string("batch_eval_") + BatchEvaluator::name(kernel), batch.size(), [batch, kernel, terms = BatchTerms()]() mutable {
+                BatchEvaluator(kernel).evaluate(batch, terms);
+                return static_cast<std::uint64_t>(terms.score[0] + terms.mobility.back());
+            });
+        }
+
+        for (std::size_t i = 0; i < benches.size(); ++i) {
+            if (!filter.empty() && benches[i].first.find(filter) == std::string::npos) continue;
+            std::uint64_t ops = 0;
+            double nsPerOp = timeBench(benches[i].second, opsPerPass[i], minSeconds, ops);
+            lines.push_back({ benches[i].first, corpus.name, ops, nsPerOp });
+            if (format == "text") {
+                std::cout << corpus.name << "/" << benches[i].first << ": " << nsPerOp << " ns/op (" << ops << " ops)\n";
+            }
+        }
+    }
+
+    if (format == "csv") {
+        std::cout << "benchmark,corpus,ops,ns_per_op\n";
+        for (const BenchLine& line : lines) {
+            std::cout << line.name << "," << line.corpus << "," << line.ops << "," << line.nsPerOp << "\n";
+        }
+    } else if (format == "json") {
+        std::cout << "[\n";
+        for (std::size_t i = 0; i < lines.size(); ++i) {
+            std::cout << "  {\"benchmark\": \"" << lines[i].name << "\", \"corpus\": \"" << lines[i].corpus
+                      << "\", \"ops\": " << lines[i].ops << ", \"ns_per_op\": " << lines[i].nsPerOp << "}"
+                      << (i + 1 < lines.size() ? ",\n" : "\n");
+        }
+        std::cout << "]\n";
+    }
+    return 0;
+}
+
+// Read-only memory mapping of a whole file. The operating system pages the file in on demand, so a
+// multi-gigabyte archive is scanned without reading it into a buffer or copying any of it.
+class MappedFile {
+private:
+    const char* data;
+    std::size_t length;
+
+public:
+    MappedFile() : data(nullptr), length(0) {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the file, replacing any previous mapping. Returns false if it cannot be opened or mapped.
+    // 'sequential' tells the kernel the file will be read front to back; otherwise it expects
+    // scattered reads and does not read ahead.
+    bool open(const char* path, bool sequential = true);
+    void close();
+
+    // The file contents, valid while the mapping is open. Empty for an empty file.
+    std::string_view view() const { return std::string_view(data, length); }
+};
+
+bool MappedFile::open(const char* path, bool sequential) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    bool ok = ::fstat(fd, &info) == 0;
+    if (ok && info.st_size > 0) {
+        void* mapping = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ok = false;
+        } else {
+            data = static_cast<const char*>(mapping);
+            length = static_cast<std::size_t>(info.st_size);
+            ::madvise(mapping, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+            // Archives are read front to back, where aggressive read-ahead pays off; tablebase probes
+            // touch one block here and there, where it would only waste memory and I/O.
+        }
+    }
+    ::close(fd);
+    // The mapping stays valid after the descriptor is closed.
+    return ok;
+}
+
+void MappedFile::close() {
+    if (data) ::munmap(const_cast<char*>(data), length);
+    data = nullptr;
+    length = 0;
+}
+
+// Syzygy endgame tablebases. A WDL file (.rtbw) gives win, draw or loss for every position of one
+// material balance, such as KRPvKR, and a DTZ file (.rtbz) gives the distance in plies to the next
+// capture or pawn move on the way to that result, which is what a perfect player needs to make
+// progress without running into the fifty-move rule.
+//
+// The decoder follows the format of the published Syzygy probing code. A position is turned into an
+// index by choosing a canonical orientation (the board can be mirrored, and without pawns also
+// rotated onto the a1-d1-d4 triangle) and counting piece placements group by group. The value at that
+// index is stored in blocks of a canonical Huffman code over "recursive pairing" symbols, each of
+// which expands into a run of values, so a probe reads one block and walks a small symbol tree.
+//
+// Files are found by scanning the given directories once. They are mapped on first use and kept in a
+// cache of bounded size, least recently used first out, so a six-piece set on shared storage (over
+// a thousand files) does not hold that many mappings and descriptors open. A probe holds a reference
+// to its file, so evicting a table while another thread is reading it is safe.
+//
+// The decoder has not yet been checked against the published files, so loading tables is not enough
+// for them to steer play: the search, the root move choice and Board::adjudicate() consult them only
+// after setPlay(true), which every mode leaves to an explicit option (--syzygy-play, or the UCI
+// option SyzygyPlay). The "syzygy" mode probes single positions regardless, for checking results
+// against known values.
+const int TB_PIECES = 7;
+// Largest tables the decoder handles; the published sets go up to seven pieces.
+
+enum ProbeState { PROBE_FAIL, PROBE_OK, PROBE_CHANGE_STM, PROBE_ZEROING_BEST_MOVE };
+// PROBE_CHANGE_STM: the DTZ table only stores the other side to move. PROBE_ZEROING_BEST_MOVE: the
+// best move is a capture or pawn move, so the stored DTZ value is not meaningful.
+
+// Tablebase results, from the point of view of the side to move. A cursed win is a win that the
+// fifty-move rule turns into a draw, and a blessed loss a loss it saves.
+const int TB_LOSS = -2, TB_BLESSED_LOSS = -1, TB_DRAW = 0, TB_CURSED_WIN = 1, TB_WIN = 2;
+
+// Decoding parameters of one sub-table (one side to move, one leading pawn file).
+struct PairsData {
+    enum Flag { STM = 1, MAPPED = 2, WIN_PLIES = 4, LOSS_PLIES = 8, WIDE = 16, SINGLE_VALUE = 128 };
+
+    std::uint8_t flags = 0;
+    std::uint8_t pieces[TB_PIECES] = {};        // Piece codes in encoding order (1-6 white, 9-14 black).
+    std::uint8_t groupLen[TB_PIECES + 1] = {};  // Sizes of the groups of like pieces, zero terminated.
+    std::uint64_t groupIdx[TB_PIECES + 1] = {}; // Index multiplier of each group; the last is the table size.
+    std::uint64_t sizeofBlock = 0, span = 0;
+    std::size_t sparseIndexSize = 0, blocksNum = 0, blockLengthSize = 0;
+    int maxSymLen = 0, minSymLen = 0;           // minSymLen holds the value itself for SINGLE_VALUE tables.
+    const std::uint8_t* lowestSym = nullptr;    // 16-bit little-endian lowest symbol of each code length.
+    const std::uint8_t* btree = nullptr;        // 3 bytes per symbol: its left and right halves, 12 bits each.
+    const std::uint8_t* sparseIndex = nullptr;  // 6 bytes per entry: block number and offset in it.
+    const std::uint8_t* blockLength = nullptr;  // 16-bit count of values in each block, minus one.
+    const std::uint8_t* data = nullptr;         // The compressed blocks.
+    std::vector<std::uint64_t> base64;          // Lowest left-aligned code of each code length.
+    std::vector<std::uint8_t> symlen;           // Number of values each symbol expands to, minus one.
+    std::uint16_t mapIdx[4] = {};               // DTZ only: where each result's value map starts.
+};
+
+static std::uint16_t readLE16(const std::uint8_t* p) { return static_cast<std::uint16_t>(p[0] | (p[1] << 8)); }
+static std::uint32_t readLE32(const std::uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+}
+static std::uint32_t readBE32(const std::uint8_t* p) {
+    return (static_cast<std::uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+static std::uint64_t readBE64(const std::uint8_t* p) {
+    return (static_cast<std::uint64_t>(readBE32(p)) << 32) | readBE32(p + 4);
+}
+
+// Index tables shared by every file, computed once.
+struct TablebaseEncoding {
+    int mapA1D1D4[64];          // The a1-d1-d4 triangle to 0-9, diagonal squares last.
+    int mapB1H1H7[64];          // Squares below the a1-h8 diagonal to 0-27.
+    int mapKK[10][64];          // The 462 legal placements of two kings, the first in the triangle.
+    int mapPawns[64];           // a2-h7 to the number of squares left for pawns behind a leading pawn there.
+    std::uint64_t binomial[TB_PIECES][64];
+    std::uint64_t leadPawnIdx[TB_PIECES][64];
+    std::uint64_t leadPawnsSize[TB_PIECES][4];
+
+    TablebaseEncoding();
+
+    // Position of the square relative to the a1-h8 diagonal: negative below it, zero on it.
+    static int offDiagonal(int square) { return square / 8 - square % 8; }
+};
+
+TablebaseEncoding::TablebaseEncoding() {
+    std::memset(this, 0, sizeof(*this));
+
+    int code = 0;
+    for (int square = 0; square < 64; ++square) {
+        if (offDiagonal(square) < 0) mapB1H1H7[square] = code++;
+    }
+
+    code = 0;
+    std::vector<int> diagonal;
+    for (int square = 0; square <= 27; ++square) {
+        if (square % 8 > 3) continue;
+        if (offDiagonal(square) < 0) mapA1D1D4[square] = code++;
+        else if (offDiagonal(square) == 0) diagonal.push_back(square);
+    }
+    for (int square : diagonal) mapA1D1D4[square] = code++;
+
+    // Kings may not touch; with the first king on the diagonal the second may not be above it, and
+    // placements with both kings on the diagonal come last.
+    std::vector<std::pair<int, int>> bothOnDiagonal;
+    code = 0;
+    for (int idx = 0; idx < 10; ++idx) {
+        for (int first = 0; first <= 27; ++first) {
+            if (first % 8 > 3 || offDiagonal(first) > 0 || mapA1D1D4[first] != idx || (!idx && first != 1)) continue;
+            for (int second = 0; second < 64; ++second) {
+                int fileDistance = std::abs(first % 8 - second % 8), rankDistance = std::abs(first / 8 - second / 8);
+                if (std::max(fileDistance, rankDistance) <= 1) continue;
+                if (!offDiagonal(first) && offDiagonal(second) > 0) continue;
+                if (!offDiagonal(first) && !offDiagonal(second)) bothOnDiagonal.emplace_back(idx, second);
+                else mapKK[idx][second] = code++;
+            }
+        }
+    }
+    for (const auto& placement : bothOnDiagonal) mapKK[placement.first][placement.second] = code++;
+
+    binomial[0][0] = 1;
+    for (int n = 1; n < 64; ++n) {
+        for (int k = 0; k < TB_PIECES && k <= n; ++k) {
+            binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) + (k < n ? binomial[k][n - 1] : 0);
+        }
+    }
+
+    // The leading pawn is the one nearest the a or h file, lowest rank first among those; the other
+    // pawns of its group can then only stand on squares further "in", which mapPawns counts.
+    int available = 47;
+    for (int leading = 1; leading < TB_PIECES - 1; ++leading) {
+        for (int file = 0; file < 4; ++file) {
+            std::uint64_t idx = 0;
+            for (int rank = 1; rank <= 6; ++rank) {
+                int square = rank * 8 + file;
+                if (leading == 1) {
+                    mapPawns[square] = available--;
+                    mapPawns[square ^ 7] = available--;
+                }
+                leadPawnIdx[leading][square] = idx;
+                idx += binomial[leading - 1][mapPawns[square]];
+            }
+            leadPawnsSize[leading][file] = idx;
+        }
+    }
+}
+
+static const TablebaseEncoding tablebaseEncoding;
+
+// One mapped tablebase file and the decoding parameters read from its header.
+struct TablebaseFile {
+    MappedFile file;
+    bool dtz = false;
+    bool hasPawns = false;
+    bool symmetric = false;      // Same material on both sides, e.g. KRvKR.
+    bool uniquePieces = false;   // Some side has exactly one piece of a type besides its king.
+    int pieceCount = 0;
+    int pawnCount[2] = { 0, 0 }; // Pawns of the leading color, then of the other.
+    PairsData items[2][4];       // By side to move (only [0] for DTZ and symmetric tables) and pawn file.
+    const std::uint8_t* map = nullptr;   // DTZ value maps.
+
+    // Maps the file named after 'material' (e.g. "KQvKR") and reads its header.
+    bool load(const std::string& path, const std::string& material, bool distanceToZero);
+
+    PairsData& get(int stm, int file) { return items[dtz || symmetric ? 0 : stm][hasPawns ? file : 0]; }
+
+private:
+    void setGroups(PairsData& d, const int order[2], int file);
+    const std::uint8_t* setSizes(PairsData& d, const std::uint8_t* data);
+    std::uint8_t setSymbolLength(PairsData& d, int symbol, std::vector<bool>& visited);
+};
+
+bool TablebaseFile::load(const std::string& path, const std::string& material, bool distanceToZero) {
+    static const std::uint8_t WDL_MAGIC[4] = { 0x71, 0xE8, 0x23, 0x5D };
+    static const std::uint8_t DTZ_MAGIC[4] = { 0xD7, 0x66, 0x0C, 0xA5 };
+
+    dtz = distanceToZero;
+    std::size_t split = material.find('v');
+    std::string white = material.substr(0, split), black = material.substr(split + 1);
+    pieceCount = static_cast<int>(white.size() + black.size());
+    symmetric = white == black;
+    hasPawns = material.find('P') != std::string::npos;
+    for (const std::string* side : { &white, &black }) {
+        for (char type : std::string("QRBNP")) {
+            if (std::count(side->begin(), side->end(), type) == 1) uniquePieces = true;
+        }
+    }
+    // The color with fewer pawns leads, because that compresses better; White when they are equal.
+    int whitePawns = static_cast<int>(std::count(white.begin(), white.end(), 'P'));
+    int blackPawns = static_cast<int>(std::count(black.begin(), black.end(), 'P'));
+    bool whiteLeads = !blackPawns || (whitePawns && blackPawns >= whitePawns);
+    pawnCount[0] = whiteLeads ? whitePawns : blackPawns;
+    pawnCount[1] = whiteLeads ? blackPawns : whitePawns;
+    if (pieceCount > TB_PIECES) return false;
+
+    if (!file.open(path.c_str(), false)) return false;
+    std::string_view bytes = file.view();
+    const std::uint8_t* begin = reinterpret_cast<const std::uint8_t*>(bytes.data());
+    if (bytes.size() < 16 || std::memcmp(begin, dtz ? DTZ_MAGIC : WDL_MAGIC, 4) != 0) return false;
+
+    const std::uint8_t* data = begin + 4;
+    if (bool(*data & 2) != hasPawns) return false;
+    // Flag bit 1 says whether the table has pawns; it must agree with the file name.
+    ++data;
+
+    const int sides = !dtz && !symmetric ? 2 : 1;
+    const int maxFile = hasPawns ? 3 : 0;
+    const bool bothHavePawns = hasPawns && pawnCount[1];
+    for (int f = 0; f <= maxFile; ++f) {
+        int order[2][2] = { { *data & 0xF, bothHavePawns ? data[1] & 0xF : 0xF },
+                            { *data >> 4, bothHavePawns ? data[1] >> 4 : 0xF } };
+        data += 1 + bothHavePawns;
+        for (int k = 0; k < pieceCount; ++k, ++data) {
+            for (int i = 0; i < sides; ++i) items[i][f].pieces[k] = static_cast<std::uint8_t>(i ? *data >> 4 : *data & 0xF);
+        }
+        for (int i = 0; i < sides; ++i) setGroups(items[i][f], order[i], f);
+    }
+    data += reinterpret_cast<std::uintptr_t>(data) & 1;
+
+    for (int f = 0; f <= maxFile; ++f) {
+        for (int i = 0; i < sides; ++i) data = setSizes(items[i][f], data);
+    }
+
+    if (dtz) {
+        // Each result (win, loss and their fifty-move variants) can have its own value map.
+        map = data;
+        for (int f = 0; f <= maxFile; ++f) {
+            PairsData& d = items[0][f];
+            if (!(d.flags & PairsData::MAPPED)) continue;
+            if (d.flags & PairsData::WIDE) {
+                data += reinterpret_cast<std::uintptr_t>(data) & 1;
+                for (int i = 0; i < 4; ++i) {
+                    d.mapIdx[i] = static_cast<std::uint16_t>((data - map) / 2 + 1);
+                    data += 2 + 2 * readLE16(data);
+                }
+            } else {
+                for (int i = 0; i < 4; ++i) {
+                    d.mapIdx[i] = static_cast<std::uint16_t>(data - map + 1);
+                    data += 1 + *data;
+                }
+            }
+        }
+        data += reinterpret_cast<std::uintptr_t>(data) & 1;
+    }
+
+    for (int f = 0; f <= maxFile; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            items[i][f].sparseIndex = data;
+            data += items[i][f].sparseIndexSize * 6;
+        }
+    }
+    for (int f = 0; f <= maxFile; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            items[i][f].blockLength = data;
+            data += items[i][f].blockLengthSize * 2;
+        }
+    }
+    for (int f = 0; f <= maxFile; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            data = begin + ((data - begin + 0x3F) & ~static_cast<std::ptrdiff_t>(0x3F));
+            // Blocks start on a 64-byte boundary.
+            items[i][f].data = data;
+            data += items[i][f].blocksNum * items[i][f].sizeofBlock;
+        }
+    }
+    return data <= begin + bytes.size();
+    // A truncated file would leave blocks outside the mapping.
+}
+
+// Splits the pieces into groups encoded together: the leading group (the two kings, three unique
+// pieces, or the leading pawns) and then each run of identical pieces. 'order' gives the position of
+// the leading group and of the other side's pawns in the encoding.
+void TablebaseFile::setGroups(PairsData& d, const int order[2], int file) {
+    const TablebaseEncoding& enc = tablebaseEncoding;
+    int n = 0, firstLen = hasPawns ? 0 : uniquePieces ? 3 : 2;
+    d.groupLen[n] = 1;
+    for (int i = 1; i < pieceCount; ++i) {
+        if (--firstLen > 0 || d.pieces[i] == d.pieces[i - 1]) d.groupLen[n]++;
+        else d.groupLen[++n] = 1;
+    }
+    d.groupLen[++n] = 0;
+
+    const bool bothHavePawns = hasPawns && pawnCount[1];
+    int next = bothHavePawns ? 2 : 1;
+    int freeSquares = 64 - d.groupLen[0] - (bothHavePawns ? d.groupLen[1] : 0);
+    std::uint64_t idx = 1;
+    for (int k = 0; next < n || k == order[0] || k == order[1]; ++k) {
+        if (k == order[0]) {
+            d.groupIdx[0] = idx;
+            idx *= hasPawns ? enc.leadPawnsSize[d.groupLen[0]][file] : uniquePieces ? 31332 : 462;
+        } else if (k == order[1]) {
+            d.groupIdx[1] = idx;
+            idx *= enc.binomial[d.groupLen[1]][48 - d.groupLen[0]];
+        } else {
+            d.groupIdx[next] = idx;
+            idx *= enc.binomial[d.groupLen[next]][freeSquares];
+            freeSquares -= d.groupLen[next++];
+        }
+    }
+    d.groupIdx[n] = idx;
+}
+
+// Reads one sub-table's block sizes and Huffman code description.
+const std::uint8_t* TablebaseFile::setSizes(PairsData& d, const std::uint8_t* data) {
+    d.flags = *data++;
+    if (d.flags & PairsData::SINGLE_VALUE) {
+        d.minSymLen = *data++;
+        return data;
+    }
+
+    std::uint64_t tableSize = d.groupIdx[std::find(d.groupLen, d.groupLen + TB_PIECES, 0) - d.groupLen];
+    d.sizeofBlock = 1ULL << *data++;
+    d.span = 1ULL << *data++;
+    d.sparseIndexSize = static_cast<std::size_t>((tableSize + d.span - 1) / d.span);
+    int padding = *data++;
+    d.blocksNum = readLE32(data);
+    data += 4;
+    d.blockLengthSize = d.blocksNum + padding;
+    d.maxSymLen = *data++;
+    d.minSymLen = *data++;
+    d.lowestSym = data;
+
+    // Longer codes have lower values, so base64[i] >= base64[i + 1]; left-aligning them lets a
+    // symbol's length be found by comparing the next 64 bits of the stream against each in turn.
+    d.base64.assign(d.maxSymLen - d.minSymLen + 1, 0);
+    for (int i = static_cast<int>(d.base64.size()) - 2; i >= 0; --i) {
+        d.base64[i] = (d.base64[i + 1] + readLE16(d.lowestSym + 2 * i) - readLE16(d.lowestSym + 2 * (i + 1))) / 2;
+    }
+    for (std::size_t i = 0; i < d.base64.size(); ++i) d.base64[i] <<= 64 - i - d.minSymLen;
+    data += d.base64.size() * 2;
+
+    d.symlen.assign(readLE16(data), 0);
+    data += 2;
+    d.btree = data;
+    std::vector<bool> visited(d.symlen.size());
+    for (std::size_t symbol = 0; symbol < d.symlen.size(); ++symbol) {
+        if (!visited[symbol]) d.symlen[symbol] = setSymbolLength(d, static_cast<int>(symbol), visited);
+    }
+    return data + d.symlen.size() * 3 + (d.symlen.size() & 1);
+}
+
+static int treeLeft(const std::uint8_t* btree, int symbol) {
+    const std::uint8_t* lr = btree + 3 * symbol;
+    return ((lr[1] & 0xF) << 8) | lr[0];
+}
+static int treeRight(const std::uint8_t* btree, int symbol) {
+    const std::uint8_t* lr = btree + 3 * symbol;
+    return (lr[2] << 4) | (lr[1] >> 4);
+}
+
+std::uint8_t TablebaseFile::setSymbolLength(PairsData& d, int symbol, std::vector<bool>& visited) {
+    visited[symbol] = true;
+    int right = treeRight(d.btree, symbol);
+    if (right == 0xFFF) return 0;
+    // A leaf: the symbol stands for a single value.
+    int left = treeLeft(d.btree, symbol);
+    if (!visited[left]) d.symlen[left] = setSymbolLength(d, left, visited);
+    if (!visited[right]) d.symlen[right] = setSymbolLength(d, right, visited);
+    return static_cast<std::uint8_t>(d.symlen[left] + d.symlen[right] + 1);
+}
+
+// Returns the stored value at 'idx'.
+static int decompressPairs(const PairsData& d, std::uint64_t idx) {
+    if (d.flags & PairsData::SINGLE_VALUE) return d.minSymLen;
+
+    // The sparse index gives the block and offset of every span-th value; from the nearest one, step
+    // over whole blocks until the one holding 'idx'.
+    std::uint32_t k = static_cast<std::uint32_t>(idx / d.span);
+    std::uint32_t block = readLE32(d.sparseIndex + 6 * k);
+    int offset = readLE16(d.sparseIndex + 6 * k + 4);
+    offset += static_cast<int>(idx % d.span) - static_cast<int>(d.span / 2);
+    while (offset < 0) offset += readLE16(d.blockLength + 2 * --block) + 1;
+    while (offset > readLE16(d.blockLength + 2 * block)) offset -= readLE16(d.blockLength + 2 * block++) + 1;
+
+    // Read symbols from the start of the block until the one whose run covers the offset.
+    const std::uint8_t* ptr = d.data + static_cast<std::uint64_t>(block) * d.sizeofBlock;
+    std::uint64_t buffer = readBE64(ptr);
+    ptr += 8;
+    int bufferBits = 64;
+    int symbol;
+    while (true) {
+        int len = 0;
+        while (buffer < d.base64[len]) ++len;
+        symbol = static_cast<int>((buffer - d.base64[len]) >> (64 - len - d.minSymLen));
+        symbol += readLE16(d.lowestSym + 2 * len);
+        if (offset < d.symlen[symbol] + 1) break;
+        offset -= d.symlen[symbol] + 1;
+        len += d.minSymLen;
+        buffer <<= len;
+        bufferBits -= len;
+        if (bufferBits <= 32) {
+            bufferBits += 32;
+            buffer |= static_cast<std::uint64_t>(readBE32(ptr)) << (64 - bufferBits);
+            ptr += 4;
+        }
+    }
+
+    // Expand the symbol's pairs down to the single value at the offset.
+    while (d.symlen[symbol]) {
+        int left = treeLeft(d.btree, symbol);
+        if (offset < d.symlen[left] + 1) {
+            symbol = left;
+        } else {
+            offset -= d.symlen[left] + 1;
+            symbol = treeRight(d.btree, symbol);
+        }
+    }
+    return treeLeft(d.btree, symbol);
+}
+
+// The set of tablebase files on disk and the cache of mapped ones.
+class Tablebases {
+private:
+    std::unordered_map<std::string, std::string> wdlPaths, dtzPaths;
+    // Material name ("KQvKR") to file path, found once by init() and read-only afterwards.
+    int largest;
+
+    std::mutex cacheLock;
+    std::list<std::pair<std::string, std::shared_ptr<TablebaseFile>>> recent;
+    std::unordered_map<std::string, decltype(recent)::iterator> cached;
+    // Mapped files, most recently used first; 'cached' finds a file's place in 'recent'.
+    std::size_t cacheLimit;
+    bool inPlay;    // Whether play consults the tables; see setPlay().
+
+    std::shared_ptr<TablebaseFile> table(const BoardState& state, bool dtz, bool& blackStronger);
+    int probeTable(const BoardState& state, bool dtz, int wdl, ProbeState& result);
+    int search(Board& board, bool checkZeroingMoves, ProbeState& result);
+
+public:
+    Tablebases() : largest(0), cacheLimit(64), inPlay(false) {}
+
+    // Scans a list of directories separated by ':' for .rtbw and .rtbz files, replacing any earlier
+    // set. Returns the number of WDL tables found.
+    std::size_t init(const std::string& paths);
+
+    // Most pieces, kings included, of any table found; 0 when there are none.
+    int maxPieces() const { return largest; }
+
+    // Limits how many files are kept mapped at once.
+    void setCacheLimit(std::size_t files);
+
+    // Lets the search, the root move choice and adjudication use the tables. Off by default.
+    void setPlay(bool on) { inPlay = on; }
+    bool usedInPlay() const { return inPlay && largest > 0; }
+
+    // True if the position could be in the tables: few enough pieces and no castling rights.
+    bool covers(const BoardState& state) const;
+
+    // Win/draw/loss (TB_LOSS to TB_WIN) for the side to move. False if no table has the position.
+    bool probeWDL(Board& board, int& wdl);
+
+    // Plies to the next capture or pawn move on the way to the result: positive when winning,
+    // negative when losing, zero for a draw, 100 more for cursed wins and blessed losses.
+    bool probeDTZ(Board& board, int& dtz);
+
+    // Picks the move that keeps the best result and makes the fastest progress toward it, and
+    // returns that result as 'wdl'. False if the position is not in the tables.
+    bool probeRoot(Board& board, Move& best, int& wdl);
+};
+
+std::size_t Tablebases::init(const std::string& paths) {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    wdlPaths.clear();
+    dtzPaths.clear();
+    recent.clear();
+    cached.clear();
+    largest = 0;
+
+    std::string_view rest(paths);
+    while (!rest.empty()) {
+        std::size_t colon = rest.find(':');
+        std::string directory(rest.substr(0, colon));
+        rest = colon == std::string_view::npos ? std::string_view() : rest.substr(colon + 1);
+        DIR* dir = directory.empty() ? nullptr : ::opendir(directory.c_str());
+        if (!dir) continue;
+        while (dirent* entry = ::readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() < 8 || name[0] != 'K' || name.find('v') == std::string::npos) continue;
+            std::string material = name.substr(0, name.size() - 5), suffix = name.substr(name.size() - 5);
+            if (suffix == ".rtbw") {
+                wdlPaths[material] = directory + "/" + name;
+                largest = std::max(largest, static_cast<int>(material.size()) - 1);
+            } else if (suffix == ".rtbz") {
+                dtzPaths[material] = directory + "/" + name;
+            }
+        }
+        ::closedir(dir);
+    }
+    return wdlPaths.size();
+}
+
+void Tablebases::setCacheLimit(std::size_t files) {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    cacheLimit = std::max<std::size_t>(files, 1);
+    while (recent.size() > cacheLimit) {
+        cached.erase(recent.back().first);
+        recent.pop_back();
+    }
+}
+
+bool Tablebases::covers(const BoardState& state) const {
+    return largest && state.castlingRights == 0 && popCount(state.occupancy()) <= largest;
+}
+
+// Returns the table for the position's material, mapping it if needed. 'blackStronger' is set when
+// the file is named from Black's side (KRvK for a position where Black has the rook).
+std::shared_ptr<TablebaseFile> Tablebases::table(const BoardState& state, bool dtz, bool& blackStronger) {
+    std::string sides[2];
+    for (int c = 0; c < 2; ++c) {
+        for (PieceType type : { PieceType::KING, PieceType::QUEEN, PieceType::ROOK, PieceType::BISHOP,
+                                PieceType::KNIGHT, PieceType::PAWN }) {
+            sides[c].append(popCount(state.piecesOf(c ? Color::BLACK : Color::WHITE, type)), "PNBRQK"[static_cast<int>(type)]);
+        }
+    }
+    const auto& paths = dtz ? dtzPaths : wdlPaths;
+    std::string material = sides[0] + "v" + sides[1];
+    blackStronger = false;
+    auto path = paths.find(material);
+    if (path == paths.end()) {
+        material = sides[1] + "v" + sides[0];
+        blackStronger = true;
+        path = paths.find(material);
+        if (path == paths.end()) return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+    std::string key = material + (dtz ? ".rtbz" : ".rtbw");
+    auto found = cached.find(key);
+    if (found != cached.end()) {
+        recent.splice(recent.begin(), recent, found->second);
+        return recent.front().second;
+    }
+
+    auto file = std::make_shared<TablebaseFile>();
+    if (!file->load(path->second, material, dtz)) return nullptr;
+    recent.emplace_front(key, file);
+    cached[key] = recent.begin();
+    if (recent.size() > cacheLimit) {
+        // The evicted file stays mapped until any probe still holding it finishes.
+        cached.erase(recent.back().first);
+        recent.pop_back();
+    }
+    return file;
+}
+
+// Looks the position up in its WDL or DTZ table, without resolving captures first.
+int Tablebases::probeTable(const BoardState& state, bool dtz, int wdl, ProbeState& result) {
+    // Bare kings have no table file: the position is a draw, zero plies from anything.
+    if (popCount(state.occupancy()) == 2) {
+        result = PROBE_OK;
+        return TB_DRAW;
+    }
+    const TablebaseEncoding& enc = tablebaseEncoding;
+    bool blackStronger;
+    std::shared_ptr<TablebaseFile> entry = table(state, dtz, blackStronger);
+    if (!entry) {
+        result = PROBE_FAIL;
+        return 0;
+    }
+
+    // Tables are built with the stronger side as White, and symmetric tables for White to move only;
+    // other positions are looked up with the colors swapped and the board flipped.
+    const bool flip = (entry->symmetric && state.turn == Color::BLACK) || blackStronger;
+    const int flipColor = flip ? 8 : 0, flipSquares = flip ? 56 : 0;
+    const int stm = flip ^ (state.turn == Color::BLACK);
+
+    int squares[TB_PIECES], pieces[TB_PIECES];
+    int size = 0, leadPawnsCount = 0, tbFile = 0;
+    Bitboard leadPawns = 0;
+    auto pawnsCompare = [&enc](int a, int b) { return enc.mapPawns[a] < enc.mapPawns[b]; };
+    if (entry->hasPawns) {
+        // The tables are split by the file of the leading pawn, which belongs to the color whose
+        // pawns come first in the encoding.
+        int pawn = entry->get(0, 0).pieces[0] ^ flipColor;
+        Bitboard b = leadPawns = state.piecesOf(pawn & 8 ? Color::BLACK : Color::WHITE, PieceType::PAWN);
+        while (b) squares[size++] = popLsb(b) ^ flipSquares;
+        leadPawnsCount = size;
+        std::swap(squares[0], *std::max_element(squares, squares + leadPawnsCount, pawnsCompare));
+        tbFile = std::min(squares[0] % 8, 7 - squares[0] % 8);
+    }
+
+    // DTZ tables hold one side to move only; the caller searches one ply for the other.
+    if (dtz && (entry->get(stm, tbFile).flags & PairsData::STM) != stm && !(entry->symmetric && !entry->hasPawns)) {
+        result = PROBE_CHANGE_STM;
+        return 0;
+    }
+
+    Bitboard b = state.occupancy() ^ leadPawns;
+    while (b) {
+        int square = popLsb(b);
+        squares[size] = square ^ flipSquares;
+        pieces[size++] = (static_cast<int>(state.mailbox[square]) + 1) ^ flipColor;
+        // The tables number pieces from 1: white pawn 1 to king 6, black pawn 9 to king 14.
+    }
+
+    // Put the pieces in the table's order, then mirror so the leading piece is on files a-d.
+    const PairsData& d = entry->get(stm, tbFile);
+    for (int i = leadPawnsCount; i < size - 1; ++i) {
+        for (int j = i + 1; j < size; ++j) {
+            if (d.pieces[i] == pieces[j]) {
+                std::swap(pieces[i], pieces[j]);
+                std::swap(squares[i], squares[j]);
+                break;
+            }
+        }
+    }
+    if (squares[0] % 8 > 3) {
+        for (int i = 0; i < size; ++i) squares[i] ^= 7;
+    }
+
+    std::uint64_t idx;
+    if (entry->hasPawns) {
+        idx = enc.leadPawnIdx[leadPawnsCount][squares[0]];
+        std::stable_sort(squares + 1, squares + leadPawnsCount, pawnsCompare);
+        for (int i = 1; i < leadPawnsCount; ++i) idx += enc.binomial[i][enc.mapPawns[squares[i]]];
+    } else {
+        // Without pawns the board can also be flipped top to bottom and along the a1-h8 diagonal, so
+        // the leading piece ends up in the a1-d1-d4 triangle.
+        if (squares[0] / 8 > 3) {
+            for (int i = 0; i < size; ++i) squares[i] ^= 56;
+        }
+        for (int i = 0; i < d.groupLen[0]; ++i) {
+            int off = TablebaseEncoding::offDiagonal(squares[i]);
+            if (!off) continue;
+            if (off > 0) {
+                for (int j = i; j < size; ++j) squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+            }
+            break;
+        }
+
+        if (entry->uniquePieces) {
+            int adjust1 = squares[1] > squares[0];
+            int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+            if (TablebaseEncoding::offDiagonal(squares[0])) {
+                idx = (enc.mapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+            } else if (TablebaseEncoding::offDiagonal(squares[1])) {
+                idx = (6 * 63 + (squares[0] / 8) * 28 + enc.mapB1H1H7[squares[1]]) * 62 + squares[2] - adjust2;
+            } else if (TablebaseEncoding::offDiagonal(squares[2])) {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + (squares[0] / 8) * 7 * 28 + (squares[1] / 8 - adjust1) * 28 +
+                      enc.mapB1H1H7[squares[2]];
+            } else {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + (squares[0] / 8) * 7 * 6 + (squares[1] / 8 - adjust1) * 6 +
+                      (squares[2] / 8 - adjust2);
+            }
+        } else {
+            idx = enc.mapKK[enc.mapA1D1D4[squares[0]]][squares[1]];
+        }
+    }
+
+    // The remaining groups, each a combination of squares in ascending order, skipping the squares
+    // taken by earlier groups.
+    idx *= d.groupIdx[0];
+    int* group = squares + d.groupLen[0];
+    bool remainingPawns = entry->hasPawns && entry->pawnCount[1];
+    for (int next = 1; d.groupLen[next]; ++next) {
+        std::stable_sort(group, group + d.groupLen[next]);
+        std::uint64_t n = 0;
+        for (int i = 0; i < d.groupLen[next]; ++i) {
+            int adjust = static_cast<int>(std::count_if(squares, group, [&](int s) { return group[i] > s; }));
+            n += enc.binomial[i + 1][group[i] - adjust - 8 * remainingPawns];
+        }
+        remainingPawns = false;
+        idx += n * d.groupIdx[next];
+        group += d.groupLen[next];
+    }
+
+    int value = decompressPairs(d, idx);
+    result = PROBE_OK;
+    if (!dtz) return value - 2;
+
+    // DTZ values may go through a per-result map, and are stored in moves unless flagged as plies.
+    static const int WDL_MAP[] = { 1, 3, 0, 2, 0 };
+    const PairsData& mapped = entry->get(0, tbFile);
+    if (mapped.flags & PairsData::MAPPED) {
+        int at = mapped.mapIdx[WDL_MAP[wdl + 2]] + value;
+        value = mapped.flags & PairsData::WIDE ? readLE16(entry->map + 2 * at) : entry->map[at];
+    }
+    if ((wdl == TB_WIN && !(mapped.flags & PairsData::WIN_PLIES)) ||
+        (wdl == TB_LOSS && !(mapped.flags & PairsData::LOSS_PLIES)) || wdl == TB_CURSED_WIN || wdl == TB_BLESSED_LOSS) {
+        value *= 2;
+    }
+    return value + 1;
+}
+
+// WDL of the position with captures (and, for DTZ, pawn moves) tried first: the tables store a
+// "don't care" value where such a move is best, and nothing for en passant.
+int Tablebases::search(Board& board, bool checkZeroingMoves, ProbeState& result) {
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    int bestValue = TB_LOSS, tried = 0;
+    for (Move move : moves) {
+        if (!move.isCapture() && (!checkZeroingMoves || board.getState().pieceTypeAt(move.from()) != PieceType::PAWN)) continue;
+        ++tried;
+        board.makeMove(move);
+        int value = -search(board, false, result);
+        board.unmakeMove();
+        if (result == PROBE_FAIL) return TB_DRAW;
+        if (value > bestValue) {
+            bestValue = value;
+            if (value >= TB_WIN) {
+                result = PROBE_ZEROING_BEST_MOVE;
+                return value;
+            }
+        }
+    }
+
+    // With every legal move already tried there is nothing to look up.
+    const bool noMoreMoves = tried && tried == moves.size();
+    int value = bestValue;
+    if (!noMoreMoves) {
+        value = probeTable(board.getState(), false, TB_DRAW, result);
+        if (result == PROBE_FAIL) return TB_DRAW;
+    }
+    if (bestValue >= value) {
+        result = bestValue > TB_DRAW || noMoreMoves ? PROBE_ZEROING_BEST_MOVE : PROBE_OK;
+        return bestValue;
+    }
+    result = PROBE_OK;
+    return value;
+}
+
+bool Tablebases::probeWDL(Board& board, int& wdl) {
+    if (!covers(board.getState())) return false;
+    ProbeState result = PROBE_OK;
+    wdl = search(board, false, result);
+    return result != PROBE_FAIL;
+}
+
+// DTZ of the move just before a zeroing move with the given result.
+static int dtzBeforeZeroing(int wdl) {
+    return wdl == TB_WIN ? 1 : wdl == TB_CURSED_WIN ? 101 : wdl == TB_BLESSED_LOSS ? -101 : wdl == TB_LOSS ? -1 : 0;
+}
+
+bool Tablebases::probeDTZ(Board& board, int& dtz) {
+    dtz = 0;
+    if (!covers(board.getState())) return false;
+    ProbeState result = PROBE_OK;
+    int wdl = search(board, true, result);
+    if (result == PROBE_FAIL) return false;
+    if (wdl == TB_DRAW) return true;
+    if (result == PROBE_ZEROING_BEST_MOVE) {
+        dtz = dtzBeforeZeroing(wdl);
+        return true;
+    }
+
+    int value = probeTable(board.getState(), true, wdl, result);
+    if (result == PROBE_FAIL) return false;
+    const int sign = wdl > 0 ? 1 : -1;
+    if (result != PROBE_CHANGE_STM) {
+        dtz = (value + 100 * (wdl == TB_BLESSED_LOSS || wdl == TB_CURSED_WIN)) * sign;
+        return true;
+    }
+
+    // The table holds the other side to move: search one ply for the move with the best DTZ.
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    int best = 0xFFFF;
+    for (Move move : moves) {
+        const bool zeroing = move.isCapture() || board.getState().pieceTypeAt(move.from()) == PieceType::PAWN;
+        board.makeMove(move);
+        int after = 0;
+        bool ok;
+        if (zeroing) {
+            ProbeState childResult = PROBE_OK;
+            after = -dtzBeforeZeroing(search(board, false, childResult));
+            ok = childResult != PROBE_FAIL;
+        } else {
+            ok = probeDTZ(board, after);
+            after = -after;
+        }
+        if (ok && after == 1 && board.status() == GameStatus::CHECKMATE) best = 1;
+        board.unmakeMove();
+        if (!ok) return false;
+        if (!zeroing) after += after > 0 ? 1 : after < 0 ? -1 : 0;
+        if (after < best && (after > 0 ? 1 : after < 0 ? -1 : 0) == sign) best = after;
+    }
+    dtz = best == 0xFFFF ? -1 : best;
+    // No legal moves: the side to move is mated.
+    return true;
+}
+
+bool Tablebases::probeRoot(Board& board, Move& best, int& wdl) {
+    if (!covers(board.getState())) return false;
+    const int clock = board.getState().halfmoveClock;
+
+    // Rank every move by the root DTZ it leads to. Wins the fifty-move rule cannot spoil rank first,
+    // the quickest conversion ahead; losses rank last, the longest resistance ahead.
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    int bestRank = -1000000;
+    for (Move move : moves) {
+        const bool zeroing = move.isCapture() || board.getState().pieceTypeAt(move.from()) == PieceType::PAWN;
+        board.makeMove(move);
+        int dtz = 0;
+        bool ok = true, mates = board.status() == GameStatus::CHECKMATE;
+        if (mates) {
+            dtz = 1;
+        } else if (zeroing) {
+            ProbeState result = PROBE_OK;
+            dtz = -dtzBeforeZeroing(search(board, false, result));
+            ok = result != PROBE_FAIL;
+        } else {
+            ok = probeDTZ(board, dtz);
+            dtz = -dtz;
+            dtz += dtz > 0 ? 1 : dtz < 0 ? -1 : 0;
+        }
+        board.unmakeMove();
+        if (!ok) return false;
+
+        const int reach = std::abs(dtz) + (zeroing ? 0 : clock);
+        int rank = 0, result = TB_DRAW;
+        if (dtz > 0) {
+            result = reach <= 100 ? TB_WIN : TB_CURSED_WIN;
+            rank = (reach <= 100 ? 3000 : 1000) - dtz + (mates ? 1 : 0);
+        } else if (dtz < 0) {
+            result = reach <= 100 ? TB_LOSS : TB_BLESSED_LOSS;
+            rank = (reach <= 100 ? -3000 : -1000) - dtz;
+        }
+        if (rank > bestRank) {
+            bestRank = rank;
+            best = move;
+            wdl = result;
+        }
+    }
+    return !moves.empty();
+}
+
+Tablebases tablebases;
+// The engine's tablebases; empty until init() is given a path.
+
+GameStatus Board::adjudicate() {
+    GameStatus current = status();
+    if (current == GameStatus::CHECKMATE || current == GameStatus::STALEMATE || current == GameStatus::DRAW) return current;
+    int wdl;
+    if (!tablebases.usedInPlay() || !tablebases.covers(state) || !tablebases.probeWDL(*this, wdl)) return current;
+    // Cursed wins and blessed losses are draws under the fifty-move rule.
+    return wdl == TB_WIN ? GameStatus::TABLEBASE_WIN : wdl == TB_LOSS ? GameStatus::TABLEBASE_LOSS : GameStatus::TABLEBASE_DRAW;
+}
+
+// Handles "syzygy <DIRS> <FEN>": prints the WDL and DTZ values of the position and the move the root
+// probe picks, so that the decoder can be checked against known values of the published tables.
+int runSyzygy(int argc, char* argv[]) {
+    Board board;
+    std::string fen;
+    for (int i = 3; i < argc; ++i) fen += (fen.empty() ? "" : " ") + std::string(argv[i]);
+    if (argc < 4 || !board.fromFEN(fen)) {
+        std::cerr << "Usage: " << argv[0] << " syzygy <DIRS> <FEN>\n";
+        return 1;
+    }
+    if (tablebases.init(argv[2]) == 0) {
+        std::cerr << "No tablebases found in " << argv[2] << ".\n";
+        return 1;
+    }
+
+    static const char* const WDL_NAMES[5] = { "loss", "blessed loss", "draw", "cursed win", "win" };
+    int wdl, dtz;
+    Move best;
+    if (!tablebases.probeWDL(board, wdl)) {
+        std::cout << "wdl: not in the tables\n";
+        return 1;
+    }
+    std::cout << "wdl: " << wdl << " (" << WDL_NAMES[wdl - TB_LOSS] << ")\n";
+    if (tablebases.probeDTZ(board, dtz)) std::cout << "dtz: " << dtz << "\n";
+    else std::cout << "dtz: not in the tables\n";
+    if (tablebases.probeRoot(board, best, wdl)) std::cout << "best: " << best.toString() << "\n";
+    return 0;
+}
+
+// Polyglot opening books. A .bin book is a sorted array of 16-byte big-endian entries: the position
+// key, a move, a weight and four bytes of learning data, with every book move of a position in
+// adjacent entries. A lookup is one binary search in the mapped file.
+//
+// Polyglot keys are Zobrist keys built from its own fixed table of 781 random numbers (768 for the
+// pieces, 4 for castling rights, 8 for the en passant file and 1 for White to move), not from this
+// program's keys. That table is not reproduced here: loadKeys() reads it from a file, either as 6248
+// bytes of big-endian numbers or as text holding the 781 hexadecimal constants (the array from the
+// Polyglot sources can be used as it is). The file is checked against the key every Polyglot book
+// uses for the starting position, so a wrong or garbled table is refused rather than silently
+// finding nothing.
+const std::uint64_t POLYGLOT_START_KEY = 0x463B96181691FC9CULL;
+// Polyglot key of the standard starting position.
+const int POLYGLOT_KEY_COUNT = 781;
+
+// One book move with its relative weight among the position's book moves.
+struct BookMove {
+    Move move;
+    int weight;
+};
+
+class OpeningBook {
+private:
+    std::uint64_t keys[POLYGLOT_KEY_COUNT];
+    bool haveKeys;
+    MappedFile file;
+    std::atomic<std::uint64_t> seed;    // For the weighted choice; advanced by every pick.
+
+public:
+    OpeningBook() : haveKeys(false), seed(0x9E3779B97F4A7C15ULL) {}
+
+    // Reads the Polyglot random table. False if the file is missing, malformed or gives the wrong
+    // key for the starting position.
+    bool loadKeys(const char* path);
+
+    // Maps a book file. False if it cannot be mapped or is not a whole number of entries.
+    bool open(const char* path);
+    void close() { file.close(); }
+
+    // True once both the key table and a book are loaded.
+    bool ready() const { return haveKeys && !file.view().empty(); }
+
+    // The Polyglot key of a position. Requires loadKeys().
+    std::uint64_t key(const BoardState& state) const;
+
+    // Fills 'moves' with the legal book moves for the position; returns how many there are.
+    int lookup(const Board& board, std::vector<BookMove>& moves) const;
+
+    // Picks one of the position's book moves at random, in proportion to the weights. Returns
+    // Move::none() when the position is not in the book. Safe to call from several threads.
+    Move pick(const Board& board);
+};
+
+bool OpeningBook::loadKeys(const char* path) {
+    haveKeys = false;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    int count = 0;
+    if (text.size() == POLYGLOT_KEY_COUNT * 8) {
+        for (; count < POLYGLOT_KEY_COUNT; ++count) {
+            keys[count] = readBE64(reinterpret_cast<const std::uint8_t*>(text.data()) + 8 * count);
+        }
+    } else {
+        // Text: every "0x" followed by hex digits is the next constant.
+        for (std::size_t at = text.find("0x"); at != std::string::npos && count < POLYGLOT_KEY_COUNT;
+             at = text.find("0x", at + 2)) {
+            std::uint64_t value;
+            auto parsed = std::from_chars(text.data() + at + 2, text.data() + text.size(), value, 16);
+            if (parsed.ec != std::errc()) continue;
+            keys[count++] = value;
+        }
+    }
+    if (count != POLYGLOT_KEY_COUNT) return false;
+
+    BoardState start;
+    std::string_view fen = START_FEN;
+    parseFEN(fen, start);
+    haveKeys = true;
+    haveKeys = key(start) == POLYGLOT_START_KEY;
+    return haveKeys;
+}
+
+bool OpeningBook::open(const char* path) {
+    return file.open(path, false) && file.view().size() % 16 == 0 && !file.view().empty();
+}
+
+std::uint64_t OpeningBook::key(const BoardState& state) const {
+    std::uint64_t result = 0;
+    for (int square = 0; square < 64; ++square) {
+        Piece piece = state.mailbox[square];
+        if (piece == NO_PIECE) continue;
+        // Polyglot orders the pieces black pawn, white pawn, black knight, white knight, ...
+        int kind = 2 * static_cast<int>(typeOf(piece)) + (colorOf(piece) == Color::WHITE ? 1 : 0);
+        result ^= keys[64 * kind + square];
+    }
+    if (state.castlingRights & WHITE_KING_SIDE) result ^= keys[768];
+    if (state.castlingRights & WHITE_QUEEN_SIDE) result ^= keys[769];
+    if (state.castlingRights & BLACK_KING_SIDE) result ^= keys[770];
+    if (state.castlingRights & BLACK_QUEEN_SIDE) result ^= keys[771];
+    // The en passant file counts only when a pawn of the side to move stands ready to capture.
+    if (state.enPassantSquare >= 0 &&
+        (pawnAttacks(opponent(state.turn), state.enPassantSquare) & state.piecesOf(state.turn, PieceType::PAWN))) {
+        result ^= keys[772 + state.enPassantSquare % 8];
+    }
+    if (state.turn == Color::WHITE) result ^= keys[780];
+    return result;
+}
+
+int OpeningBook::lookup(const Board& board, std::vector<BookMove>& moves) const {
+    moves.clear();
+    if (!ready()) return 0;
+    const std::uint64_t target = key(board.getState());
+    const std::uint8_t* base = reinterpret_cast<const std::uint8_t*>(file.view().data());
+    auto keyAt = [base](std::size_t i) { return readBE64(base + 16 * i); };
+
+    std::size_t low = 0, high = file.view().size() / 16;
+    while (low < high) {
+        std::size_t middle = low + (high - low) / 2;
+        if (keyAt(middle) < target) low = middle + 1;
+        else high = middle;
+    }
+
+    MoveList legal;
+    board.generateLegalMoves(legal);
+    for (std::size_t i = low; i < file.view().size() / 16 && keyAt(i) == target; ++i) {
+        // Move bits: to file 0-2, to rank 3-5, from file 6-8, from rank 9-11, promotion 12-14.
+        const std::uint8_t* entry = base + 16 * i;
+        int raw = (entry[8] << 8) | entry[9];
+        int weight = (entry[10] << 8) | entry[11];
+        int to = raw & 63, from = (raw >> 6) & 63, promotion = (raw >> 12) & 7;
+        // Castling is written as the king taking its own rook.
+        if (board.getState().pieceTypeAt(from) == PieceType::KING && board.getState().isOccupied(to) &&
+            board.getState().colorAt(to) == board.getState().colorAt(from)) {
+            to = to > from ? from + 2 : from - 2;
+        }
+        for (Move move : legal) {
+            if (move.from() != from || move.to() != to) continue;
+            if (move.isPromotion() != (promotion != 0)) continue;
+            if (promotion && static_cast<int>(move.promotionType()) != promotion) continue;
+            // Polyglot numbers promotions 1-4 for knight to queen, as PieceType does.
+            moves.push_back({ move, weight });
+            break;
+        }
+    }
+    return static_cast<int>(moves.size());
+}
+
+Move OpeningBook::pick(const Board& board) {
+    std::vector<BookMove> moves;
+    if (!lookup(board, moves)) return Move::none();
+    long total = 0;
+    for (const BookMove& candidate : moves) total += candidate.weight;
+    if (total == 0) return moves.front().move;
+    // Every move has weight zero: the book gives no preference, so take the first.
+
+    std::uint64_t z = seed.fetch_add(0x9E3779B97F4A7C15ULL, std::memory_order_relaxed) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    long roll = static_cast<long>((z ^ (z >> 31)) % static_cast<std::uint64_t>(total));
+    for (const BookMove& candidate : moves) {
+        roll -= candidate.weight;
+        if (roll < 0) return candidate.move;
+    }
+    return moves.back().move;
+}
+
+OpeningBook openingBook;
+// The engine's opening book; searches play from it while it has the position.
+
+const int MAX_PLY = 128;
+// Deepest ply the search will reach, including quiescence.
+const int MATE_SCORE = 32000;
+// Score of being checkmated at the root; a mate found n plies away scores MATE_SCORE - n.
+const int MATE_BOUND = MATE_SCORE - MAX_PLY;
+// Scores beyond this magnitude are mate scores.
+const int TB_WIN_SCORE = MATE_BOUND - 1;
+// Score of a tablebase win at the root, less the distance to it; below every mate score, since the
+// tables say the position is won but not how far away the mate is.
+const int INFINITE_SCORE = 32767;
+
+// Limits for one search. A zero value means "no limit"; with no limits at all the search runs
+// to MAX_PLY or until stop() is called.
+struct SearchLimits {
+    int maxDepth = 0;
+    std::uint64_t maxNodes = 0;
+    int moveTimeMs = 0;
+};
+
+// Outcome of a search: the best move found and what the last completed iteration reported.
+struct SearchResult {
+    Move bestMove = Move::none();
+    int score = 0;
+    int depth = 0;
+    std::uint64_t nodes = 0;
+    double seconds = 0;
+    std::vector<Move> pv;        // Principal variation, starting with bestMove.
+    std::vector<std::uint64_t> threadNodes;   // Nodes searched by each thread; nodes is their sum.
+};
+
+// Single-threaded alpha-beta search over a Board.
+//
+// run() does iterative deepening: depth 1, 2, 3, ... until a limit is reached, each iteration
+// seeded by the previous one through the transposition table. Each node is a fail-soft negamax
+// alpha-beta search, and leaves are resolved by a captures-only quiescence search so the
+// evaluation is never taken in the middle of an exchange. Moves are ordered hash move first, then
+// captures by MVV-LVA (most valuable victim, least valuable attacker), then the two killer moves of
+// the ply, then quiet moves by history score.
+//
+// Time and node limits are checked every 1024 nodes, from the first iteration on. The search can stop
+// at any point and returns the best move of the last finished iteration; when not even the first one
+// finished, the best root move it had scored, or the first legal move if none was. The response time
+// is therefore bounded by the move time plus a few microseconds, however slow the evaluation.
+class Search {
+private:
+    TranspositionTable& table;
+    TTStats ttStats;
+    std::atomic<bool> stopRequested;
+    const std::atomic<bool>* sharedStop;     // Stop signal of the thread group this search belongs to.
+    const std::atomic<std::int64_t>* sharedDeadline;   // Group deadline in steady_clock ticks, 0 for none.
+    bool stopped;                            // Set once a limit is hit; unwinds the current iteration.
+    int depthOffset;                         // Helper threads start deeper to spread the work.
+    bool useNetwork;                         // Evaluate with the loaded network, if any, rather than Evaluator.
+    std::function<void(const SearchResult&)> onIteration;
+    SearchLimits limits;
+    std::chrono::steady_clock::time_point startTime;
+    std::uint64_t nodes;
+    int rootDepth;
+    Move rootBest;                           // Best root move scored so far, Move::none() before the first.
+    int rootBestScore;
+
+    Move killers[MAX_PLY][2];                // Quiet moves that caused a beta cutoff at each ply.
+    int history[2][64][64];                  // Cutoff counts for quiet moves by side, from and to.
+    Move pvTable[MAX_PLY][MAX_PLY];          // Triangular principal variation table.
+    int pvLength[MAX_PLY];
+
+    void checkLimits();
+    int evaluate(const Board& board) const;
+    void scoreMoves(const Board& board, const MoveList& moves, int scores[], Move hashMove, int ply) const;
+    static Move pickNext(MoveList& moves, int scores[], int index);
+    int negamax(Board& board, int depth, int alpha, int beta, int ply);
+    int quiescence(Board& board, int alpha, int beta, int ply);
+
+public:
+    explicit Search(TranspositionTable& sharedTable);
+
+    // Searches the board's position for its side to move. The board is returned unchanged.
+    SearchResult run(Board& board, const SearchLimits& searchLimits);
+
+    // Asks a running search to finish as soon as possible. Safe to call from another thread.
+    void stop() { stopRequested.store(true, std::memory_order_relaxed); }
+
+    // Makes the search also stop when 'flag' becomes true. Unlike stop(), the flag is not reset by run(),
+    // so a group of threads can be stopped together even if one of them has not started yet.
+    void setSharedStop(const std::atomic<bool>* flag) { sharedStop = flag; }
+
+    // Makes the search also stop once the steady clock passes the time in 'deadline', which can be
+    // set while the search runs (0 means no deadline). Used when pondering turns into a timed search.
+    void setSharedDeadline(const std::atomic<std::int64_t>* deadline) { sharedDeadline = deadline; }
+
+    // Starts iterative deepening at depth 1 + offset instead of depth 1.
+    void setDepthOffset(int offset) { depthOffset = offset; }
+
+    // Chooses between the loaded network and Evaluator; a match can pit one against the other.
+    void setUseNetwork(bool use) { useNetwork = use; }
+
+    // Called with the partial result after every completed iteration, on the searching thread.
+    void setIterationCallback(std::function<void(const SearchResult&)> callback) { onIteration = std::move(callback); }
+
+    const TTStats& tableStats() const { return ttStats; }
+};
+
+// Converts a mate score between "plies from the root" (used in the search) and "plies from this
+// node" (stored in the table), so a stored mate stays correct wherever the position recurs.
+static int scoreToTable(int score, int ply) {
+    return score >= MATE_BOUND ? score + ply : score <= -MATE_BOUND ? score - ply : score;
+}
+
+static int scoreFromTable(int score, int ply) {
+    return score >= MATE_BOUND ? score - ply : score <= -MATE_BOUND ? score + ply : score;
+}
+
+Search::Search(TranspositionTable& sharedTable)
+    : table(sharedTable), stopRequested(false), sharedStop(nullptr), sharedDeadline(nullptr), stopped(false), depthOffset(0),
+      useNetwork(true), nodes(0), rootDepth(0), rootBest(Move::none()), rootBestScore(0) {}
+
+void Search::checkLimits() {
+    if (stopRequested.load(std::memory_order_relaxed) ||
+        (sharedStop && sharedStop->load(std::memory_order_relaxed))) {
+        stopped = true;
+        return;
+    }
+    if (limits.maxNodes && nodes >= limits.maxNodes) stopped = true;
+    if (limits.moveTimeMs) {
+        auto elapsed = std::chrono::steady_clock::now() - startTime;
+        if (elapsed >= std::chrono::milliseconds(limits.moveTimeMs)) stopped = true;
+    }
+    if (sharedDeadline) {
+        std::int64_t deadline = sharedDeadline->load(std::memory_order_relaxed);
+        if (deadline && std::chrono::steady_clock::now().time_since_epoch().count() >= deadline) stopped = true;
+    }
+}
+
+int Search::evaluate(const Board& board) const {
+    if (useNetwork && network.loaded()) {
+        // Keep network scores below the tablebase and mate range, whatever the weights.
+        int score = network.evaluate(board.accumulator(), board.getTurn());
+        return std::clamp(score, -TB_WIN_SCORE + MAX_PLY, TB_WIN_SCORE - MAX_PLY);
+    }
+    return Evaluator::evaluate(board.getState());
+}
+
+void Search::scoreMoves(const Board& board, const MoveList& moves, int scores[], Move hashMove, int ply) const {
+    const BoardState& state = board.getState();
+    const int side = colorIndex(state.turn);
+    for (int i = 0; i < moves.size(); ++i) {
+        Move move = moves[i];
+        if (move == hashMove) {
+            scores[i] = 1 << 30;
+        } else if (move.isCapture() || move.isPromotion()) {
+            int victim = move.isEnPassant() ? 0 : static_cast<int>(state.pieceTypeAt(move.to()));
+            int attacker = static_cast<int>(state.pieceTypeAt(move.from()));
+            int victimValue = move.isCapture() ? PIECE_VALUES[victim == static_cast<int>(PieceType::NONE) ? 0 : victim] : 0;
+            int promotionValue = move.isPromotion() ? PIECE_VALUES[static_cast<int>(move.promotionType())] : 0;
+            scores[i] = (1 << 28) + (victimValue + promotionValue) * 16 - PIECE_VALUES[attacker] / 16;
+        } else if (move == killers[ply][0]) {
+            scores[i] = (1 << 27) + 1;
+        } else if (move == killers[ply][1]) {
+            scores[i] = 1 << 27;
+        } else {
+            scores[i] = history[side][move.from()][move.to()];
+        }
+    }
+}
+
+// Selection sort step: moves the best remaining move to 'index' and returns it. Cheaper than a full
+// sort because a cutoff usually comes within the first few moves.
+Move Search::pickNext(MoveList& moves, int scores[], int index) {
+    int best = index;
+    for (int i = index + 1; i < moves.size(); ++i) {
+        if (scores[i] > scores[best]) best = i;
+    }
+    std::swap(moves[index], moves[best]);
+    std::swap(scores[index], scores[best]);
+    return moves[index];
+}
+
+SearchResult Search::run(Board& board, const SearchLimits& searchLimits) {
+    typedef std::chrono::steady_clock Clock;
+    limits = searchLimits;
+    startTime = Clock::now();
+    stopRequested.store(false, std::memory_order_relaxed);
+    stopped = false;
+    nodes = 0;
+    rootBest = Move::none();
+    ttStats = TTStats();
+    // In a thread group the table generation is advanced once by the group, not by every thread.
+    if (!sharedStop) table.newSearch();
+    for (auto& ply : killers) ply[0] = ply[1] = Move::none();
+    for (auto& side : history) for (auto& from : side) for (int& score : from) score = 0;
+
+    SearchResult result;
+    MoveList rootMoves;
+    board.generateLegalMoves(rootMoves);
+    if (rootMoves.empty()) return result;
+    result.bestMove = rootMoves[0];
+
+    int maxDepth = limits.maxDepth > 0 ? std::min(limits.maxDepth, MAX_PLY - 1) : MAX_PLY - 1;
+    for (rootDepth = std::min(1 + depthOffset, maxDepth); rootDepth <= maxDepth; ++rootDepth) {
+        int score = negamax(board, rootDepth, -INFINITE_SCORE, INFINITE_SCORE, 0);
+        if (stopped) break;
+
+        result.depth = rootDepth;
+        result.score = score;
+        result.pv.assign(pvTable[0], pvTable[0] + pvLength[0]);
+        if (!result.pv.empty()) result.bestMove = result.pv[0];
+        if (onIteration) {
+            result.nodes = nodes;
+            result.seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+            onIteration(result);
+        }
+
+        // A found mate cannot improve with more depth.
+        if (std::abs(score) >= MATE_BOUND) break;
+        // Don't start an iteration that almost certainly cannot finish in the remaining time.
+        if (limits.moveTimeMs &&
+            Clock::now() - startTime >= std::chrono::milliseconds(limits.moveTimeMs / 2)) break;
+    }
+    // Stopped inside the first iteration: the best root move it scored beats an unsearched one, which
+    // is what bestMove otherwise still holds.
+    if (result.depth == 0 && !rootBest.isNone()) {
+        result.bestMove = rootBest;
+        result.score = rootBestScore;
+        result.pv.assign(1, rootBest);
+    }
+
+    result.nodes = nodes;
+    result.seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+    result.threadNodes.assign(1, nodes);
+    return result;
+}
+
+int Search::negamax(Board& board, int depth, int alpha, int beta, int ply) {
+    pvLength[ply] = 0;
+    if (depth <= 0) return quiescence(board, alpha, beta, ply);
+
+    INSTRUMENT_COUNT(SEARCH_NODE);
+    if ((++nodes & 1023) == 0) checkLimits();
+    if (stopped) return 0;
+
+    // A position seen before on the way here (or in the game) is scored as a draw: if repeating it
+    // were good, the side that can repeat would do so, and finding the best way out is all that matters.
+    if (ply > 0 && (board.getState().halfmoveClock >= 100 || board.isRepetition(1))) return 0;
+
+    // Inside the tablebases the result is known. Probing only right after a capture or pawn move keeps
+    // probes rare, and is where the table's fifty-move verdict applies from a fresh count.
+    if (ply > 0 && board.getState().halfmoveClock == 0 && tablebases.usedInPlay() &&
+        tablebases.covers(board.getState())) {
+        int wdl;
+        if (tablebases.probeWDL(board, wdl)) {
+            if (wdl == TB_WIN) return TB_WIN_SCORE - ply;
+            if (wdl == TB_LOSS) return -TB_WIN_SCORE + ply;
+            return wdl;
+            // Cursed wins and blessed losses are draws, nudged toward the side that is better.
+        }
+    }
+
+    const std::uint64_t key = board.getHash();
+    const int originalAlpha = alpha;
+    Move hashMove = Move::none();
+    TTData entry;
+    if (table.probe(key, entry, ttStats)) {
+        hashMove = entry.move;
+        int score = scoreFromTable(entry.score, ply);
+        if (ply > 0 && entry.depth >= depth &&
+            (entry.bound == Bound::EXACT ||
+             (entry.bound == Bound::LOWER && score >= beta) ||
+             (entry.bound == Bound::UPPER && score <= alpha))) {
+            return score;
+        }
+    }
+
+    const Color side = board.getTurn();
+    const bool inCheck = board.isInCheck(side);
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    if (moves.empty()) return inCheck ? -MATE_SCORE + ply : 0;
+    if (ply >= MAX_PLY - 1) return evaluate(board);
+
+    // Search one ply deeper when in check, so forcing sequences are not cut off at the horizon.
+    const int extension = inCheck ? 1 : 0;
+    int scores[MAX_MOVES];
+    scoreMoves(board, moves, scores, hashMove, ply);
+
+    int bestScore = -INFINITE_SCORE;
+    Move bestMove = Move::none();
+    for (int i = 0; i < moves.size(); ++i) {
+        Move move = pickNext(moves, scores, i);
+        board.makeMove(move);
+        int score = -negamax(board, depth - 1 + extension, -beta, -alpha, ply + 1);
+        board.unmakeMove();
+        if (stopped) return 0;
+
+        if (score > bestScore) {
+            bestScore = score;
+            bestMove = move;
+            if (ply == 0) {
+                rootBest = move;
+                rootBestScore = score;
+            }
+            if (score > alpha) {
+                alpha = score;
+                pvTable[ply][0] = move;
+                std::copy(pvTable[ply + 1], pvTable[ply + 1] + pvLength[ply + 1], pvTable[ply] + 1);
+                pvLength[ply] = pvLength[ply + 1] + 1;
+            }
+        }
+        if (alpha >= beta) {
+            // Remember quiet refutations for ordering sibling nodes.
+            if (!move.isCapture() && !move.isPromotion()) {
+                if (killers[ply][0] != move) {
+                    killers[ply][1] = killers[ply][0];
+                    killers[ply][0] = move;
+                }
+                history[colorIndex(side)][move.from()][move.to()] += depth * depth;
+            }
+            break;
+        }
+    }
+
+    Bound bound = bestScore >= beta ? Bound::LOWER : bestScore > originalAlpha ? Bound::EXACT : Bound::UPPER;
+    table.store(key, bestMove, scoreToTable(bestScore, ply), depth, bound, ttStats);
+    return bestScore;
+}
+
+int Search::quiescence(Board& board, int alpha, int beta, int ply) {
+    pvLength[ply] = 0;
+    INSTRUMENT_COUNT(QUIESCENCE_NODE);
+    if ((++nodes & 1023) == 0) checkLimits();
+    if (stopped) return 0;
+
+    const bool inCheck = board.isInCheck(board.getTurn());
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    if (moves.empty()) return inCheck ? -MATE_SCORE + ply : 0;
+    if (ply >= MAX_PLY - 1) return evaluate(board);
+
+    // Stand pat: the side to move may decline all captures, unless it is in check and must respond.
+    int bestScore = -INFINITE_SCORE;
+    if (!inCheck) {
+        bestScore = evaluate(board);
+        if (bestScore >= beta) return bestScore;
+        if (bestScore > alpha) alpha = bestScore;
+    }
+
+    int scores[MAX_MOVES];
+    scoreMoves(board, moves, scores, Move::none(), ply);
+    for (int i = 0; i < moves.size(); ++i) {
+        Move move = pickNext(moves, scores, i);
+        if (!inCheck && !move.isCapture() && !move.isPromotion()) break;
+        // Captures and promotions are ordered first, so the rest are quiet moves.
+
+        board.makeMove(move);
+        int score = -quiescence(board, -beta, -alpha, ply + 1);
+        board.unmakeMove();
+        if (stopped) return 0;
+
+        if (score > bestScore) {
+            bestScore = score;
+            if (score > alpha) alpha = score;
+        }
+        if (alpha >= beta) break;
+    }
+    return bestScore;
+}
+
+// Lazy SMP: several threads run the same iterative-deepening search on their own Board copy and
+// share nothing but the transposition table. Threads that finish a subtree first leave its result in
+// the table, which the others then pick up instead of searching it again; odd-numbered helpers start
+// one ply deeper so the threads are not all working on the same iteration. Each thread keeps its own
+// killer and history tables, so there is no locking anywhere in the search.
+//
+// The calling thread is the main searcher: its limits decide when the search ends, at which point
+// the helpers are told to stop and joined. With one thread no helper is started and the search is
+// exactly the deterministic single-threaded one.
+class ParallelSearch {
+private:
+    TranspositionTable& table;
+    std::vector<std::unique_ptr<Search>> searchers;   // searchers[0] runs on the calling thread.
+    std::vector<Board> helperBoards;                  // Branched from the root for searchers[1...].
+    std::atomic<bool> stopRequested;
+    std::atomic<std::int64_t> deadline;
+    std::function<void(const SearchResult&)> onIteration;
+
+public:
+    explicit ParallelSearch(TranspositionTable& sharedTable, int threads = 1);
+
+    // Changes the number of search threads. Must not be called while a search is running.
+    void setThreads(int threads);
+    int threadCount() const { return static_cast<int>(searchers.size()); }
+
+    // Searches the board's position with every thread and returns the best result found.
+    SearchResult run(Board& board, const SearchLimits& limits);
+
+    // The two halves of run(), for searches started on another thread: prepare() clears any earlier
+    // stop request and deadline, and runPrepared() searches. Calling prepare() before starting the
+    // thread means a stop() issued right after cannot be lost.
+    void prepare();
+    SearchResult runPrepared(Board& board, const SearchLimits& limits);
+
+    // Asks a running search to finish as soon as possible. Safe to call from another thread.
+    void stop();
+
+    // Makes a running search stop 'milliseconds' from now, in addition to its own limits.
+    // Safe to call from another thread.
+    void setDeadline(int milliseconds);
+
+    // Called after every iteration completed by the main searcher.
+    void setIterationCallback(std::function<void(const SearchResult&)> callback) { onIteration = std::move(callback); }
+
+    // Table statistics of the last search, summed over all threads.
+    TTStats tableStats() const;
+};
+
+ParallelSearch::ParallelSearch(TranspositionTable& sharedTable, int threads)
+    : table(sharedTable), stopRequested(false), deadline(0) {
+    setThreads(threads);
+}
+
+void ParallelSearch::setThreads(int threads) {
+    searchers.clear();
+    for (int i = 0; i < std::max(1, threads); ++i) {
+        searchers.emplace_back(new Search(table));
+        searchers.back()->setSharedStop(&stopRequested);
+        searchers.back()->setSharedDeadline(&deadline);
+        searchers.back()->setDepthOffset(i % 2);
+    }
+}
+
+void ParallelSearch::stop() {
+    stopRequested.store(true, std::memory_order_relaxed);
+}
+
+void ParallelSearch::setDeadline(int milliseconds) {
+    auto when = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    deadline.store(when.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+void ParallelSearch::prepare() {
+    stopRequested.store(false, std::memory_order_relaxed);
+    deadline.store(0, std::memory_order_relaxed);
+}
+
+SearchResult ParallelSearch::run(Board& board, const SearchLimits& limits) {
+    prepare();
+    return runPrepared(board, limits);
+}
+
+SearchResult ParallelSearch::runPrepared(Board& board, const SearchLimits& limits) {
+    // A book position is played from the book and a tablebase position from the tables: the move that
+    // keeps the best result with the shortest distance to the next capture or pawn move.
+    SearchResult probed;
+    int wdl;
+    auto probeStart = std::chrono::steady_clock::now();
+    probed.bestMove = openingBook.pick(board);
+    if (!probed.bestMove.isNone()) {
+        probed.depth = 1;
+        probed.pv.push_back(probed.bestMove);
+        probed.threadNodes.assign(searchers.size(), 0);
+        probed.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - probeStart).count();
+        if (onIteration) onIteration(probed);
+        return probed;
+    }
+    if (tablebases.usedInPlay() && tablebases.probeRoot(board, probed.bestMove, wdl)) {
+        probed.score = wdl == TB_WIN ? TB_WIN_SCORE : wdl == TB_LOSS ? -TB_WIN_SCORE : wdl;
+        probed.depth = 1;
+        probed.pv.push_back(probed.bestMove);
+        probed.threadNodes.assign(searchers.size(), 0);
+        probed.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - probeStart).count();
+        if (onIteration) onIteration(probed);
+        return probed;
+    }
+
+    searchers[0]->setIterationCallback(onIteration);
+    table.newSearch();
+    if (searchers.size() == 1) return searchers[0]->run(board, limits);
+
+    // Helpers get no limits of their own: they search until the main searcher is done.
+    SearchLimits helperLimits;
+    helperLimits.maxDepth = limits.maxDepth;
+    helperBoards.resize(searchers.size() - 1);
+    for (Board& helperBoard : helperBoards) helperBoard.branchFrom(board);
+    std::vector<SearchResult> results(searchers.size());
+    std::vector<std::thread> helpers;
+    for (std::size_t i = 1; i < searchers.size(); ++i) {
+        helpers.emplace_back([this, i, &results, &helperLimits]() {
+            results[i] = searchers[i]->run(helperBoards[i - 1], helperLimits);
+        });
+    }
+
+    results[0] = searchers[0]->run(board, limits);
+    stopRequested.store(true, std::memory_order_relaxed);
+    for (std::thread& helper : helpers) helper.join();
+
+    // Prefer the main result, unless a helper finished a deeper iteration before being stopped.
+    SearchResult best = results[0];
+    for (std::size_t i = 1; i < results.size(); ++i) {
+        if (results[i].depth > best.depth && !results[i].bestMove.isNone()) best = results[i];
+    }
+    best.nodes = 0;
+    best.threadNodes.clear();
+    for (const SearchResult& result : results) {
+        best.nodes += result.nodes;
+        best.threadNodes.push_back(result.nodes);
+    }
+    best.seconds = results[0].seconds;
+    return best;
+}
+
+TTStats ParallelSearch::tableStats() const {
+    TTStats total;
+    for (const auto& searcher : searchers) total += searcher->tableStats();
+    return total;
+}
+
+// Handles "search [--threads N] [--depth D] [--movetime MS] [--nodes N] [--hash MB] [FEN]": searches one
+// position, printing every completed iteration so time-to-depth can be compared across thread counts.
+int runSearch(int argc, char* argv[]) {
+    SearchLimits limits;
+    int threads = 1;
+    int hashMegabytes = 64;
+    std::string fen, bookPath, bookKeys, networkPath, stats;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--threads" && hasValue) threads = std::atoi(argv[++i]);
+        else if (arg == "--depth" && hasValue) limits.maxDepth = std::atoi(argv[++i]);
+        else if (arg == "--movetime" && hasValue) limits.moveTimeMs = std::atoi(argv[++i]);
+        else if (arg == "--nodes" && hasValue) limits.maxNodes = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--hash" && hasValue) hashMegabytes = std::atoi(argv[++i]);
+        else if (arg == "--syzygy" && hasValue) tablebases.init(argv[++i]);
+        else if (arg == "--syzygy-play") tablebases.setPlay(true);
+        else if (arg == "--nnue" && hasValue) networkPath = argv[++i];
+        else if (arg == "--book" && hasValue) bookPath = argv[++i];
+        else if (arg == "--book-keys" && hasValue) bookKeys = argv[++i];
+        else if (arg == "--stats" && hasValue) stats = argv[++i];
+        else fen += (fen.empty() ? "" : " ") + arg;
+        // Anything else is part of the FEN, quoted or not.
+    }
+    if (fen.empty()) fen = START_FEN;
+    if (limits.maxDepth == 0 && limits.moveTimeMs == 0 && limits.maxNodes == 0) limits.maxDepth = 8;
+
+    Board board;
+    if (threads < 1 || hashMegabytes < 1 || !board.fromFEN(fen)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " search [--threads N] [--depth D] [--movetime MS] [--nodes N] [--hash MB] [--syzygy DIRS]"
+                  << " [--syzygy-play] [--nnue FILE] [--book BIN --book-keys KEYS] [--stats json|prometheus] [FEN]\n";
+        return 1;
+    }
+    if (!networkPath.empty() && !network.load(networkPath.c_str())) {
+        std::cerr << "Cannot load network " << networkPath << ".\n";
+        return 1;
+    }
+    if (!bookPath.empty() && (!openingBook.loadKeys(bookKeys.c_str()) || !openingBook.open(bookPath.c_str()))) {
+        std::cerr << "Cannot load book " << bookPath << " with keys from '" << bookKeys << "'.\n";
+        return 1;
+    }
+
+    TranspositionTable table(hashMegabytes);
+    ParallelSearch engine(table, threads);
+    engine.setIterationCallback([](const SearchResult& result) {
+        std::cout << "depth " << result.depth << " score " << result.score << " nodes " << result.nodes
+                  << " time " << static_cast<int>(result.seconds * 1000) << " ms pv";
+        for (Move move : result.pv) std::cout << " " << move.toString();
+        std::cout << "\n";
+    });
+    SearchResult result = engine.run(board, limits);
+
+    std::cout << "bestmove " << (result.bestMove.isNone() ? "none" : result.bestMove.toString())
+              << " depth " << result.depth << " score " << result.score << "\n";
+    std::cout << "nodes " << result.nodes << " in " << result.seconds << " s, "
+              << static_cast<std::uint64_t>(nodesPerSecond(result.nodes, result.seconds)) << " nps\n";
+    for (std::size_t i = 0; i < result.threadNodes.size(); ++i) {
+        std::cout << "thread " << i << ": " << result.threadNodes[i] << " nodes\n";
+    }
+    std::cout << "hashfull " << table.hashfull() << " permille\n";
+    if (!stats.empty()) writeInstrumentation(std::cout, stats == "prometheus");
+    return 0;
+}
+
+// Handles "book <book.bin> <keys> [FEN]": lists the book moves of a position (the starting position
+// by default) with their weights, where 'keys' is the Polyglot random table (see OpeningBook).
+int runBook(int argc, char* argv[]) {
+    std::string fen;
+    for (int i = 4; i < argc; ++i) fen += (fen.empty() ? "" : " ") + std::string(argv[i]);
+    if (fen.empty()) fen = START_FEN;
+
+    Board board;
+    if (argc < 4 || !board.fromFEN(fen)) {
+        std::cerr << "Usage: " << argv[0] << " book <book.bin> <keys> [FEN]\n";
+        return 1;
+    }
+    if (!openingBook.loadKeys(argv[3])) {
+        std::cerr << "Cannot load Polyglot keys from " << argv[3] << " (781 constants giving the standard start key).\n";
+        return 1;
+    }
+    if (!openingBook.open(argv[2])) {
+        std::cerr << "Cannot open book " << argv[2] << ".\n";
+        return 1;
+    }
+
+    std::vector<BookMove> moves;
+    openingBook.lookup(board, moves);
+    long total = 0;
+    for (const BookMove& candidate : moves) total += candidate.weight;
+    std::cout << "key " << std::hex << openingBook.key(board.getState()) << std::dec << ", " << moves.size() << " book moves\n";
+    for (const BookMove& candidate : moves) {
+        std::cout << candidate.move.toString() << " weight " << candidate.weight;
+        if (total) std::cout << " (" << candidate.weight * 100 / total << "%)";
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+// UCI front end. Commands are read on the calling thread and every search runs on a thread of its
+// own, so "stop", "ponderhit" and "isready" are answered at once even in the middle of a search:
+// "stop" raises the search's stop flag and waits for the thread, which takes no longer than the
+// search's next limit check. Output from both threads goes through one lock so lines never interleave.
+class UCIFrontEnd {
+private:
+    TranspositionTable table;
+    ParallelSearch engine;
+    Board board;
+    std::thread searchThread;
+    std::mutex outputLock;
+
+    // A "go ponder" or "go infinite" search must not report its move until it is released by "stop"
+    // or "ponderhit", even if it finishes early.
+    std::mutex releaseLock;
+    std::condition_variable released;
+    bool holdResult;
+    int ponderTimeMs;            // Time to allow once a pondering search turns into a real one.
+
+    void send(const std::string& line);
+    void waitForSearch();
+    void position(std::string_view arguments);
+    void go(std::string_view arguments);
+    void setOption(std::string_view arguments);
+    static std::string formatScore(int score);
+
+public:
+    UCIFrontEnd();
+    ~UCIFrontEnd() { waitForSearch(); }
+
+    // Reads commands until "quit" or the end of the input.
+    void loop(std::istream& input);
+};
+
+UCIFrontEnd::UCIFrontEnd() : table(64), engine(table, 1), holdResult(false), ponderTimeMs(0) {
+    engine.setIterationCallback([this](const SearchResult& result) {
+        std::string line = "info depth " + std::to_string(result.depth) + " score " + formatScore(result.score) +
+                           " nodes " + std::to_string(result.nodes) +
+                           " nps " + std::to_string(static_cast<std::uint64_t>(nodesPerSecond(result.nodes, result.seconds))) +
+                           " time " + std::to_string(static_cast<int>(result.seconds * 1000)) +
+                           " hashfull " + std::to_string(table.hashfull()) + " pv";
+        for (Move move : result.pv) line += " " + move.toString();
+        send(line);
+    });
+}
+
+void UCIFrontEnd::send(const std::string& line) {
+    std::lock_guard<std::mutex> guard(outputLock);
+    std::cout << line << std::endl;
+}
+
+std::string UCIFrontEnd::formatScore(int score) {
+    // Mate scores are reported in moves, not plies: positive when the side to move mates.
+    if (score >= MATE_BOUND) return "mate " + std::to_string((MATE_SCORE - score + 1) / 2);
+    if (score <= -MATE_BOUND) return "mate " + std::to_string(-(MATE_SCORE + score) / 2);
+    return "cp " + std::to_string(score);
+}
+
+// Stops a running search, if any, and waits for it to report its move.
+void UCIFrontEnd::waitForSearch() {
+    if (!searchThread.joinable()) return;
+    engine.stop();
+    {
+        std::lock_guard<std::mutex> guard(releaseLock);
+        holdResult = false;
+    }
+    released.notify_all();
+    searchThread.join();
+}
+
+// "position [startpos | fen <FEN>] [moves <move>...]"
+void UCIFrontEnd::position(std::string_view arguments) {
+    std::string_view kind = nextField(arguments);
+    std::size_t movesAt = arguments.find("moves");
+    std::string_view fen = arguments.substr(0, movesAt);
+    if (kind == "startpos") {
+        board.fromFEN(START_FEN);
+    } else if (kind != "fen" || !board.fromFEN(fen)) {
+        send("info string invalid position");
+        return;
+    }
+
+    if (movesAt == std::string_view::npos) return;
+    std::string_view moves = arguments.substr(movesAt + 5);
+    // Moves are in coordinate notation, e.g. "e2e4" or "e7e8q", which movePiece() accepts split in two.
+    for (std::string_view move = nextField(moves); !move.empty(); move = nextField(moves)) {
+        if (move.size() < 4 || !board.movePiece(std::string(move.substr(0, 2)), std::string(move.substr(2)))) {
+            send("info string illegal move " + std::string(move));
+            return;
+        }
+    }
+}
+
+// "go [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>] [movestogo <n>] [depth <n>] [nodes <n>]
+//     [movetime <ms>] [infinite] [ponder]"
+void UCIFrontEnd::go(std::string_view arguments) {
+    SearchLimits limits;
+    int time[2] = { 0, 0 }, increment[2] = { 0, 0 }, movesToGo = 0;
+    bool infinite = false, ponder = false;
+    for (std::string_view token = nextField(arguments); !token.empty(); token = nextField(arguments)) {
+        if (token == "infinite") { infinite = true; continue; }
+        if (token == "ponder") { ponder = true; continue; }
+        long long value = 0;
+        std::string_view number = nextField(arguments);
+        std::from_chars(number.data(), number.data() + number.size(), value);
+        if (token == "wtime") time[0] = static_cast<int>(value);
+        else if (token == "btime") time[1] = static_cast<int>(value);
+        else if (token == "winc") increment[0] = static_cast<int>(value);
+        else if (token == "binc") increment[1] = static_cast<int>(value);
+        else if (token == "movestogo") movesToGo = static_cast<int>(value);
+        else if (token == "depth") limits.maxDepth = static_cast<int>(value);
+        else if (token == "nodes") limits.maxNodes = static_cast<std::uint64_t>(value);
+        else if (token == "movetime") limits.moveTimeMs = static_cast<int>(value);
+    }
+
+    // With a clock, spend an even share of the remaining time plus most of the increment, never
+    // more than half the clock, and keep a little back for communication delays.
+    const int side = colorIndex(board.getTurn());
+    if (!limits.moveTimeMs && time[side] > 0) {
+        int share = time[side] / (movesToGo > 0 ? movesToGo + 1 : 30) + increment[side] * 3 / 4;
+        limits.moveTimeMs = std::max(1, std::min(share, time[side] / 2) - 10);
+    }
+    ponderTimeMs = limits.moveTimeMs;
+    if (ponder) limits.moveTimeMs = 0;
+    // The clock only starts at "ponderhit"; until then the search runs unlimited.
+
+    holdResult = infinite || ponder;
+    engine.prepare();
+    // Cleared here rather than on the search thread, so a "stop" that follows at once is not lost.
+    Board root = board;
+    searchThread = std::thread([this, root, limits]() mutable {
+        SearchResult result = engine.runPrepared(root, limits);
+        {
+            std::unique_lock<std::mutex> guard(releaseLock);
+            released.wait(guard, [this]() { return !holdResult; });
+        }
+        std::string line = "bestmove " + (result.bestMove.isNone() ? std::string("0000") : result.bestMove.toString());
+        if (result.pv.size() > 1) line += " ponder " + result.pv[1].toString();
+        send(line);
+    });
+}
+
+// "setoption name <Hash|Threads|SyzygyPath|SyzygyCache|SyzygyPlay|BookKeys|BookFile|EvalFile> value <value>"
+void UCIFrontEnd::setOption(std::string_view arguments) {
+    nextField(arguments);
+    std::string_view name = nextField(arguments);
+    nextField(arguments);
+    std::string_view valueText = arguments;
+    // Everything after "value": a path list may contain spaces.
+    while (!valueText.empty() && valueText.front() == ' ') valueText.remove_prefix(1);
+    int value = 0;
+    std::from_chars(valueText.data(), valueText.data() + valueText.size(), value);
+
+    waitForSearch();
+    if (name == "SyzygyPath") {
+        std::string paths(valueText == "<empty>" ? std::string_view() : valueText);
+        send("info string found " + std::to_string(tablebases.init(paths)) + " tablebases");
+    }
+    else if (name == "BookKeys" || name == "BookFile") {
+        // The keys must be set first; the book is only used once both have loaded.
+        std::string path(valueText);
+        bool loaded = path == "<empty>" || path.empty() ? (openingBook.close(), true)
+                      : name == "BookKeys" ? openingBook.loadKeys(path.c_str()) : openingBook.open(path.c_str());
+        if (!loaded) send("info string cannot load " + path);
+    }
+    else if (name == "EvalFile") {
+        std::string path(valueText);
+        if (path == "<empty>" || path.empty()) network.unload();
+        else if (network.load(path.c_str())) send(std::string("info string network loaded, ") + network.kernelName() + " kernels");
+        else send("info string cannot load " + path);
+    }
+    else if (name == "SyzygyPlay" && (valueText == "true" || valueText == "false")) tablebases.setPlay(valueText == "true");
+    else if (name == "SyzygyCache" && value >= 1) tablebases.setCacheLimit(static_cast<std::size_t>(value));
+    else if (name == "Hash" && value >= 1) table.resize(static_cast<std::size_t>(value));
+    else if (name == "Threads" && value >= 1) engine.setThreads(value);
+    else send("info string unknown option or value");
+}
+
+void UCIFrontEnd::loop(std::istream& input) {
+    std::string line;
+    while (std::getline(input, line)) {
+        std::string_view arguments(line);
+        std::string_view command = nextField(arguments);
+
+        if (command == "uci") {
+            send("id name CIS17C Chess");
+            send("id author CIS17C Project 2");
+            send("option name Hash type spin default 64 min 1 max 65536");
+            send("option name Threads type spin default 1 min 1 max 512");
+            send("option name Ponder type check default false");
+            send("option name SyzygyPath type string default <empty>");
+            send("option name SyzygyCache type spin default 64 min 1 max 4096");
+            send("option name SyzygyPlay type check default false");
+            send("option name BookKeys type string default <empty>");
+            send("option name BookFile type string default <empty>");
+            send("option name EvalFile type string default <empty>");
+            send("uciok");
+        } else if (command == "isready") {
+            send("readyok");
+        } else if (command == "ucinewgame") {
+            waitForSearch();
+            table.clear();
+        } else if (command == "setoption") {
+            setOption(arguments);
+        } else if (command == "position") {
+            waitForSearch();
+            position(arguments);
+        } else if (command == "go") {
+            waitForSearch();
+            go(arguments);
+        } else if (command == "stop") {
+            waitForSearch();
+        } else if (command == "ponderhit") {
+            // The opponent played the expected move: the search continues as a normal timed search.
+            if (ponderTimeMs > 0) engine.setDeadline(ponderTimeMs);
+            {
+                std::lock_guard<std::mutex> guard(releaseLock);
+                holdResult = false;
+            }
+            released.notify_all();
+        } else if (command == "stats") {
+            // Not part of UCI; dumps the instrumentation counters, as JSON unless "prometheus" is given.
+            std::ostringstream text;
+            writeInstrumentation(text, nextField(arguments) == "prometheus");
+            std::lock_guard<std::mutex> guard(outputLock);
+            std::cout << text.str() << std::flush;
+        } else if (command == "d") {
+            send(board.toFEN());
+            // Not part of UCI; prints the current position for debugging.
+        } else if (command == "quit") {
+            break;
+        }
+    }
+    waitForSearch();
+}
+
+// Handles "uci": speaks the UCI protocol on standard input and output.
+int runUCI() {
+    UCIFrontEnd frontEnd;
+    frontEnd.loop(std::cin);
+    return 0;
+}
+
+// One game of a PGN archive, as views into the archive text.
+struct PGNGame {
+    std::string_view tags;       // The tag pair section, e.g. [Event "..."] lines.
+    std::string_view movetext;   // Moves, comments and the result.
+    std::size_t offset = 0;      // Byte offset of the game in the archive.
+    std::size_t index = 0;       // Game number, counting from 0.
+
+    // Returns the value of the named tag without its quotes, or an empty view if the tag is absent.
+    std::string_view tag(std::string_view name) const;
+};
+
+std::string_view PGNGame::tag(std::string_view name) const {
+    std::string_view rest = tags;
+    while (!rest.empty()) {
+        std::size_t open = rest.find('[');
+        if (open == std::string_view::npos) break;
+        rest.remove_prefix(open + 1);
+        std::size_t space = rest.find_first_of(" \t");
+        if (space == std::string_view::npos) break;
+        if (rest.substr(0, space) == name) {
+            std::size_t first = rest.find('"', space);
+            std::size_t last = first == std::string_view::npos ? first : rest.find('"', first + 1);
+            if (last == std::string_view::npos) break;
+            return rest.substr(first + 1, last - first - 1);
+        }
+    }
+    return std::string_view();
+}
+
+// Splits PGN text into games. A game is its tag lines followed by movetext up to the next tag line
+// outside a comment; nothing is copied, the games are views into the text.
+class PGNReader {
+private:
+    std::string_view text;
+    std::size_t position;
+    std::size_t gameCount;
+
+public:
+    explicit PGNReader(std::string_view archive) : text(archive), position(0), gameCount(0) {}
+
+    // Reads the next game. Returns false at the end of the text.
+    bool next(PGNGame& game);
+};
+
+bool PGNReader::next(PGNGame& game) {
+    // Skip blank lines (and a byte order mark) up to the next game.
+    while (position < text.size() && std::strchr(" \t\r\n\xEF\xBB\xBF", text[position])) ++position;
+    if (position >= text.size()) return false;
+
+    game.offset = position;
+    game.index = gameCount++;
+
+    // Tag section: consecutive lines starting with '['.
+    std::size_t tagsStart = position;
+    while (position < text.size() && text[position] == '[') {
+        std::size_t end = text.find('\n', position);
+        position = end == std::string_view::npos ? text.size() : end + 1;
+        while (position < text.size() && std::strchr(" \t\r\n", text[position])) ++position;
+    }
+    game.tags = text.substr(tagsStart, position - tagsStart);
+
+    // Movetext: up to a '[' at the start of a line that is not inside a {comment}.
+    std::size_t movesStart = position;
+    bool inComment = false;
+    bool lineStart = false;
+    for (; position < text.size(); ++position) {
+        char c = text[position];
+        if (inComment) {
+            inComment = c != '}';
+        } else if (c == '{') {
+            inComment = true;
+        } else if (c == '[' && lineStart) {
+            break;
+        }
+        if (c == '\n') lineStart = true;
+        else if (c != ' ' && c != '\t' && c != '\r') lineStart = false;
+    }
+    game.movetext = text.substr(movesStart, position - movesStart);
+    return true;
+}
+
+// Iterates over the SAN moves of a game's movetext, skipping move numbers, comments, variations,
+// numeric annotation glyphs and the result. Tokens are views into the movetext.
+class SANTokenizer {
+private:
+    std::string_view text;
+    std::size_t position;
+
+public:
+    explicit SANTokenizer(std::string_view movetext) : text(movetext), position(0) {}
+
+    // Reads the next move. Returns false at the result or the end of the movetext.
+    bool next(std::string_view& san);
+};
+
+bool SANTokenizer::next(std::string_view& san) {
+    while (position < text.size()) {
+        char c = text[position];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '.') {
+            ++position;
+        } else if (c == '{') {
+            std::size_t end = text.find('}', position);
+            position = end == std::string_view::npos ? text.size() : end + 1;
+        } else if (c == ';' || (c == '%' && (position == 0 || text[position - 1] == '\n'))) {
+            // Rest-of-line comment, or an escaped line.
+            std::size_t end = text.find('\n', position);
+            position = end == std::string_view::npos ? text.size() : end + 1;
+        } else if (c == '(') {
+            // Variations may nest and may hold comments with parentheses in them.
+            int depth = 0;
+            for (; position < text.size(); ++position) {
+                char v = text[position];
+                if (v == '{') {
+                    std::size_t end = text.find('}', position);
+                    if (end == std::string_view::npos) end = text.size() - 1;
+                    position = end;
+                } else if (v == '(') {
+                    ++depth;
+                } else if (v == ')' && --depth == 0) {
+                    ++position;
+                    break;
+                }
+            }
+        } else {
+            std::size_t start = position;
+            while (position < text.size() && !std::strchr(" \t\r\n{}();", text[position])) ++position;
+            if (position == start) {
+                ++position;
+                continue;
+                // A stray delimiter such as ')' or '}'.
+            }
+            std::string_view token = text.substr(start, position - start);
+
+            if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*") {
+                position = text.size();
+                return false;
+            }
+            if (token[0] == '$') continue;
+            // Numeric annotation glyph.
+
+            // Strip a move number such as "12." or "12..." glued to the move.
+            std::size_t digits = 0;
+            while (digits < token.size() && std::isdigit(static_cast<unsigned char>(token[digits]))) ++digits;
+            if (digits > 0 && digits < token.size() && token[digits] == '.') {
+                token.remove_prefix(digits);
+                while (!token.empty() && token.front() == '.') token.remove_prefix(1);
+            } else if (digits == token.size()) {
+                continue;
+                // A bare move number.
+            }
+            if (token.empty()) continue;
+
+            san = token;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Outcome of replaying one game.
+struct GameCheck {
+    bool valid = true;
+    int plies = 0;                   // Moves replayed before the end or the first error.
+    const char* error = nullptr;     // What went wrong, if the game is invalid.
+    std::string_view token;          // The offending move or FEN tag, a view into the archive.
+};
+
+// Replays a game on 'board' from its FEN tag or the standard starting position, resolving each SAN
+// move against the legal move generator and playing it with makeMove(). Stops at the first move that
+// is illegal, ambiguous or unreadable.
+GameCheck replayGame(const PGNGame& game, Board& board) {
+    static const BoardState initialState = Board().getState();
+    GameCheck check;
+
+    std::string_view fen = game.tag("FEN");
+    if (fen.empty()) {
+        board.setState(initialState);
+    } else if (!board.fromFEN(fen)) {
+        check.valid = false;
+        check.error = "invalid FEN tag";
+        check.token = fen;
+        return check;
+    }
+
+    SANTokenizer tokens(game.movetext);
+    std::string_view san;
+    while (tokens.next(san)) {
+        Move move = board.parseSAN(san);
+        if (move.isNone()) {
+            check.valid = false;
+            check.error = "illegal or ambiguous move";
+            check.token = san;
+            return check;
+        }
+        board.makeMove(move);
+        ++check.plies;
+    }
+    return check;
+}
+
+// Binary game archive. A file is
+//   "CHSG" and a 32-bit format version,
+//   one record per game,
+//   an index of 64-bit record offsets, one per game,
+//   a footer: the 64-bit game count, the 64-bit index offset and "CHSI".
+// A record is a varint byte length followed by a varint tag count, each tag as a varint-prefixed
+// name and value, a varint ply count and one 16-bit Move::raw() per ply. Integers are little-endian
+// and varints are LEB128. Moves keep their flags, so replaying a record needs no move generation,
+// and game N is found through the index with two reads. Games that do not start from the initial
+// position carry a FEN tag, as in PGN.
+const std::uint32_t GAME_ARCHIVE_VERSION = 1;
+
+// Appends an unsigned LEB128 varint: seven bits per byte, low bits first, high bit set on all but the last.
+static void appendVarint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Reads a varint at 'p', advancing it. Returns false if the varint runs past 'end' or is too long.
+static bool readVarint(const unsigned char*& p, const unsigned char* end, std::uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        unsigned char byte = *p++;
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static void appendFixed(std::string& out, std::uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+static std::uint64_t readFixed(const unsigned char* p, int bytes) {
+    std::uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) value |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+    return value;
+}
+
+// Encodes one game record, appending it to 'out'. 'tags' holds name/value pairs.
+void encodeGame(std::string& out, const std::vector<std::pair<std::string_view, std::string_view>>& tags,
+                const Move* moves, std::size_t plies) {
+    // The body is built after a placeholder for its length, which is then filled in; the longest
+    // possible length varint is reserved so no bytes have to move.
+    std::size_t start = out.size();
+    out.append(5, '\0');
+    appendVarint(out, tags.size());
+    for (const auto& tag : tags) {
+        appendVarint(out, tag.first.size());
+        out.append(tag.first.data(), tag.first.size());
+        appendVarint(out, tag.second.size());
+        out.append(tag.second.data(), tag.second.size());
+    }
+    appendVarint(out, plies);
+    for (std::size_t i = 0; i < plies; ++i) appendFixed(out, moves[i].raw(), 2);
+
+    // A padded varint: every byte but the last has its continuation bit set.
+    std::uint64_t length = out.size() - start - 5;
+    for (int i = 0; i < 5; ++i) {
+        out[start + i] = static_cast<char>(((length >> (7 * i)) & 0x7F) | (i < 4 ? 0x80 : 0));
+    }
+}
+
+// Writes a binary game archive. Records are streamed to the file as they are added; the index and
+// footer are written by finish().
+class GameArchiveWriter {
+private:
+    std::ofstream out;
+    std::vector<std::uint64_t> offsets;
+    std::uint64_t position;
+
+public:
+    GameArchiveWriter() : position(0) {}
+
+    // Creates the file and writes its header. Returns false if it cannot be created.
+    bool open(const char* path);
+
+    // Appends records already produced by encodeGame(); 'count' is how many 'records' holds.
+    void writeRecords(const std::string& records, std::size_t count);
+
+    // Writes the index and footer and closes the file. Returns false if any write failed.
+    bool finish();
+
+    std::size_t games() const { return offsets.size(); }
+};
+
+bool GameArchiveWriter::open(const char* path) {
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    std::string header = "CHSG";
+    appendFixed(header, GAME_ARCHIVE_VERSION, 4);
+    out.write(header.data(), header.size());
+    position = header.size();
+    offsets.clear();
+    return static_cast<bool>(out);
+}
+
+void GameArchiveWriter::writeRecords(const std::string& records, std::size_t count) {
+    // Walk the length prefixes to find where each record starts.
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(records.data());
+    const unsigned char* p = begin;
+    const unsigned char* end = begin + records.size();
+    for (std::size_t i = 0; i < count && p < end; ++i) {
+        offsets.push_back(position + static_cast<std::uint64_t>(p - begin));
+        std::uint64_t length = 0;
+        if (!readVarint(p, end, length)) break;
+        p += length;
+    }
+    out.write(records.data(), records.size());
+    position += records.size();
+}
+
+bool GameArchiveWriter::finish() {
+    std::string tail;
+    tail.reserve(offsets.size() * 8 + 20);
+    for (std::uint64_t offset : offsets) appendFixed(tail, offset, 8);
+    appendFixed(tail, offsets.size(), 8);
+    appendFixed(tail, position, 8);
+    tail += "CHSI";
+    out.write(tail.data(), tail.size());
+    out.close();
+    return !out.fail();
+}
+
+// One game read from an archive; it points into the mapping and is valid while the archive is open.
+struct GameRecord {
+    const unsigned char* tagData = nullptr;   // Start of the tag list.
+    std::size_t tagCount = 0;
+    const unsigned char* moveData = nullptr;  // 'plies' little-endian 16-bit moves.
+    std::size_t plies = 0;
+    const unsigned char* end = nullptr;       // End of the record.
+
+    Move move(std::size_t ply) const { return Move::fromRaw(static_cast<std::uint16_t>(readFixed(moveData + 2 * ply, 2))); }
+
+    // Returns the value of the named tag, or an empty view if the game has no such tag.
+    std::string_view tag(std::string_view name) const;
+};
+
+std::string_view GameRecord::tag(std::string_view name) const {
+    const unsigned char* p = tagData;
+    for (std::size_t i = 0; i < tagCount; ++i) {
+        std::uint64_t nameLength = 0, valueLength = 0;
+        readVarint(p, end, nameLength);
+        std::string_view tagName(reinterpret_cast<const char*>(p), nameLength);
+        p += nameLength;
+        readVarint(p, end, valueLength);
+        if (tagName == name) return std::string_view(reinterpret_cast<const char*>(p), valueLength);
+        p += valueLength;
+    }
+    return std::string_view();
+}
+
+// Read-only view of a binary game archive through a memory mapping.
+class GameArchive {
+private:
+    MappedFile file;
+    const unsigned char* data;
+    std::size_t length;
+    const unsigned char* index;
+    std::size_t gameCount;
+
+public:
+    GameArchive() : data(nullptr), length(0), index(nullptr), gameCount(0) {}
+
+    // Maps the archive and checks its header and footer. Returns false if it is not a valid archive.
+    bool open(const char* path);
+
+    std::size_t size() const { return gameCount; }
+
+    // Decodes game 'n' (counting from 0) through the index. Returns false if the record is damaged.
+    bool game(std::size_t n, GameRecord& record) const;
+};
+
+bool GameArchive::open(const char* path) {
+    gameCount = 0;
+    if (!file.open(path)) return false;
+    data = reinterpret_cast<const unsigned char*>(file.view().data());
+    length = file.view().size();
+    if (length < 8 + 20 || std::memcmp(data, "CHSG", 4) != 0 || readFixed(data + 4, 4) != GAME_ARCHIVE_VERSION ||
+        std::memcmp(data + length - 4, "CHSI", 4) != 0) {
+        return false;
+    }
+    std::uint64_t count = readFixed(data + length - 20, 8);
+    std::uint64_t indexOffset = readFixed(data + length - 12, 8);
+    if (indexOffset > length - 20 || (length - 20 - indexOffset) / 8 != count) return false;
+    index = data + indexOffset;
+    gameCount = static_cast<std::size_t>(count);
+    return true;
+}
+
+bool GameArchive::game(std::size_t n, GameRecord& record) const {
+    if (n >= gameCount) return false;
+    std::uint64_t offset = readFixed(index + 8 * n, 8);
+    const unsigned char* limit = index;
+    // Records never extend into the index.
+    if (offset >= static_cast<std::uint64_t>(limit - data)) return false;
+
+    const unsigned char* p = data + offset;
+    std::uint64_t recordLength = 0, tagCount = 0, plies = 0;
+    if (!readVarint(p, limit, recordLength) || recordLength > static_cast<std::uint64_t>(limit - p)) return false;
+    record.end = p + recordLength;
+    if (!readVarint(p, record.end, tagCount)) return false;
+    record.tagData = p;
+    record.tagCount = static_cast<std::size_t>(tagCount);
+    for (std::uint64_t i = 0; i < 2 * tagCount; ++i) {
+        std::uint64_t fieldLength = 0;
+        if (!readVarint(p, record.end, fieldLength) || fieldLength > static_cast<std::uint64_t>(record.end - p)) return false;
+        p += fieldLength;
+    }
+    if (!readVarint(p, record.end, plies) || plies * 2 != static_cast<std::uint64_t>(record.end - p)) return false;
+    record.moveData = p;
+    record.plies = static_cast<std::size_t>(plies);
+    return true;
+}
+
+// Collects the tag pairs of a PGN game as views into the archive text.
+static void collectTags(const PGNGame& game, std::vector<std::pair<std::string_view, std::string_view>>& tags) {
+    tags.clear();
+    std::string_view rest = game.tags;
+    while (true) {
+        std::size_t open = rest.find('[');
+        if (open == std::string_view::npos) break;
+        rest.remove_prefix(open + 1);
+        std::size_t space = rest.find_first_of(" \t");
+        std::size_t first = rest.find('"');
+        std::size_t last = first == std::string_view::npos ? first : rest.find('"', first + 1);
+        if (space == std::string_view::npos || last == std::string_view::npos || space > first) break;
+        tags.emplace_back(rest.substr(0, space), rest.substr(first + 1, last - first - 1));
+        rest.remove_prefix(last + 1);
+    }
+}
+
+// Encodes the game played on 'board' since its start position, with the given tags. A FEN tag is
+// added when the game did not start from the initial position.
+void encodeBoardGame(std::string& out, const Board& board,
+                     std::vector<std::pair<std::string_view, std::string_view>> tags) {
+    static const std::uint64_t initialHash = Board().getHash();
+    std::vector<Move> moves(board.moveCount());
+    for (std::size_t i = 0; i < moves.size(); ++i) moves[i] = board.moveAt(i);
+
+    std::string fen;
+    bool hasFEN = false;
+    for (const auto& tag : tags) hasFEN = hasFEN || tag.first == "FEN";
+    BoardState start = board.startPosition();
+    if (!hasFEN && start.hash != initialHash) {
+        appendFEN(start, fen);
+        tags.emplace_back("FEN", fen);
+    }
+    encodeGame(out, tags, moves.data(), moves.size());
+}
+
+// Plays a move read from an archive record on 'board'. Records are not trusted: the move is played
+// only if it is one of the legal moves of the position, and false is returned otherwise.
+static bool playRecordedMove(Board& board, Move move) {
+    MoveList moves;
+    board.generateLegalMoves(moves);
+    if (std::find(moves.begin(), moves.end(), move) == moves.end()) return false;
+    board.makeMove(move);
+    return true;
+}
+
+// Handles "games <archive> [N]": with N, prints the tags and moves of game N (counting from 1) and
+// the final position; without, replays every game and prints the throughput.
+int runGames(int argc, char* argv[]) {
+    typedef std::chrono::steady_clock Clock;
+    GameArchive archive;
+    if (argc < 3 || !archive.open(argv[2])) {
+        std::cerr << "Usage: " << argv[0] << " games <archive> [game number]\n";
+        return 1;
+    }
+
+    static const BoardState initialState = Board().getState();
+    Board board;
+    GameRecord record;
+    // Replays one record; returns false if its FEN tag is unreadable or one of its moves is illegal.
+    auto replay = [&board, &record]() {
+        std::string_view fen = record.tag("FEN");
+        if (fen.empty()) board.setState(initialState);
+        else if (!board.fromFEN(fen)) return false;
+        for (std::size_t ply = 0; ply < record.plies; ++ply) {
+            if (!playRecordedMove(board, record.move(ply))) return false;
+        }
+        return true;
+    };
+
+    if (argc > 3) {
+        std::size_t n = std::strtoull(argv[3], nullptr, 10);
+        if (n < 1 || !archive.game(n - 1, record) || !replay()) {
+            std::cerr << "No readable game " << argv[3] << " in an archive of " << archive.size() << " games.\n";
+            return 1;
+        }
+        for (std::string_view name : { "Event", "White", "Black", "Result", "FEN" }) {
+            std::string_view value = record.tag(name);
+            if (!value.empty()) std::cout << "[" << name << " \"" << value << "\"]\n";
+        }
+        for (std::size_t ply = 0; ply < record.plies; ++ply) {
+            std::cout << record.move(ply).toString() << (ply + 1 == record.plies ? "\n" : " ");
+        }
+        std::cout << board.toFEN() << "\n";
+        return 0;
+    }
+
+    Clock::time_point start = Clock::now();
+    std::uint64_t plies = 0;
+    std::size_t damaged = 0;
+    for (std::size_t n = 0; n < archive.size(); ++n) {
+        if (!archive.game(n, record) || !replay()) {
+            ++damaged;
+            continue;
+        }
+        plies += record.plies;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << archive.size() << " games (" << damaged << " damaged), " << plies << " plies in " << seconds
+              << " s: " << static_cast<std::uint64_t>(seconds > 0 ? archive.size() / seconds : 0) << " games/s\n";
+    return damaged == 0 ? 0 : 1;
+}
+
+// On-disk index from position key to the games that reached the position. The file is
+//   "CHPI" and a 32-bit format version,
+//   the entries, sorted by key and then game number,
+//   a table of 65537 64-bit entry numbers: entries whose key starts with the 16 bits b are
+//   numbered table[b] up to table[b + 1],
+//   a footer: the 64-bit entry count and "CHPX".
+// Each entry is 16 bytes, little-endian: key (8), game number (4), first ply the position occurred
+// in that game (2), result (1) and a reserved byte. A lookup reads two table words and binary searches
+// one bucket, which for uniformly distributed Zobrist keys is a few entries even in a billion-entry
+// index, so it touches two or three pages of the mapping.
+const std::uint32_t POSITION_INDEX_VERSION = 1;
+const int POSITION_ENTRY_BYTES = 16;
+const std::size_t POSITION_INDEX_BUCKETS = 1 << 16;
+
+// Outcome of a game as stored in the index.
+enum class GameResult : std::uint8_t { UNKNOWN, WHITE_WINS, BLACK_WINS, DRAW };
+
+const char* const RESULT_NAMES[4] = { "*", "1-0", "0-1", "1/2-1/2" };
+// PGN spelling of each GameResult.
+
+static GameResult parseResult(std::string_view result) {
+    if (result == "1-0") return GameResult::WHITE_WINS;
+    if (result == "0-1") return GameResult::BLACK_WINS;
+    if (result == "1/2-1/2") return GameResult::DRAW;
+    return GameResult::UNKNOWN;
+}
+
+struct PositionEntry {
+    std::uint64_t key;
+    std::uint32_t game;
+    std::uint16_t ply;
+    GameResult result;
+
+    bool operator<(const PositionEntry& other) const {
+        return key != other.key ? key < other.key : game != other.game ? game < other.game : ply < other.ply;
+    }
+};
+
+static void appendEntry(std::string& out, const PositionEntry& entry) {
+    appendFixed(out, entry.key, 8);
+    appendFixed(out, entry.game, 4);
+    appendFixed(out, entry.ply, 2);
+    appendFixed(out, static_cast<std::uint8_t>(entry.result), 1);
+    appendFixed(out, 0, 1);
+}
+
+static PositionEntry readEntry(const unsigned char* p) {
+    PositionEntry entry;
+    entry.key = readFixed(p, 8);
+    entry.game = static_cast<std::uint32_t>(readFixed(p + 8, 4));
+    entry.ply = static_cast<std::uint16_t>(readFixed(p + 12, 2));
+    entry.result = static_cast<GameResult>(p[14]);
+    return entry;
+}
+
+// Builds a position index from a game archive with an external sort: entries are collected into a
+// buffer of bounded size, each full buffer is sorted and written out as a run, and the runs are then
+// merged into the index. Memory use is the buffer plus one read buffer per run, however large the
+// archive. Positions repeated within a game are kept once, with their first ply. Damaged games are
+// counted on std::cerr and left out of the index.
+// Returns false, with a message on std::cerr, if a file cannot be read or written.
+bool buildPositionIndex(const char* archivePath, const char* indexPath, std::size_t memoryBytes) {
+    GameArchive archive;
+    if (!archive.open(archivePath)) {
+        std::cerr << "Cannot read game archive " << archivePath << ".\n";
+        return false;
+    }
+
+    const std::size_t bufferEntries = std::max<std::size_t>(memoryBytes / sizeof(PositionEntry), 1024);
+    std::vector<PositionEntry> buffer;
+    buffer.reserve(bufferEntries);
+    std::vector<std::string> runPaths;
+    std::string bytes;
+
+    // Sorts the buffer and writes it out as the next run file.
+    auto flushRun = [&]() {
+        std::sort(buffer.begin(), buffer.end());
+        runPaths.push_back(std::string(indexPath) + ".run" + std::to_string(runPaths.size()));
+        std::ofstream run(runPaths.back(), std::ios::binary | std::ios::trunc);
+        bytes.clear();
+        for (const PositionEntry& entry : buffer) appendEntry(bytes, entry);
+        run.write(bytes.data(), bytes.size());
+        buffer.clear();
+        return static_cast<bool>(run);
+    };
+
+    static const BoardState initialState = Board().getState();
+    Board board;
+    GameRecord record;
+    std::vector<std::uint64_t> keys;
+    std::size_t skipped = 0;
+    bool ok = true;
+    for (std::size_t n = 0; n < archive.size() && ok; ++n) {
+        // The whole game is replayed before any of its positions are indexed, so that a damaged
+        // record (an unreadable FEN tag or an illegal move) is skipped entirely.
+        bool readable = archive.game(n, record);
+        std::string_view fen = readable ? record.tag("FEN") : std::string_view();
+        if (readable && fen.empty()) board.setState(initialState);
+        else if (readable) readable = board.fromFEN(fen);
+        keys.clear();
+        for (std::size_t ply = 0; readable; ++ply) {
+            keys.push_back(board.getHash());
+            if (ply == record.plies) break;
+            readable = playRecordedMove(board, record.move(ply));
+        }
+        if (!readable) {
+            ++skipped;
+            continue;
+        }
+
+        PositionEntry entry;
+        entry.game = static_cast<std::uint32_t>(n);
+        entry.result = parseResult(record.tag("Result"));
+        for (std::size_t ply = 0; ply < keys.size() && ok; ++ply) {
+            entry.key = keys[ply];
+            entry.ply = static_cast<std::uint16_t>(std::min<std::size_t>(ply, 0xFFFF));
+            buffer.push_back(entry);
+            if (buffer.size() == bufferEntries) ok = flushRun();
+        }
+    }
+    if (ok && (!buffer.empty() || runPaths.empty())) ok = flushRun();
+    if (skipped > 0) std::cerr << "Skipped " << skipped << " damaged games.\n";
+
+    // Merge the runs, smallest entry first, dropping repeats of a position within one game.
+    std::vector<std::ifstream> runs;
+    for (const std::string& path : runPaths) runs.emplace_back(path, std::ios::binary);
+    typedef std::pair<PositionEntry, std::size_t> Head;
+    auto later = [](const Head& a, const Head& b) { return b.first < a.first; };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    unsigned char raw[POSITION_ENTRY_BYTES];
+    auto advance = [&](std::size_t run) {
+        if (runs[run].read(reinterpret_cast<char*>(raw), POSITION_ENTRY_BYTES)) heads.emplace(readEntry(raw), run);
+    };
+    for (std::size_t run = 0; run < runs.size(); ++run) advance(run);
+
+    std::ofstream out(indexPath, std::ios::binary | std::ios::trunc);
+    std::string header = "CHPI";
+    appendFixed(header, POSITION_INDEX_VERSION, 4);
+    out.write(header.data(), header.size());
+
+    std::vector<std::uint64_t> bucketStart(POSITION_INDEX_BUCKETS + 1, 0);
+    std::uint64_t count = 0;
+    PositionEntry previous = PositionEntry();
+    bytes.clear();
+    while (!heads.empty()) {
+        Head head = heads.top();
+        heads.pop();
+        advance(head.second);
+        const PositionEntry& entry = head.first;
+        if (count > 0 && entry.key == previous.key && entry.game == previous.game) continue;
+
+        ++bucketStart[(entry.key >> 48) + 1];
+        appendEntry(bytes, entry);
+        previous = entry;
+        ++count;
+        if (bytes.size() >= (1 << 20)) {
+            out.write(bytes.data(), bytes.size());
+            bytes.clear();
+        }
+    }
+
+    // Bucket counts become running starting points.
+    for (std::size_t b = 1; b <= POSITION_INDEX_BUCKETS; ++b) bucketStart[b] += bucketStart[b - 1];
+    for (std::uint64_t start : bucketStart) appendFixed(bytes, start, 8);
+    appendFixed(bytes, count, 8);
+    bytes += "CHPX";
+    out.write(bytes.data(), bytes.size());
+    out.close();
+    ok = ok && !out.fail();
+
+    runs.clear();
+    for (const std::string& path : runPaths) std::remove(path.c_str());
+    if (!ok) std::cerr << "Cannot write position index " << indexPath << ".\n";
+    return ok;
+}
+
+// Read-only view of a position index through a memory mapping.
+class PositionIndex {
+private:
+    MappedFile file;
+    const unsigned char* entries;
+    const unsigned char* buckets;
+    std::uint64_t entryCount;
+
+public:
+    PositionIndex() : entries(nullptr), buckets(nullptr), entryCount(0) {}
+
+    // Maps the index and checks its header and footer. Returns false if it is not a valid index.
+    bool open(const char* path);
+
+    std::uint64_t size() const { return entryCount; }
+
+    // Appends the entry of every game that reached the position with this key, in game order.
+    void find(std::uint64_t key, std::vector<PositionEntry>& found) const;
+};
+
+bool PositionIndex::open(const char* path) {
+    entryCount = 0;
+    if (!file.open(path)) return false;
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(file.view().data());
+    const std::size_t length = file.view().size();
+    const std::size_t tableBytes = (POSITION_INDEX_BUCKETS + 1) * 8;
+    if (length < 8 + tableBytes + 12 || std::memcmp(data, "CHPI", 4) != 0 ||
+        readFixed(data + 4, 4) != POSITION_INDEX_VERSION || std::memcmp(data + length - 4, "CHPX", 4) != 0) {
+        return false;
+    }
+    std::uint64_t count = readFixed(data + length - 12, 8);
+    if (8 + count * POSITION_ENTRY_BYTES + tableBytes + 12 != length) return false;
+    entries = data + 8;
+    buckets = entries + count * POSITION_ENTRY_BYTES;
+    entryCount = count;
+    return true;
+}
+
+void PositionIndex::find(std::uint64_t key, std::vector<PositionEntry>& found) const {
+    if (!entryCount) return;
+    std::size_t bucket = static_cast<std::size_t>(key >> 48);
+    std::uint64_t low = readFixed(buckets + bucket * 8, 8);
+    std::uint64_t high = std::min(readFixed(buckets + (bucket + 1) * 8, 8), entryCount);
+
+    // Lower bound of the key within the bucket.
+    while (low < high) {
+        std::uint64_t middle = low + (high - low) / 2;
+        if (readFixed(entries + middle * POSITION_ENTRY_BYTES, 8) < key) low = middle + 1;
+        else high = middle;
+    }
+    for (std::uint64_t i = low; i < entryCount; ++i) {
+        PositionEntry entry = readEntry(entries + i * POSITION_ENTRY_BYTES);
+        if (entry.key != key) break;
+        found.push_back(entry);
+    }
+}
+
+// Handles "index build <archive> <index> [--memory MB]" and "index query <index> <FEN>". A query
+// prints every game that reached the position, the results summed up and the lookup time.
+int runIndex(int argc, char* argv[]) {
+    typedef std::chrono::steady_clock Clock;
+    std::string command = argc > 2 ? argv[2] : "";
+
+    std::size_t megabytes = 256;
+    bool usage = false;
+    for (int i = 5; command == "build" && i < argc && !usage; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--memory" && i + 1 < argc) megabytes = std::strtoull(argv[++i], nullptr, 10);
+        else usage = true;
+    }
+    if (command == "build" && argc >= 5 && !usage && megabytes >= 1) {
+        Clock::time_point start = Clock::now();
+        if (!buildPositionIndex(argv[3], argv[4], megabytes << 20)) return 1;
+        PositionIndex index;
+        if (!index.open(argv[4])) {
+            std::cerr << "Cannot read back position index " << argv[4] << ".\n";
+            return 1;
+        }
+        std::cout << index.size() << " positions indexed in "
+                  << std::chrono::duration<double>(Clock::now() - start).count() << " s\n";
+        return 0;
+    }
+
+    if (command == "query" && argc >= 5) {
+        PositionIndex index;
+        if (!index.open(argv[3])) {
+            std::cerr << "Cannot read position index " << argv[3] << ".\n";
+            return 1;
+        }
+        std::string fen = argv[4];
+        for (int i = 5; i < argc; ++i) fen += std::string(" ") + argv[i];
+        Board board;
+        if (!board.fromFEN(fen)) {
+            std::cerr << "Invalid FEN.\n";
+            return 1;
+        }
+
+        std::vector<PositionEntry> found;
+        Clock::time_point start = Clock::now();
+        index.find(board.getHash(), found);
+        double micros = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+        int outcomes[4] = { 0, 0, 0, 0 };
+        for (const PositionEntry& entry : found) {
+            ++outcomes[static_cast<int>(entry.result)];
+            std::cout << "game " << entry.game + 1 << " ply " << entry.ply << " "
+                      << RESULT_NAMES[static_cast<int>(entry.result)] << "\n";
+        }
+        std::cout << found.size() << " games: +" << outcomes[1] << " -" << outcomes[2] << " =" << outcomes[3]
+                  << " (" << outcomes[0] << " unknown), lookup " << micros << " us\n";
+        return 0;
+    }
+
+    std::cerr << "Usage: " << argv[0] << " index build <archive> <index> [--memory MB]\n"
+              << "       " << argv[0] << " index query <index> <FEN>\n";
+    return 1;
+}
+
+// Fixed set of worker threads that run a batch of independent tasks, numbered 0 to count - 1.
+// Each worker starts with its own contiguous block of task numbers and takes them from the front; a
+// worker that runs out steals from the back of another worker's block. Neighbouring tasks therefore
+// tend to run on the same worker, and an unlucky worker holding a few slow tasks does not hold up
+// the batch. Workers only contend for a lock when they steal.
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<std::size_t> tasks;
+    };
+    int workerCount;
+
+public:
+    explicit WorkStealingPool(int workers) : workerCount(std::max(1, workers)) {}
+
+    int workers() const { return workerCount; }
+
+    // Runs task(index, worker) for every index below 'count' and returns when all have finished.
+    // 'worker' identifies the calling worker (0 to workers() - 1), so tasks can use per-worker state.
+    void run(std::size_t count, const std::function<void(std::size_t, int)>& task);
+};
+
+void WorkStealingPool::run(std::size_t count, const std::function<void(std::size_t, int)>& task) {
+    std::vector<WorkerQueue> queues(workerCount);
+    for (int w = 0; w < workerCount; ++w) {
+        std::size_t first = count * w / workerCount;
+        std::size_t last = count * (w + 1) / workerCount;
+        for (std::size_t i = first; i < last; ++i) queues[w].tasks.push_back(i);
+    }
+
+    auto work = [&queues, &task, this](int worker) {
+        while (true) {
+            std::size_t index = 0;
+            bool found = false;
+            // Own queue first, then the others in turn starting with the next worker.
+            for (int offset = 0; offset < workerCount && !found; ++offset) {
+                WorkerQueue& queue = queues[(worker + offset) % workerCount];
+                std::lock_guard<std::mutex> guard(queue.lock);
+                if (queue.tasks.empty()) continue;
+                if (offset == 0) {
+                    index = queue.tasks.front();
+                    queue.tasks.pop_front();
+                } else {
+                    index = queue.tasks.back();
+                    queue.tasks.pop_back();
+                }
+                found = true;
+            }
+            // Tasks never add tasks, so once every queue is empty the batch is done for this worker.
+            if (!found) return;
+            task(index, worker);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 1; w < workerCount; ++w) threads.emplace_back(work, w);
+    work(0);
+    // The calling thread is worker 0.
+    for (std::thread& thread : threads) thread.join();
+}
+
+// Returns the offset of the first game that starts at or after 'from': a tag line whose previous
+// non-blank line is not a tag line. Returns text.size() if there is none.
+static std::size_t nextGameStart(std::string_view text, std::size_t from) {
+    if (from == 0) return 0;
+    std::size_t line = text.find('\n', from - 1);
+    // Start at the beginning of a line, never in the middle of one.
+    bool previousWasTag = true;
+    // Unknown until a non-blank line is seen; assume the worst so a game is never split in two.
+    while (line != std::string_view::npos && line + 1 < text.size()) {
+        std::size_t start = line + 1;
+        char first = text[start];
+        if (first == '[' && !previousWasTag) return start;
+        if (!std::strchr(" \t\r\n", first)) previousWasTag = first == '[';
+        line = text.find('\n', start);
+    }
+    return text.size();
+}
+
+// A game that failed validation, with where the failure happened.
+struct GameFailure {
+    std::size_t index;       // Game number in the archive, counting from 0.
+    std::size_t offset;      // Byte offset of the game.
+    GameCheck check;
+    std::string fen;         // Position in which the failing move was read, if it got that far.
+};
+
+// Validation results of one contiguous slice of the archive.
+struct ShardResult {
+    std::size_t games = 0;
+    std::uint64_t plies = 0;
+    std::vector<GameFailure> failures;   // In input order.
+    std::string records;                 // Binary records of the valid games, when converting.
+    std::size_t recordCount = 0;
+};
+
+// Handles "pgn <file> [--threads N]": replays every game of a PGN archive, reports each invalid game
+// with the move that failed and the position it failed in, and prints the throughput.
+// The archive is cut into slices on game boundaries, a few per thread, and the slices are validated
+// on a work-stealing pool with one Board per worker. Each slice keeps its own results, so the report
+// comes out in input order whatever order the slices finish in. Returns 0 if every game is valid.
+int runPGN(int argc, char* argv[]) {
+    typedef std::chrono::steady_clock Clock;
+    int threads = 1;
+    const char* path = nullptr;
+    const char* convertPath = nullptr;
+    bool usage = false;
+    for (int i = 2; i < argc && !usage; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--threads" && hasValue) threads = std::atoi(argv[++i]);
+        else if (arg == "--convert" && hasValue) convertPath = argv[++i];
+        else if (!path && arg.compare(0, 1, "-") != 0) path = argv[i];
+        else usage = true;
+        // Only one input file, and never something that looks like a misspelled or incomplete option.
+    }
+    if (usage || !path || threads < 1) {
+        std::cerr << "Usage: " << argv[0] << " pgn <file> [--threads N] [--convert <archive>]\n";
+        return 1;
+    }
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Cannot open " << path << ".\n";
+        return 1;
+    }
+    GameArchiveWriter writer;
+    if (convertPath && !writer.open(convertPath)) {
+        std::cerr << "Cannot create " << convertPath << ".\n";
+        return 1;
+    }
+
+    Clock::time_point start = Clock::now();
+    const std::string_view archive = file.view();
+
+    // Sixteen slices per thread keep the load balanced without making the slices tiny.
+    const std::size_t sliceTarget = static_cast<std::size_t>(threads) * 16;
+    std::vector<std::size_t> bounds(1, 0);
+    for (std::size_t i = 1; i < sliceTarget; ++i) {
+        std::size_t bound = nextGameStart(archive, std::max(archive.size() / sliceTarget * i, bounds.back() + 1));
+        if (bound >= archive.size()) break;
+        bounds.push_back(bound);
+    }
+    bounds.push_back(archive.size());
+
+    const std::size_t slices = bounds.size() - 1;
+    std::vector<ShardResult> results(slices);
+    std::vector<Board> boards(threads);
+    WorkStealingPool pool(threads);
+    pool.run(slices, [&](std::size_t slice, int worker) {
+        ShardResult& result = results[slice];
+        Board& board = boards[worker];
+        PGNReader reader(archive.substr(bounds[slice], bounds[slice + 1] - bounds[slice]));
+        PGNGame game;
+        std::vector<std::pair<std::string_view, std::string_view>> tags;
+        while (reader.next(game)) {
+            GameCheck check = replayGame(game, board);
+            ++result.games;
+            result.plies += check.plies;
+            if (check.valid && convertPath) {
+                collectTags(game, tags);
+                encodeBoardGame(result.records, board, tags);
+                ++result.recordCount;
+            }
+            if (!check.valid) {
+                GameFailure failure;
+                failure.index = game.index;
+                // Numbered within the slice for now; made global when the results are merged.
+                failure.offset = bounds[slice] + game.offset;
+                failure.check = check;
+                if (check.token.data() != game.tag("FEN").data()) failure.fen = board.toFEN();
+                result.failures.push_back(failure);
+            }
+        }
+    });
+
+    std::size_t games = 0, invalid = 0;
+    std::uint64_t plies = 0;
+    for (const ShardResult& result : results) {
+        for (const GameFailure& failure : result.failures) {
+            std::cout << "Game " << games + failure.index + 1 << " (byte " << failure.offset << "): "
+                      << failure.check.error << " '" << failure.check.token << "' after "
+                      << failure.check.plies << " plies, at byte "
+                      << static_cast<std::size_t>(failure.check.token.data() - archive.data());
+            if (!failure.fen.empty()) std::cout << " in " << failure.fen;
+            std::cout << "\n";
+        }
+        games += result.games;
+        plies += result.plies;
+        invalid += result.failures.size();
+        if (convertPath) writer.writeRecords(result.records, result.recordCount);
+    }
+    if (convertPath && !writer.finish()) {
+        std::cerr << "Cannot write " << convertPath << ".\n";
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cout << games << " games (" << games - invalid << " valid, " << invalid << " invalid), "
+              << plies << " plies in " << seconds << " s on " << threads << " threads: "
+              << static_cast<std::uint64_t>(seconds > 0 ? games / seconds : 0) << " games/s, "
+              << static_cast<std::uint64_t>(seconds > 0 ? archive.size() / seconds / 1e6 : 0) << " MB/s\n";
+    return invalid == 0 ? 0 : 1;
+}
+
+// Fixed-capacity multi-producer, multi-consumer queue. All slots are allocated up front, so passing
+// items through it never touches the heap.
+template <typename T>
+class BoundedQueue {
+private:
+    std::vector<T> slots;
+    std::size_t head;
+    std::size_t count;
+    bool closed;
+    std::mutex lock;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+
+public:
+    explicit BoundedQueue(std::size_t capacity) : slots(capacity), head(0), count(0), closed(false) {}
+
+    // Adds an item. When the queue is full, waits for room if 'wait' is set and fails otherwise.
+    bool push(const T& item, bool wait);
+
+    // Removes the oldest item, waiting for one. Returns false once the queue is closed and empty.
+    bool pop(T& item);
+
+    // Removes the oldest item if there is one.
+    bool tryPop(T& item);
+
+    // Wakes every waiting consumer; pop() fails once the remaining items are drained.
+    void close();
+};
+
+template <typename T>
+bool BoundedQueue<T>::push(const T& item, bool wait) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (count == slots.size()) {
+        if (!wait) return false;
+        notFull.wait(guard, [this]() { return count < slots.size() || closed; });
+        if (closed) return false;
+    }
+    slots[(head + count) % slots.size()] = item;
+    ++count;
+    notEmpty.notify_one();
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::pop(T& item) {
+    std::unique_lock<std::mutex> guard(lock);
+    notEmpty.wait(guard, [this]() { return count > 0 || closed; });
+    if (count == 0) return false;
+    item = slots[head];
+    head = (head + 1) % slots.size();
+    --count;
+    notFull.notify_one();
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::tryPop(T& item) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (count == 0) return false;
+    item = slots[head];
+    head = (head + 1) % slots.size();
+    --count;
+    notFull.notify_one();
+    return true;
+}
+
+template <typename T>
+void BoundedQueue<T>::close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+}
+
+// Service mode. Clients connect over TCP and send one command per line:
+//   new                        start a game; replies "<id> ok"
+//   move <id> <from> <to>      e.g. "move 16777216 e2 e4"; replies "<id> ok [check|checkmate|stalemate|draw]"
+//                              or "<id> illegal". With --syzygy-play, a move into a tablebase position adds
+//                              "tablebase win|draw|loss" for the side to move (see Board::adjudicate).
+//   undo <id>                  take back the last move
+//   fen <id>                   replies "<id> ok <FEN>"
+//   close <id>                 end the game and return its board to the pool
+//   stats                      replies "stats <requests> <p50 us> <p99 us>" for validation latency
+//   shutdown                   stop the server
+// Every reply starts with the game id it is about. Replies about one game come in request order;
+// replies about different games may overtake each other.
+//
+// One event-loop thread owns the sockets: it reads lines, routes each to the worker that owns the
+// game and writes the replies back. Games live in a fixed pool of Board objects, and each board
+// belongs to exactly one worker (slot modulo the worker count), so workers never lock a board. Game ids
+// combine the pool slot with a generation number, so an id stays invalid after its game is closed
+// even when the slot is reused. Requests, replies and boards are all preallocated, and boards keep
+// their undo history capacity between games, so validating a move does not allocate.
+namespace server {
+
+const std::size_t LINE_BYTES = 64;
+// Longest accepted request line; longer lines are rejected.
+const int HISTORY_RESERVE = 1024;
+// Plies of undo history each pooled board reserves up front.
+const int LATENCY_BUCKETS = 4096;
+// Latency histogram resolution: one bucket per microsecond, the last one collecting the rest.
+
+enum class RequestKind : std::uint8_t { NEW, MOVE, UNDO, FEN, CLOSE };
+
+struct Request {
+    RequestKind kind;
+    std::uint32_t slot;
+    std::uint64_t gameId;
+    int connection;                 // Socket of the client, and its serial number, so a reply to a
+    std::uint64_t serial;           // client that has gone away is dropped rather than misdelivered.
+    char from[8];
+    char to[8];
+    std::chrono::steady_clock::time_point received;
+};
+
+struct Reply {
+    int connection;
+    std::uint64_t serial;
+    std::int64_t freedSlot;         // Slot to return to the free list after a close, or -1.
+    std::uint16_t length;
+    char text[128];
+};
+
+struct Connection {
+    int fd;
+    std::uint64_t serial;
+    std::size_t buffered;           // Bytes of an incomplete line waiting in 'input'.
+    char input[4096];
+    std::string output;             // Replies not yet written; its capacity is kept between writes.
+};
+
+// Appends text to a reply, truncating rather than overflowing.
+static void append(Reply& reply, std::string_view text) {
+    std::size_t room = sizeof(reply.text) - reply.length;
+    std::size_t n = std::min(room, text.size());
+    std::memcpy(reply.text + reply.length, text.data(), n);
+    reply.length = static_cast<std::uint16_t>(reply.length + n);
+}
+
+static void append(Reply& reply, std::uint64_t number) {
+    char digits[24];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), number);
+    append(reply, std::string_view(digits, result.ptr - digits));
+}
+
+class Server {
+private:
+    std::vector<Board> boards;
+    std::vector<std::uint32_t> generations;   // Current generation of each slot; odd while a game is open.
+    std::vector<std::uint32_t> freeSlots;     // Owned by the event loop.
+    std::vector<std::unique_ptr<BoundedQueue<Request>>> queues;   // One per worker.
+    BoundedQueue<Reply> replies;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<std::atomic<std::uint64_t>[]>> latency;   // Per-worker histograms.
+    int wakeFd;                               // eventfd the workers signal when replies are waiting.
+    std::atomic<bool> running;
+
+    static std::uint64_t makeId(std::uint32_t slot, std::uint32_t generation) {
+        return (static_cast<std::uint64_t>(generation) << 24) | slot;
+    }
+
+    void work(int worker);
+    void handle(const Request& request, Board& board, Reply& reply);
+    void parseLine(Connection& connection, std::string_view line);
+    void writeStats(Connection& connection);
+
+public:
+    Server(std::size_t games, int workerCount);
+    ~Server();
+
+    // Serves clients on the port until a client sends "shutdown". Returns false if the port cannot be opened.
+    bool run(int port);
+};
+
+Server::Server(std::size_t games, int workerCount)
+    : boards(games), generations(games, 0), replies(games * 2 + 1024), wakeFd(-1), running(false) {
+    static const BoardState initialState = Board().getState();
+    for (Board& board : boards) {
+        board.setState(initialState);
+        board.reserveHistory(HISTORY_RESERVE);
+    }
+    for (std::size_t slot = games; slot-- > 0;) freeSlots.push_back(static_cast<std::uint32_t>(slot));
+    for (int w = 0; w < workerCount; ++w) {
+        queues.emplace_back(new BoundedQueue<Request>(games / workerCount + 1024));
+        latency.emplace_back(new std::atomic<std::uint64_t>[LATENCY_BUCKETS]());
+    }
+}
+
+Server::~Server() {
+    for (auto& queue : queues) queue->close();
+    replies.close();
+    for (std::thread& worker : workers) worker.join();
+    if (wakeFd >= 0) ::close(wakeFd);
+}
+
+void Server::work(int worker) {
+    Request request;
+    Reply reply;
+    std::atomic<std::uint64_t>* histogram = latency[worker].get();
+    while (queues[worker]->pop(request)) {
+        reply.connection = request.connection;
+        reply.serial = request.serial;
+        reply.freedSlot = -1;
+        reply.length = 0;
+        handle(request, boards[request.slot], reply);
+        append(reply, "\n");
+
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - request.received).count();
+        histogram[std::min<std::int64_t>(micros, LATENCY_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+
+        if (!replies.push(reply, true)) return;
+        std::uint64_t one = 1;
+        ssize_t written = ::write(wakeFd, &one, sizeof(one));
+        (void)written;
+        // The eventfd counter only has to become non-zero; a failed write means it already is.
+    }
+}
+
+void Server::handle(const Request& request, Board& board, Reply& reply) {
+    static const BoardState initialState = Board().getState();
+    std::uint32_t& generation = generations[request.slot];
+
+    if (request.kind == RequestKind::NEW) {
+        // Slots handed out by the event loop are always closed, so the generation is even here.
+        ++generation;
+        board.setState(initialState);
+        append(reply, makeId(request.slot, generation));
+        append(reply, " ok");
+        return;
+    }
+
+    append(reply, request.gameId);
+    if (request.gameId != makeId(request.slot, generation) || generation % 2 == 0) {
+        append(reply, " error unknown game");
+        return;
+    }
+
+    switch (request.kind) {
+        case RequestKind::MOVE: {
+            // Square names are short enough for std::string's inline buffer, so this does not allocate.
+            if (!board.movePiece(request.from, request.to)) {
+                append(reply, " illegal");
+                break;
+            }
+            append(reply, " ok");
+            // A check is reported alongside a tablebase result, so the check is taken from status().
+            if (board.status() == GameStatus::CHECK) append(reply, " check");
+            switch (board.adjudicate()) {
+                case GameStatus::CHECKMATE: append(reply, " checkmate"); break;
+                case GameStatus::STALEMATE: append(reply, " stalemate"); break;
+                case GameStatus::DRAW: append(reply, " draw"); break;
+                case GameStatus::TABLEBASE_WIN: append(reply, " tablebase win"); break;
+                case GameStatus::TABLEBASE_DRAW: append(reply, " tablebase draw"); break;
+                case GameStatus::TABLEBASE_LOSS: append(reply, " tablebase loss"); break;
+                case GameStatus::CHECK:
+                case GameStatus::PLAYING: break;
+            }
+            break;
+        }
+        case RequestKind::UNDO:
+            if (board.canUndo()) {
+                board.unmakeMove();
+                append(reply, " ok");
+            } else {
+                append(reply, " error nothing to undo");
+            }
+            break;
+        case RequestKind::FEN: {
+            append(reply, " ok ");
+            thread_local std::string fen;
+            // Reused, so after the first request its capacity covers any FEN.
+            fen.clear();
+            appendFEN(board.getState(), fen);
+            append(reply, fen);
+            break;
+        }
+        default:
+            ++generation;
+            reply.freedSlot = request.slot;
+            append(reply, " ok");
+            break;
+    }
+}
+
+void Server::parseLine(Connection& connection, std::string_view line) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    std::string_view command = nextField(line);
+    if (command.empty()) return;
+
+    if (command == "stats") {
+        writeStats(connection);
+        return;
+    }
+    if (command == "shutdown") {
+        running = false;
+        return;
+    }
+
+    Request request;
+    request.connection = connection.fd;
+    request.serial = connection.serial;
+    request.received = std::chrono::steady_clock::now();
+    request.from[0] = request.to[0] = '\0';
+    request.gameId = 0;
+
+    if (command == "new") {
+        if (freeSlots.empty()) {
+            connection.output += "0 error no free board\n";
+            return;
+        }
+        request.kind = RequestKind::NEW;
+        request.slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else {
+        if (command == "move") request.kind = RequestKind::MOVE;
+        else if (command == "undo") request.kind = RequestKind::UNDO;
+        else if (command == "fen") request.kind = RequestKind::FEN;
+        else if (command == "close") request.kind = RequestKind::CLOSE;
+        else {
+            connection.output += "0 error unknown command\n";
+            return;
+        }
+        std::string_view id = nextField(line);
+        std::from_chars_result parsed = std::from_chars(id.data(), id.data() + id.size(), request.gameId);
+        request.slot = static_cast<std::uint32_t>(request.gameId & 0xFFFFFF);
+        if (id.empty() || parsed.ec != std::errc() || request.slot >= boards.size()) {
+            connection.output += "0 error bad game id\n";
+            return;
+        }
+        if (request.kind == RequestKind::MOVE) {
+            std::string_view from = nextField(line), to = nextField(line);
+            if (from.empty() || to.empty() || from.size() >= sizeof(request.from) || to.size() >= sizeof(request.to)) {
+                connection.output.append(id.data(), id.size());
+                connection.output += " illegal\n";
+                return;
+            }
+            std::memcpy(request.from, from.data(), from.size());
+            request.from[from.size()] = '\0';
+            std::memcpy(request.to, to.data(), to.size());
+            request.to[to.size()] = '\0';
+        }
+    }
+
+    // A full worker queue means the server is overloaded; refuse rather than stall every client.
+    if (!queues[request.slot % queues.size()]->push(request, false)) {
+        if (request.kind == RequestKind::NEW) freeSlots.push_back(request.slot);
+        connection.output += "0 error busy\n";
+    }
+}
+
+void Server::writeStats(Connection& connection) {
+    std::vector<std::uint64_t> totals(LATENCY_BUCKETS, 0);
+    std::uint64_t requests = 0;
+    for (const auto& histogram : latency) {
+        for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+            std::uint64_t n = histogram[b].load(std::memory_order_relaxed);
+            totals[b] += n;
+            requests += n;
+        }
+    }
+    // Smallest latency that the given fraction of requests did not exceed.
+    auto percentile = [&totals, requests](double fraction) {
+        std::uint64_t seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+            seen += totals[b];
+            if (seen > 0 && seen >= fraction * requests) return b;
+        }
+        return 0;
+    };
+    connection.output += "stats " + std::to_string(requests) + " " + std::to_string(percentile(0.5)) + " " +
+                         std::to_string(percentile(0.99)) + "\n";
+}
+
+bool Server::run(int port) {
+    int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int yes = 1;
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // Loopback only: the protocol has no authentication.
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::listen(listener, 512) < 0) {
+        if (listener >= 0) ::close(listener);
+        return false;
+    }
+
+    int poller = ::epoll_create1(0);
+    wakeFd = ::eventfd(0, EFD_NONBLOCK);
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.fd = listener;
+    ::epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+    event.data.fd = wakeFd;
+    ::epoll_ctl(poller, EPOLL_CTL_ADD, wakeFd, &event);
+
+    running = true;
+    for (int w = 0; w < static_cast<int>(queues.size()); ++w) workers.emplace_back(&Server::work, this, w);
+
+    std::vector<std::unique_ptr<Connection>> connections;   // Indexed by socket.
+    std::uint64_t nextSerial = 1;
+
+    // Writes as much pending output as the socket takes, and asks for EPOLLOUT if some is left over.
+    auto flush = [&poller](Connection& connection) {
+        std::size_t sent = 0;
+        while (sent < connection.output.size()) {
+            ssize_t n = ::send(connection.fd, connection.output.data() + sent, connection.output.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += static_cast<std::size_t>(n);
+        }
+        connection.output.erase(0, sent);
+        epoll_event update = epoll_event();
+        update.events = static_cast<std::uint32_t>(EPOLLIN) | (connection.output.empty() ? 0u : static_cast<std::uint32_t>(EPOLLOUT));
+        update.data.fd = connection.fd;
+        ::epoll_ctl(poller, EPOLL_CTL_MOD, connection.fd, &update);
+    };
+    auto disconnect = [&connections](int fd) {
+        ::close(fd);
+        connections[fd].reset();
+        // The epoll registration goes away with the socket.
+    };
+
+    epoll_event events[256];
+    while (running) {
+        int ready = ::epoll_wait(poller, events, 256, 100);
+        for (int e = 0; e < ready; ++e) {
+            int fd = events[e].data.fd;
+            if (fd == listener) {
+                int client;
+                while ((client = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                    ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                    if (static_cast<std::size_t>(client) >= connections.size()) connections.resize(client + 1);
+                    connections[client].reset(new Connection());
+                    connections[client]->fd = client;
+                    connections[client]->serial = nextSerial++;
+                    connections[client]->buffered = 0;
+                    connections[client]->output.reserve(1 << 16);
+                    epoll_event add = epoll_event();
+                    add.events = EPOLLIN;
+                    add.data.fd = client;
+                    ::epoll_ctl(poller, EPOLL_CTL_ADD, client, &add);
+                }
+            } else if (fd == wakeFd) {
+                std::uint64_t count;
+                ssize_t drained = ::read(wakeFd, &count, sizeof(count));
+                (void)drained;
+                Reply reply;
+                while (replies.tryPop(reply)) {
+                    if (reply.freedSlot >= 0) freeSlots.push_back(static_cast<std::uint32_t>(reply.freedSlot));
+                    Connection* connection = static_cast<std::size_t>(reply.connection) < connections.size()
+                                                 ? connections[reply.connection].get() : nullptr;
+                    if (!connection || connection->serial != reply.serial) continue;
+                    connection->output.append(reply.text, reply.length);
+                    flush(*connection);
+                }
+            } else if (connections[fd]) {
+                Connection& connection = *connections[fd];
+                if (events[e].events & EPOLLOUT) flush(connection);
+                if (!(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+
+                ssize_t n = ::recv(fd, connection.input + connection.buffered,
+                                   sizeof(connection.input) - connection.buffered, 0);
+                if (n <= 0) {
+                    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) disconnect(fd);
+                    continue;
+                }
+                connection.buffered += static_cast<std::size_t>(n);
+
+                // Handle every complete line and keep the incomplete tail for the next read.
+                std::string_view pending(connection.input, connection.buffered);
+                std::size_t newline;
+                while ((newline = pending.find('\n')) != std::string_view::npos) {
+                    std::string_view line = pending.substr(0, newline);
+                    if (line.size() <= LINE_BYTES) parseLine(connection, line);
+                    else connection.output += "0 error line too long\n";
+                    pending.remove_prefix(newline + 1);
+                }
+                if (pending.size() == sizeof(connection.input)) {
+                    pending = std::string_view();
+                    // A full buffer without a newline is not a request; drop it.
+                    connection.output += "0 error line too long\n";
+                }
+                std::memmove(connection.input, pending.data(), pending.size());
+                connection.buffered = pending.size();
+                flush(connection);
+            }
+        }
+    }
+
+    for (auto& connection : connections) {
+        if (connection) ::close(connection->fd);
+    }
+    ::close(poller);
+    ::close(listener);
+    return true;
+}
+
+}  // namespace server
+
+// Handles "server [--port P] [--games N] [--workers W] [--syzygy DIRS] [--syzygy-play]": runs the game service until a client sends
+// "shutdown".
+int runServer(int argc, char* argv[]) {
+    int port = 7777;
+    std::size_t games = 4096;
+    int workers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    bool usage = false;
+    for (int i = 2; i < argc && !usage; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--port" && hasValue) port = std::atoi(argv[++i]);
+        else if (arg == "--games" && hasValue) games = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--workers" && hasValue) workers = std::atoi(argv[++i]);
+        else if (arg == "--syzygy" && hasValue) tablebases.init(argv[++i]);
+        else if (arg == "--syzygy-play") tablebases.setPlay(true);
+        else usage = true;
+    }
+    if (usage || port <= 0 || port > 65535 || games < 1 || games > (1u << 24) || workers < 1) {
+        std::cerr << "Usage: " << argv[0] << " server [--port P] [--games N] [--workers W] [--syzygy DIRS] [--syzygy-play]\n";
+        return 1;
+    }
+
+    server::Server service(games, workers);
+    std::cout << "Serving " << games << " boards on 127.0.0.1:" << port << " with " << workers << " workers.\n";
+    std::cout.flush();
+    if (!service.run(port)) {
+        std::cerr << "Cannot listen on port " << port << ".\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Settings of one side of a self-play match.
+struct MatchEngine {
+    SearchLimits limits;
+    bool network = true;    // Evaluates with the loaded network, if there is one; otherwise with Evaluator.
+};
+
+// Elo difference for an expected score, from the logistic model the rating system uses.
+static double eloFromScore(double score) {
+    score = std::min(std::max(score, 1e-6), 1 - 1e-6);
+    return 400 * std::log10(score / (1 - score));
+}
+
+// Log-likelihood ratio of "A is elo1 stronger than B" against "elo0 stronger", from the win, draw
+// and loss counts (the trinomial approximation fishtest-style testers use).
+static double sprtLLR(std::uint64_t wins, std::uint64_t draws, std::uint64_t losses, double elo0, double elo1) {
+    double games = static_cast<double>(wins + draws + losses);
+    if (games == 0) return 0;
+    double score = (wins + 0.5 * draws) / games;
+    double variance = (wins * (1 - score) * (1 - score) + draws * (0.5 - score) * (0.5 - score) + losses * score * score) / games;
+    if (variance <= 0) return 0;
+    // Every game has had the same result, which says nothing yet about the spread.
+    double score0 = 1 / (1 + std::pow(10, -elo0 / 400)), score1 = 1 / (1 + std::pow(10, -elo1 / 400));
+    return (score1 - score0) * (2 * score - score0 - score1) * games / (2 * variance);
+}
+
+// Entry point for "match": self-play between two engine settings A and B, for measuring throughput and
+// checking that a change to the search or evaluation gains strength.
+//   match [--games N] [--concurrency C] [--nodes N] [--movetime MS] [--depth D] [--eval nnue|classical]
+//         [--a-<option> V] [--b-<option> V] [--hash MB] [--openings EPD] [--nnue FILE] [--syzygy DIRS]
+//         [--syzygy-play] [--max-plies N] [--sprt ELO0 ELO1] [--alpha A] [--beta B] [--archive FILE]
+// --nodes, --movetime, --depth and --eval set both sides; with an --a- or --b- prefix they set one.
+// Each opening (the starting position without --openings) is played twice with colors reversed. A game
+// ends by Board::adjudicate() (mate, stalemate, repetition, the fifty-move rule, or with --syzygy-play
+// the tablebases once it reaches them), or as a draw after --max-plies. Results are counted from A's point of view; with
+// --sprt, no new games start once the test accepts or rejects. Returns the process exit code.
+int runMatch(int argc, char* argv[]) {
+    typedef std::chrono::steady_clock Clock;
+    MatchEngine engines[2];
+    int games = 100, maxPlies = 400, hashMegabytes = 16;
+    int concurrency = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    double elo0 = 0, elo1 = 0, alpha = 0.05, beta = 0.05;
+    bool sprt = false, usage = false;
+    std::string openingsPath, networkPath, archivePath;
+
+    auto setEngineOption = [](MatchEngine& engine, const std::string& name, const char* value) {
+        if (name == "--nodes") engine.limits.maxNodes = std::strtoull(value, nullptr, 10);
+        else if (name == "--movetime") engine.limits.moveTimeMs = std::atoi(value);
+        else if (name == "--depth") engine.limits.maxDepth = std::atoi(value);
+        else if (name == "--eval" && (std::strcmp(value, "nnue") == 0 || std::strcmp(value, "classical") == 0)) {
+            engine.network = std::strcmp(value, "nnue") == 0;
+        } else {
+            return false;
+        }
+        return true;
+    };
+    for (int i = 2; i < argc && !usage; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--syzygy-play") tablebases.setPlay(true);
+        else if (!hasValue) usage = true;
+        else if (arg.compare(0, 4, "--a-") == 0) usage = !setEngineOption(engines[0], "--" + arg.substr(4), argv[++i]);
+        else if (arg.compare(0, 4, "--b-") == 0) usage = !setEngineOption(engines[1], "--" + arg.substr(4), argv[++i]);
+        else if (setEngineOption(engines[0], arg, argv[i + 1])) setEngineOption(engines[1], arg, argv[++i]);
+        else if (arg == "--games") games = std::atoi(argv[++i]);
+        else if (arg == "--concurrency") concurrency = std::atoi(argv[++i]);
+        else if (arg == "--hash") hashMegabytes = std::atoi(argv[++i]);
+        else if (arg == "--max-plies") maxPlies = std::atoi(argv[++i]);
+        else if (arg == "--openings") openingsPath = argv[++i];
+        else if (arg == "--nnue") networkPath = argv[++i];
+        else if (arg == "--syzygy") tablebases.init(argv[++i]);
+        else if (arg == "--archive") archivePath = argv[++i];
+        else if (arg == "--alpha") alpha = std::atof(argv[++i]);
+        else if (arg == "--beta") beta = std::atof(argv[++i]);
+        else if (arg == "--sprt" && i + 2 < argc) {
+            sprt = true;
+            elo0 = std::atof(argv[++i]);
+            elo1 = std::atof(argv[++i]);
+        } else {
+            usage = true;
+        }
+    }
+    for (MatchEngine& engine : engines) {
+        if (!engine.limits.maxNodes && !engine.limits.moveTimeMs && !engine.limits.maxDepth) engine.limits.maxNodes = 10000;
+    }
+    if (usage || games < 1 || concurrency < 1 || hashMegabytes < 1 || maxPlies < 1 || (sprt && elo1 <= elo0) ||
+        alpha <= 0 || alpha >= 1 || beta <= 0 || beta >= 1) {
+        std::cerr << "Usage: " << argv[0]
+                  << " match [--games N] [--concurrency C] [--nodes N] [--movetime MS] [--depth D]"
+                  << " [--eval nnue|classical] [--a-<option> V] [--b-<option> V] [--hash MB] [--openings EPD]"
+                  << " [--nnue FILE] [--syzygy DIRS] [--syzygy-play] [--max-plies N] [--sprt ELO0 ELO1] [--alpha A] [--beta B]"
+                  << " [--archive FILE]\n";
+        return 1;
+    }
+    if (!networkPath.empty() && !network.load(networkPath.c_str())) {
+        std::cerr << "Cannot load network " << networkPath << ".\n";
+        return 1;
+    }
+
+    std::vector<BoardState> openings;
+    if (!openingsPath.empty()) {
+        std::ifstream in(openingsPath);
+        if (!in) {
+            std::cerr << "Cannot open " << openingsPath << ".\n";
+            return 1;
+        }
+        EPDReader reader(in);
+        EPDRecord record;
+        while (reader.next(record)) openings.push_back(record.state);
+        if (openings.empty()) {
+            std::cerr << "No positions in " << openingsPath << ".\n";
+            return 1;
+        }
+    } else {
+        openings.push_back(Board().getState());
+    }
+
+    GameArchiveWriter archive;
+    if (!archivePath.empty() && !archive.open(archivePath.c_str())) {
+        std::cerr << "Cannot create " << archivePath << ".\n";
+        return 1;
+    }
+
+    // Shared by the workers: the next game to start, the results so far and the SPRT verdict.
+    std::atomic<int> nextGame(0);
+    std::atomic<bool> decided(false);
+    std::mutex resultLock;
+    std::uint64_t wins = 0, draws = 0, losses = 0;
+    int finished = 0, adjudicated = 0;
+    const int reportEvery = std::max(1, games / 10);
+    const double lowerBound = std::log(beta / (1 - alpha)), upperBound = std::log((1 - beta) / alpha);
+    const Clock::time_point start = Clock::now();
+
+    struct WorkerStats {
+        std::uint64_t nodes = 0;
+        double searchSeconds = 0;
+        int games = 0;
+    };
+    std::vector<WorkerStats> workerStats(static_cast<std::size_t>(concurrency));
+
+    auto report = [&]() {
+        std::uint64_t played = wins + draws + losses;
+        double score = (wins + 0.5 * draws) / played;
+        // 95% interval of the Elo difference, from the standard error of the mean score.
+        double deviation = std::sqrt((wins * (1 - score) * (1 - score) + draws * (0.5 - score) * (0.5 - score) +
+                                      losses * score * score) / played / played);
+        double elo = eloFromScore(score);
+        double margin = (eloFromScore(score + 1.96 * deviation) - eloFromScore(score - 1.96 * deviation)) / 2;
+        std::cout << "Games " << played << ": +" << wins << " -" << losses << " =" << draws << ", score " << score
+                  << ", Elo " << elo << " +/- " << margin;
+        if (sprt) {
+            std::cout << ", LLR " << sprtLLR(wins, draws, losses, elo0, elo1) << " (" << lowerBound << ", " << upperBound
+                      << ") [" << elo0 << ", " << elo1 << "]";
+        }
+        std::cout << "\n";
+    };
+
+    auto work = [&](int worker) {
+        // Each side keeps its own table, as two separate engines would.
+        std::unique_ptr<TranspositionTable> tables[2];
+        std::unique_ptr<Search> searches[2];
+        for (int side = 0; side < 2; ++side) {
+            tables[side] = std::make_unique<TranspositionTable>(static_cast<std::size_t>(hashMegabytes));
+            searches[side] = std::make_unique<Search>(*tables[side]);
+            searches[side]->setUseNetwork(engines[side].network);
+        }
+        Board board;
+        board.reserveHistory(static_cast<std::size_t>(maxPlies));
+        std::string record;
+        WorkerStats& stats = workerStats[static_cast<std::size_t>(worker)];
+
+        for (int game; !decided.load(std::memory_order_relaxed) && (game = nextGame.fetch_add(1)) < games;) {
+            board.setState(openings[static_cast<std::size_t>(game / 2) % openings.size()]);
+            tables[0]->clear();
+            tables[1]->clear();
+            // Engine A has the first move of the opening in even games, engine B in odd ones.
+            const Color firstMover = board.getTurn();
+            auto engineFor = [&](Color turn) { return (turn == firstMover) == (game % 2 == 0) ? 0 : 1; };
+
+            // The result for the side to move when the game ends: 1 win, 0 draw, -1 loss.
+            int result = 0;
+            bool byTablebase = false;
+            for (int ply = 0; ply < maxPlies; ++ply) {
+                GameStatus status = board.adjudicate();
+                if (status == GameStatus::CHECKMATE || status == GameStatus::TABLEBASE_LOSS) result = -1;
+                if (status == GameStatus::TABLEBASE_WIN) result = 1;
+                byTablebase = status == GameStatus::TABLEBASE_WIN || status == GameStatus::TABLEBASE_DRAW ||
+                              status == GameStatus::TABLEBASE_LOSS;
+                if (status != GameStatus::PLAYING && status != GameStatus::CHECK) break;
+                int side = engineFor(board.getTurn());
+                SearchResult searched = searches[side]->run(board, engines[side].limits);
+                stats.nodes += searched.nodes;
+                stats.searchSeconds += searched.seconds;
+                board.makeMove(searched.bestMove);
+            }
+            // Engine A's result: the side to move's, negated if that is engine B.
+            int resultA = engineFor(board.getTurn()) == 0 ? result : -result;
+            ++stats.games;
+
+            if (!archivePath.empty()) {
+                bool whiteIsA = engineFor(Color::WHITE) == 0;
+                int resultWhite = board.getTurn() == Color::WHITE ? result : -result;
+                record.clear();
+                encodeBoardGame(record, board, { { "Event", "Self-play match" }, { "White", whiteIsA ? "A" : "B" },
+                                                 { "Black", whiteIsA ? "B" : "A" },
+                                                 { "Result", resultWhite > 0 ? "1-0" : resultWhite < 0 ? "0-1" : "1/2-1/2" } });
+            }
+
+            std::lock_guard<std::mutex> guard(resultLock);
+            if (!archivePath.empty()) archive.writeRecords(record, 1);
+            (resultA > 0 ? wins : resultA < 0 ? losses : draws) += 1;
+            adjudicated += byTablebase;
+            if (++finished % reportEvery == 0) report();
+            if (sprt) {
+                double llr = sprtLLR(wins, draws, losses, elo0, elo1);
+                if (llr <= lowerBound || llr >= upperBound) decided.store(true, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int worker = 1; worker < concurrency; ++worker) workers.emplace_back(work, worker);
+    work(0);
+    for (std::thread& worker : workers) worker.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (finished % reportEvery != 0) report();
+    std::cout << finished << " games in " << seconds << " s, " << finished / seconds << " games/s";
+    if (adjudicated) std::cout << ", " << adjudicated << " adjudicated by tablebases";
+    std::cout << "\n";
+    for (std::size_t worker = 0; worker < workerStats.size(); ++worker) {
+        const WorkerStats& stats = workerStats[worker];
+        std::cout << "thread " << worker << ": " << stats.games << " games, " << stats.nodes << " nodes, "
+                  << static_cast<std::uint64_t>(stats.searchSeconds > 0 ? stats.nodes / stats.searchSeconds : 0) << " nps\n";
+    }
+    if (sprt) {
+        double llr = sprtLLR(wins, draws, losses, elo0, elo1);
+        std::cout << "SPRT: " << (llr >= upperBound ? "H1 accepted" : llr <= lowerBound ? "H0 accepted" : "inconclusive") << "\n";
+    }
+    if (!archivePath.empty() && !archive.finish()) {
+        std::cerr << "Cannot write " << archivePath << ".\n";
+        return 1;
+    }
+    return 0;
+}
+
+//This is the main game loop, where the board is displayed, and the user is prompted for input. The loop continues until the program is terminated.
+//Passing "perft" as the first argument runs the move generation benchmark instead (see runPerft),
+//"bench" times the board's calls over fixed position sets (see runBench),
+//"uci" (also accepted as the first command) speaks the UCI protocol for chess GUIs (see runUCI),
+//"search" analyses a single position (see runSearch), "book" lists a Polyglot book's moves (see runBook),
+//"match" plays the engine against itself for throughput and strength testing (see runMatch),
+//"pgn" validates a game archive (see runPGN)
+//"games" reads a binary game archive (see runGames), "index" builds or queries a position index
+//over one (see runIndex), "server" hosts many games over TCP (see runServer) and "syzygy" probes
+//the endgame tablebases for one position (see runSyzygy).
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "perft") {
+        return runPerft(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        return runBench(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "uci") {
+        return runUCI();
+    }
+    if (argc > 1 && std::string(argv[1]) == "book") {
+        return runBook(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "search") {
+        return runSearch(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "match") {
+        return runMatch(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "pgn") {
+        return runPGN(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "games") {
+        return runGames(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "index") {
+        return runIndex(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "server") {
+        return runServer(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "syzygy") {
+        return runSyzygy(argc, argv);
+    }
+
+    std::cout << "Welcome to My Chess Game!\n";
+    std::cout << "In this game, you will move pieces on a chessboard to checkmate your opponent.\n";
+    std::cout << "Each player takes turns moving one piece at a time.\n";
+    std::cout << "Type your move using standard chess notation (e.g., 'e2 e4').\n";
+    std::cout << "You can move a piece to an empty square or capture an opponent's piece by moving to its square.\n";
+    std::cout << "Type 'undo' to take back the last move, or 'computer' to let the engine move for you.\n";
+    std::cout << "Type 'save' and a file name to store the game so far in a binary game archive.\n\n";
+    std::cout << "Let's get started!\n\n";
+
+
+    Board board;
+    board.display();  
+
+    TranspositionTable table(64);
+    ParallelSearch engine(table, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+    // The engine thinks for about a second per move on every core when asked to play
+
+    std::string from, to;
+    while (true) {
+        // Display the current player's turn
+        std::cout << "It's " << board.getTurnName() << "'s turn.\n";
+        std::cout << "Enter your move in the format 'from_square to_square' (e.g., 'e2 e4').\n";
+        std::cout << "Example: Move your pawn from 'e2' to 'e4'.\n";
+        if (!(std::cin >> from)) break;
+        // Stop when the input ends instead of re-reading an exhausted stream forever
+
+        if (from == "uci" && !board.canUndo()) {
+            // A chess GUI started the program: hand standard input over to the UCI front end
+            return runUCI();
+        }
+
+        if (from == "undo") {
+            // Take back the last move using the board's undo stack
+            if (board.canUndo()) {
+                board.unmakeMove();
+                board.display();
+            } else {
+                std::cout << "\nThere is no move to undo.\n";
+            }
+            continue;
+        }
+        if (from == "save") {
+            // Store the moves played so far; 'games <file> 1' prints them back
+            std::string path;
+            if (!(std::cin >> path)) break;
+            GameArchiveWriter writer;
+            std::string record;
+            encodeBoardGame(record, board, { { "Event", "Interactive game" } });
+            bool saved = writer.open(path.c_str());
+            if (saved) writer.writeRecords(record, 1);
+            saved = saved && writer.finish();
+            std::cout << (saved ? "\nGame saved to " : "\nCould not save the game to ") << path << ".\n";
+            continue;
+        }
+        if (from == "computer") {
+            // Let the engine pick the move, then play it like a typed one
+            SearchLimits limits;
+            limits.moveTimeMs = 1000;
+            SearchResult result = engine.run(board, limits);
+            if (result.bestMove.isNone()) continue;
+            std::string move = result.bestMove.toString();
+            from = move.substr(0, 2);
+            to = move.substr(2);
+            std::cout << "\nThe computer plays " << from << " " << to << ".\n";
+        } else if (!(std::cin >> to)) {
+            break;
+        }
+
+        if (board.movePiece(from, to)) {
+            board.display();
+
+// Check if the game is over
+            GameStatus status = board.status();
+            // One pass over the legal moves answers checkmate, stalemate and draw together
+            if (status == GameStatus::CHECKMATE) {
+                std::cout << "\nCheckmate! " << board.getTurnName() << " is in checkmate! Game over.\n";
+                std::cout << "Congratulations to the winner, " << board.getTurnName() << "!\n";
+                std::cout << "Would you like to play again? (Y/N)\n";
+                break;
+              // Ask the user if they want to play again
+            } else if (status == GameStatus::STALEMATE) {
+                std::cout << "\nIt's a Stalemate! Neither player can make a legal move. Game over.\n";
+                std::cout << "No winner this time. Better luck next time!\n";
+                break;
+            } else if (status == GameStatus::DRAW) {
+                std::cout << "\nIt's a draw by repetition or the fifty-move rule. Game over.\n";
                 std::cout << "No winner this time. Better luck next time!\n";
                 break;
             }